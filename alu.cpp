@@ -0,0 +1,3 @@
+#include "alu.hpp"
+
+constinit const Alu::Tables Alu::tables = Alu::build();
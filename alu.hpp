@@ -0,0 +1,107 @@
+#ifndef ALU_H
+#define ALU_H
+
+#include <cstdint>
+
+/**
+ * @brief 8-bit addition, subtraction and DAA with their flags, computed
+ * bitwise or looked up in tables generated at compile time.
+ *
+ * Results are packed like AF: the result in the low byte and F (ZNHC0000) in
+ * the high byte, so a table lookup yields both in one load. With the
+ * GB_ALU_TABLES build option the CPU's ADD/ADC/SUB/SBC/CP and DAA use the
+ * tables instead of computing the flags.
+ */
+struct Alu {
+    /**
+     * @brief Computes `x + y + c` and its flags: Z, N reset, H on a carry
+     * from bit 3, C on a carry from bit 7.
+     */
+    static constexpr uint16_t add(uint8_t x, uint8_t y, uint8_t c) {
+        uint8_t res = x + y + c;
+        bool h = (x & 0xF) + (y & 0xF) + c > 0xF;
+        bool cr = y > UINT8_MAX - (x + c);
+
+        return res | pack(!res, false, h, cr) << 8;
+    }
+
+    /**
+     * @brief Computes `x - y - c` and its flags: Z, N set, H on a borrow
+     * from bit 4, C on a borrow from bit 8.
+     */
+    static constexpr uint16_t sub(uint8_t x, uint8_t y, uint8_t c) {
+        uint8_t res = x - y - c;
+        bool h = (x & 0xF) - c < (y & 0xF);
+        bool cr = y > (x - c);
+
+        return res | pack(!res, true, h, cr) << 8;
+    }
+
+    /**
+     * @brief Decimal-adjusts `a` after a BCD addition (`n` clear) or
+     * subtraction (`n` set) that left the flags `h` and `c`. Z, N unchanged,
+     * H reset, C set if the upper digit was adjusted.
+     */
+    static constexpr uint16_t daa(uint8_t a, bool n, bool h, bool c) {
+        uint8_t correction = (h ? 0x06 : 0) | (c ? 0x60 : 0);
+
+        if (!n) {
+            if ((a & 0x0F) > 0x09) {
+                correction |= 0x06;
+            }
+
+            if (a > 0x99) {
+                correction |= 0x60;
+            }
+        }
+
+        uint8_t res = n ? a - correction : a + correction;
+
+        return res | pack(!res, n, false, correction & 0x60) << 8;
+    }
+
+    /**
+     * @brief Every result of `add`, `sub` and `daa`, indexed by their operands.
+     */
+    struct Tables {
+        uint16_t add[2][256][256]; // [c][x][y]
+        uint16_t sub[2][256][256]; // [c][x][y]
+        uint16_t daa[8][256];      // [n << 2 | h << 1 | c][a]
+    };
+
+    /**
+     * @brief The tables, built by the compiler (alu.cpp); 514 KiB of read-only data.
+     */
+    static const Tables tables;
+
+    /**
+     * @brief Fills a `Tables` from `add`, `sub` and `daa`; only run at compile time.
+     */
+    static constexpr Tables build() {
+        Tables t{};
+
+        for (unsigned c = 0; c < 2; c++) {
+            for (unsigned x = 0; x < 256; x++) {
+                for (unsigned y = 0; y < 256; y++) {
+                    t.add[c][x][y] = add(x, y, c);
+                    t.sub[c][x][y] = sub(x, y, c);
+                }
+            }
+        }
+
+        for (unsigned nhc = 0; nhc < 8; nhc++) {
+            for (unsigned a = 0; a < 256; a++) {
+                t.daa[nhc][a] = daa(a, nhc & 4, nhc & 2, nhc & 1);
+            }
+        }
+
+        return t;
+    }
+
+private:
+    static constexpr uint8_t pack(bool z, bool n, bool h, bool c) {
+        return (z << 7) | (n << 6) | (h << 5) | (c << 4);
+    }
+};
+
+#endif
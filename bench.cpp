@@ -0,0 +1,607 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <functional>
+#include <tuple>
+#include <algorithm>
+
+#include "gba.hpp"
+#include "alu.hpp"
+#include "pixels.hpp"
+
+/**
+ * @brief Size of the synthetic cartridge (32 KiB, no MBC).
+ */
+static constexpr size_t ROM_SIZE = 0x8000;
+
+/**
+ * @brief Start of the generated loop body. The loop head at 0x150 resets the pointer registers.
+ */
+static constexpr uint16_t LOOP_START = 0x150;
+
+/**
+ * @brief Address of the `ret` used as the target of every generated `call`.
+ */
+static constexpr uint16_t CALL_TARGET = 0x7FF0;
+
+/**
+ * @brief Number of opcode bytes generated per loop iteration. Kept small enough
+ * that `ld (hl+),a` runs can never walk HL out of work RAM.
+ */
+static constexpr size_t BODY_SIZE = 0x1000;
+
+/**
+ * @brief Appends one randomly chosen instruction of a mix to the loop body.
+ *
+ * Generated code only reads and writes memory through HL (reset to 0xC000 at
+ * the top of the loop), never writes H or L directly and keeps the stack
+ * balanced, so any sequence of these instructions can run forever.
+ */
+using Emitter = std::function<void(std::vector<uint8_t>&, std::mt19937&)>;
+
+/**
+ * @brief Returns a uniformly distributed integer in [0, n).
+ */
+static unsigned pick(std::mt19937& rng, unsigned n) {
+    return std::uniform_int_distribution<unsigned>(0, n - 1)(rng);
+}
+
+/**
+ * @brief Keeps the compiler from dropping the computation of `value`, or the stores
+ * to memory before this call, as unused.
+ */
+template<class T> static void doNotOptimize(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+/**
+ * @brief Picks an 8-bit register operand that may be written: B, C, D, E or A.
+ */
+static uint8_t destReg(std::mt19937& rng) {
+    static constexpr uint8_t regs[] = { 0, 1, 2, 3, 7 };
+    return regs[pick(rng, 5)];
+}
+
+/**
+ * @brief Picks any 8-bit source operand, including H, L and (HL).
+ */
+static uint8_t srcReg(std::mt19937& rng) {
+    return pick(rng, 8);
+}
+
+/**
+ * @brief 8-bit arithmetic and logic: ALU A,r / ALU A,d8, INC/DEC r, DAA, CPL, SCF, CCF and the A rotates.
+ */
+static void emitAlu(std::vector<uint8_t>& out, std::mt19937& rng) {
+    static constexpr uint8_t misc[] = { 0x27, 0x2F, 0x37, 0x3F, 0x07, 0x0F, 0x17, 0x1F };
+
+    switch (pick(rng, 6)) {
+    case 0:
+    case 1:
+    case 2:
+        out.push_back(0x80 | (pick(rng, 8) << 3) | srcReg(rng));
+        break;
+    case 3:
+        out.push_back(0xC6 | (pick(rng, 8) << 3));
+        out.push_back(pick(rng, 256));
+        break;
+    case 4:
+        out.push_back(0x04 | (destReg(rng) << 3) | pick(rng, 2));
+        break;
+    default:
+        out.push_back(misc[pick(rng, 8)]);
+        break;
+    }
+}
+
+/**
+ * @brief Loads and stores: LD r,r', LD r,d8, LD (HL),r, LD A,(HL+/-), LD (HL+),A, LDH, PUSH/POP and INC/DEC rr.
+ */
+static void emitLoad(std::vector<uint8_t>& out, std::mt19937& rng) {
+    switch (pick(rng, 9)) {
+    case 0:
+    case 1:
+    case 2:
+    {
+        uint8_t src = srcReg(rng), dst = destReg(rng);
+        out.push_back(0x40 | (dst << 3) | src);
+        break;
+    }
+    case 3:
+        out.push_back(0x06 | (destReg(rng) << 3));
+        out.push_back(pick(rng, 256));
+        break;
+    case 4:
+        out.push_back(0x70 | destReg(rng));
+        break;
+    case 5:
+    {
+        static constexpr uint8_t ops[] = { 0x22, 0x2A, 0x3A, 0x0A, 0x1A };
+        out.push_back(ops[pick(rng, 5)]);
+        break;
+    }
+    case 6:
+        out.push_back(pick(rng, 2) ? 0xE0 : 0xF0);
+        out.push_back(0x80 + pick(rng, 0x70));
+        break;
+    case 7:
+    {
+        static constexpr uint8_t push[] = { 0xC5, 0xD5, 0xE5, 0xF5 };
+        static constexpr uint8_t pop[] = { 0xC1, 0xD1, 0xF1 };
+        out.push_back(push[pick(rng, 4)]);
+        out.push_back(pop[pick(rng, 3)]);
+        break;
+    }
+    default:
+    {
+        static constexpr uint8_t ops[] = { 0x03, 0x0B, 0x13, 0x1B };
+        out.push_back(ops[pick(rng, 4)]);
+        break;
+    }
+    }
+}
+
+/**
+ * @brief CB-prefixed rotates, shifts, SWAP, BIT, RES and SET on registers and (HL).
+ */
+static void emitCb(std::vector<uint8_t>& out, std::mt19937& rng) {
+    uint8_t op = pick(rng, 256);
+
+    // Keep H and L intact unless the operation only reads them (BIT)
+    if ((op & 7) == 4 || (op & 7) == 5) {
+        if (op < 0x40 || op >= 0x80) {
+            op = (op & ~7) | destReg(rng);
+        }
+    }
+
+    out.push_back(0xCB);
+    out.push_back(op);
+}
+
+/**
+ * @brief Control flow that always falls through to the next instruction:
+ * JR/JP (conditional or not) to the next instruction, CALL to a RET, and flag-setting CP.
+ */
+static void emitBranch(std::vector<uint8_t>& out, std::mt19937& rng) {
+    switch (pick(rng, 5)) {
+    case 0:
+        out.push_back(pick(rng, 2) ? 0x18 : 0x20 | (pick(rng, 4) << 3));
+        out.push_back(0);
+        break;
+    case 1:
+    {
+        uint16_t next = LOOP_START + out.size() + 3;
+        out.push_back(pick(rng, 2) ? 0xC3 : 0xC2 | (pick(rng, 4) << 3));
+        out.push_back(next & 0xFF);
+        out.push_back(next >> 8);
+        break;
+    }
+    case 2:
+        out.push_back(pick(rng, 2) ? 0xCD : 0xC4 | (pick(rng, 4) << 3));
+        out.push_back(CALL_TARGET & 0xFF);
+        out.push_back(CALL_TARGET >> 8);
+        break;
+    default:
+        out.push_back(0xFE);
+        out.push_back(pick(rng, 256));
+        break;
+    }
+}
+
+/**
+ * @brief A rough game-like blend: mostly loads and ALU, some branches and CB ops.
+ */
+static void emitMix(std::vector<uint8_t>& out, std::mt19937& rng) {
+    unsigned n = pick(rng, 100);
+
+    if (n < 40) {
+        emitLoad(out, rng);
+    }
+    else if (n < 70) {
+        emitAlu(out, rng);
+    }
+    else if (n < 85) {
+        emitBranch(out, rng);
+    }
+    else {
+        emitCb(out, rng);
+    }
+}
+
+/**
+ * @brief Builds a 32 KiB ROM-only cartridge whose entry point loops over
+ * `BODY_SIZE` bytes of instructions produced by `emit`.
+ */
+static std::string buildRom(const Emitter& emit) {
+    std::vector<uint8_t> rom(ROM_SIZE, 0);
+    std::mt19937 rng(0x6B0E);
+
+    // Entry point: jp LOOP_START
+    rom[0x100] = 0xC3; rom[0x101] = LOOP_START & 0xFF; rom[0x102] = LOOP_START >> 8;
+    rom[0x147] = 0; rom[0x148] = 0; rom[0x149] = 0;
+    rom[CALL_TARGET] = 0xC9;
+
+    // Loop head: ld hl,0xC000 ; ld bc,0xC200 ; ld de,0xC300
+    std::vector<uint8_t> body = { 0x21, 0x00, 0xC0, 0x01, 0x00, 0xC2, 0x11, 0x00, 0xC3 };
+
+    while (body.size() < BODY_SIZE) {
+        emit(body, rng);
+    }
+
+    // jp LOOP_START
+    body.push_back(0xC3); body.push_back(LOOP_START & 0xFF); body.push_back(LOOP_START >> 8);
+
+    std::copy(body.begin(), body.end(), rom.begin() + LOOP_START);
+
+    return std::string(rom.begin(), rom.end());
+}
+
+/**
+ * @brief Names of the `Machine::Dispatch` strategies, as `--dispatch` takes them.
+ */
+static const std::pair<const char*, Machine::Dispatch> DISPATCHES[] = {
+    { "switch", Machine::Dispatch::Switch },
+    { "threaded", Machine::Dispatch::Threaded },
+    { "cached", Machine::Dispatch::Cached },
+    { "jit", Machine::Dispatch::Jit },
+    { "recompiled", Machine::Dispatch::Recompiled },
+};
+
+/**
+ * @brief Loads `rom` into a fresh machine and runs `instructions` instructions.
+ * @param full If false, only the CPU is stepped (no PPU, timer or interrupts);
+ * otherwise the whole machine runs through `run_cycles` with `dispatch`.
+ * @return Millions of instructions per second of the best of `reps` runs.
+ */
+static double measure(const std::string& rom, uint64_t instructions, bool full, Machine::Dispatch dispatch, int reps) {
+    double best = 0;
+
+    for (int r = 0; r < reps; r++) {
+        Machine m;
+        std::string error;
+        std::istringstream in(rom);
+
+        if (!m.loadCartridge(in, "", error)) {
+            std::cerr << error << std::endl;
+            std::exit(1);
+        }
+
+        m.dispatch = dispatch;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (full) {
+            while (m.total_instructions < instructions) {
+                m.run_cycles(1 << 16);
+            }
+        }
+        else {
+            while (m.total_instructions < instructions) {
+                uint8_t op = m.memory->get(m.$PC);
+                m.executeOp(op);
+                m.$PC++;
+                m.total_instructions++;
+            }
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, m.total_instructions / elapsed.count() / 1e6);
+    }
+
+    return best;
+}
+
+/**
+ * @brief One flags computation of the `flags` microbenchmark, on operands packed
+ * as `c << 16 | x << 8 | y` (`n << 10 | h << 9 | c << 8 | a` for DAA).
+ */
+using FlagsOp = uint16_t (*)(uint32_t operands);
+
+static uint16_t addFlags(uint32_t k) {
+    return Alu::add(k >> 8, k, (k >> 16) & 1);
+}
+
+static uint16_t subFlags(uint32_t k) {
+    return Alu::sub(k >> 8, k, (k >> 16) & 1);
+}
+
+static uint16_t daaFlags(uint32_t k) {
+    return Alu::daa(k, k & 0x400, k & 0x200, k & 0x100);
+}
+
+#ifdef GB_ALU_TABLES
+static uint16_t addTable(uint32_t k) {
+    return Alu::tables.add[(k >> 16) & 1][(k >> 8) & 0xFF][k & 0xFF];
+}
+
+static uint16_t subTable(uint32_t k) {
+    return Alu::tables.sub[(k >> 16) & 1][(k >> 8) & 0xFF][k & 0xFF];
+}
+
+static uint16_t daaTable(uint32_t k) {
+    return Alu::tables.daa[(k >> 8) & 7][k & 0xFF];
+}
+#endif
+
+/**
+ * @brief Runs `op` over `operands` `passes` times, walking `noise` a cache line
+ * per operation when it is not empty.
+ * @return Nanoseconds per operation of the best of `reps` runs.
+ */
+static double timeFlags(FlagsOp op, const std::vector<uint32_t>& operands, std::vector<uint8_t>& noise,
+                        uint64_t passes, int reps) {
+    double best = 0;
+
+    for (int r = 0; r < reps; r++) {
+        uint32_t sum = 0;
+        size_t at = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        for (uint64_t pass = 0; pass < passes; pass++) {
+            for (uint32_t k : operands) {
+                sum += op(k);
+
+                if (!noise.empty()) {
+                    noise[at]++;
+                    at = (at + 64) % noise.size();
+                }
+            }
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = elapsed.count() * 1e9 / (passes * operands.size());
+        best = r == 0 ? ns : std::min(best, ns);
+
+        doNotOptimize(sum);
+    }
+
+    return best;
+}
+
+/**
+ * @brief Compares the bitwise flags of `Alu::add`, `Alu::sub` and `Alu::daa` with
+ * lookups in `Alu::tables` (the GB_ALU_TABLES build option).
+ *
+ * The tables are only a win while their entries stay in cache, so each is
+ * timed on three operand streams: `hot` cycles through 16 operand pairs, `random`
+ * draws them uniformly over the whole table, and `evict` is `random` with a
+ * 4 MiB buffer walked between operations, standing in for the rest of the
+ * emulator competing for the cache. The tables are only built into gbcore
+ * with GB_ALU_TABLES; without it the table column is left empty.
+ */
+static void benchFlags(uint64_t operations, int reps) {
+    static constexpr size_t STREAM = 1 << 16;
+    std::mt19937 rng(0xF1A6);
+    std::vector<uint32_t> hot(STREAM), random(STREAM);
+    std::vector<uint8_t> none, noise(4 << 20);
+
+    for (size_t i = 0; i < STREAM; i++) {
+        random[i] = pick(rng, 1 << 17);
+        hot[i] = random[i % 16];
+    }
+
+    const std::tuple<const char*, FlagsOp, FlagsOp> kernels[] = {
+#ifdef GB_ALU_TABLES
+        { "add", addFlags, addTable },
+        { "sub", subFlags, subTable },
+        { "daa", daaFlags, daaTable },
+#else
+        { "add", addFlags, nullptr },
+        { "sub", subFlags, nullptr },
+        { "daa", daaFlags, nullptr },
+#endif
+    };
+
+    const std::tuple<const char*, const std::vector<uint32_t>*, std::vector<uint8_t>*> streams[] = {
+        { "hot", &hot, &none },
+        { "random", &random, &none },
+        { "evict", &random, &noise },
+    };
+
+    uint64_t passes = std::max<uint64_t>(1, operations / STREAM);
+
+    std::cout << std::left << std::setw(8) << "flags" << std::setw(8) << "stream" << std::right
+              << std::setw(12) << "bitwise ns" << std::setw(10) << "table ns" << "\n";
+
+    for (auto& [name, bitwise, table] : kernels) {
+        for (auto& [stream, operands, buffer] : streams) {
+            std::cout << std::left << std::setw(8) << name << std::setw(8) << stream << std::right
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(12) << timeFlags(bitwise, *operands, *buffer, passes, reps) << std::setw(10);
+
+            if (table) {
+                std::cout << timeFlags(table, *operands, *buffer, passes, reps) << std::endl;
+            }
+            else {
+                std::cout << "-" << std::endl;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Runs `work` (one pass over `items` items) `passes` times.
+ * @return Nanoseconds per item of the best of `reps` runs.
+ */
+static double timePasses(const std::function<void()>& work, uint64_t passes, size_t items, int reps) {
+    double best = 0;
+
+    for (int r = 0; r < reps; r++) {
+        auto start = std::chrono::steady_clock::now();
+
+        for (uint64_t pass = 0; pass < passes; pass++) {
+            work();
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = elapsed.count() * 1e9 / (passes * items);
+        best = r == 0 ? ns : std::min(best, ns);
+    }
+
+    return best;
+}
+
+/**
+ * @brief Times the PPU's pixel kernels (`Pixels`) for every instruction set the
+ * host supports: decoding all 384 tiles of VRAM, and mapping the colour numbers
+ * of 144 lines of 160 pixels through a palette into a framebuffer.
+ */
+static void benchPixels(uint64_t operations, int reps) {
+    std::mt19937 rng(0x2B99);
+    std::vector<uint8_t> vram(384 * 16), tiles(384 * 64), colours(144 * 160), framebuffer(144 * 160 * 4);
+
+    for (auto& b : vram) {
+        b = pick(rng, 256);
+    }
+
+    for (auto& c : colours) {
+        c = pick(rng, 4);
+    }
+
+    uint64_t passes = std::max<uint64_t>(1, operations / colours.size());
+
+    std::cout << std::left << std::setw(8) << "pixels" << std::right
+              << std::setw(16) << "decode ns/tile" << std::setw(14) << "map ns/line" << "\n";
+
+    for (int i = 0; i < int(Pixels::Isa::Count); i++) {
+        auto isa = Pixels::Isa(i);
+
+        if (!Pixels::supported(isa)) {
+            continue;
+        }
+
+        Pixels::Kernels kernels = Pixels::kernels(isa);
+
+        auto decode = [&] {
+            for (size_t t = 0; t < 384; t++) {
+                kernels.decode(vram.data() + t * 16, tiles.data() + t * 64);
+            }
+
+            doNotOptimize(tiles.data());
+        };
+
+        auto map = [&] {
+            for (size_t line = 0; line < 144; line++) {
+                kernels.map(colours.data() + line * 160, 160, 0xE4, framebuffer.data() + line * 640);
+            }
+
+            doNotOptimize(framebuffer.data());
+        };
+
+        std::cout << std::left << std::setw(8) << Pixels::name(isa) << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(16) << timePasses(decode, passes, 384, reps)
+                  << std::setw(14) << timePasses(map, passes, 144, reps) << std::endl;
+    }
+}
+
+/**
+ * @brief Prints command-line usage for the benchmark.
+ * @param name The executable name (argv[0]).
+ */
+static void usage(const char* name) {
+    std::cout << "usage: " << name << " [--instructions N] [--reps N] [--mix NAME]\n"
+              << "       [--dispatch switch|threaded|cached|jit|recompiled]\n"
+              << "  --instructions N  instructions per run (default 20000000)\n"
+              << "  --reps N          runs per mix, best is reported (default 3)\n"
+              << "  --dispatch D      interpreter dispatch of the whole-machine column (default threaded)\n"
+              << "  --mix NAME        only run one mix: alu, load, cb, branch, mix, flags for the\n"
+              << "                    flags computation of the ALU alone, bitwise vs table lookups\n"
+              << "                    (with GB_ALU_TABLES), or pixels for the PPU's tile decoding\n"
+              << "                    and palette kernels\n";
+}
+
+/**
+ * @brief Entry point for the interpreter microbenchmark.
+ *
+ * Runs synthetic opcode mixes on the interpreter, both CPU-only (no PPU, timer
+ * or interrupt work, always the switch) and as a full machine with the selected
+ * dispatch, and reports MIPS for each, then
+ * times the ALU flags computation (`benchFlags`) and the PPU's pixel kernels
+ * (`benchPixels`) on their own.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 on success, 1 on error.
+ */
+int main(int argc, char* argv[])
+{
+    uint64_t instructions = 20000000;
+    int reps = 3;
+    std::string only;
+    auto dispatch = DISPATCHES[1];
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--instructions" && i + 1 < argc) {
+            instructions = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--reps" && i + 1 < argc) {
+            reps = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--mix" && i + 1 < argc) {
+            only = argv[++i];
+        }
+        else if (arg == "--dispatch" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            auto found = std::find_if(std::begin(DISPATCHES), std::end(DISPATCHES),
+                                      [&](auto& d) { return mode == d.first; });
+
+            if (found == std::end(DISPATCHES)) {
+                usage(argv[0]);
+                return 1;
+            }
+
+            dispatch = *found;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const std::pair<const char*, Emitter> mixes[] = {
+        { "alu", emitAlu },
+        { "load", emitLoad },
+        { "cb", emitCb },
+        { "branch", emitBranch },
+        { "mix", emitMix },
+    };
+
+    if (only.empty() || (only != "flags" && only != "pixels")) {
+        std::cout << std::left << std::setw(8) << "mix" << std::right
+                  << std::setw(12) << "cpu MIPS" << std::setw(16) << dispatch.first + std::string(" MIPS") << "\n";
+    }
+
+    for (auto& [name, emit] : mixes) {
+        if (!only.empty() && only != name) {
+            continue;
+        }
+
+        std::string rom = buildRom(emit);
+
+        std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << measure(rom, instructions, false, dispatch.second, reps)
+                  << std::setw(16) << measure(rom, instructions, true, dispatch.second, reps) << std::endl;
+    }
+
+    if (only.empty() || only == "flags") {
+        benchFlags(instructions, reps);
+    }
+
+    if (only.empty() || only == "pixels") {
+        benchPixels(instructions, reps);
+    }
+
+    return 0;
+}
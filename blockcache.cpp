@@ -0,0 +1,176 @@
+#include <initializer_list>
+
+#include "blockcache.hpp"
+#include "opcodes.h"
+
+/**
+ * @brief Checks whether `op` may leave the straight line of code (jumps, calls,
+ * returns, restarts) or stop the CPU (HALT, STOP), which ends a block.
+ */
+static bool endsBlock(uint8_t op) {
+    switch (op) {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:             // JR
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: // JP
+    case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:             // CALL
+    case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9: // RET, RETI
+    case 0xC7: case 0xCF: case 0xD7: case 0xDF:                        // RST
+    case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+    case 0x10: case 0x76:                                              // STOP, HALT
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::unique_ptr<Block> Block::decode(const uint8_t* code, uint16_t pc, unsigned avail) {
+    auto block = std::make_unique<Block>();
+    unsigned i = 0;
+
+    while (block->ops.size() < MAX_OPS) {
+        uint8_t op = code[i];
+        unsigned length = lengths[op];
+
+        if (i + length > avail) {
+            break;
+        }
+
+        DecodedOp decoded = { op, 0, uint16_t(pc + i), cycles[op] };
+
+        if (length == 2) {
+            decoded.operand = code[i + 1];
+        }
+        else if (length == 3) {
+            decoded.operand = code[i + 1] | (code[i + 2] << 8);
+        }
+
+        if (op == 0xCB) {
+            decoded.cycles = cb_cycles[code[i + 1]];
+        }
+
+        block->ops.push_back(decoded);
+        i += length;
+
+        if (endsBlock(op)) {
+            break;
+        }
+    }
+
+    block->ops.push_back({ BLOCK_END, 0, uint16_t(pc + i), 0 });
+    block->bytes = i;
+    return block;
+}
+
+LoopIdiom Block::loopIdiom() const {
+    // At least a body, a counter and the jump, then the sentinel
+    if (ops.size() < 4) {
+        return {};
+    }
+
+    const DecodedOp& jump = ops[ops.size() - 2];
+
+    if (jump.op != 0x20 || uint16_t(jump.pc + 2 + int8_t(jump.operand)) != ops[0].pc) {
+        return {};
+    }
+
+    auto matches = [this](size_t at, std::initializer_list<uint16_t> sequence) {
+        if (at + sequence.size() != ops.size() - 2) {
+            return false;
+        }
+
+        for (uint16_t op : sequence) {
+            if (ops[at++].op != op) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    LoopIdiom loop;
+    size_t body;
+
+    if (ops[0].op == 0x2A && ops[1].op == 0x12 && ops[2].op == 0x13) {
+        loop.kind = LoopIdiom::CopyHLToDE;
+        body = 3;
+    }
+    else if (ops[0].op == 0x1A && ops[1].op == 0x22 && ops[2].op == 0x13) {
+        loop.kind = LoopIdiom::CopyDEToHL;
+        body = 3;
+    }
+    else if (ops[0].op == 0x22 || ops[0].op == 0x32) {
+        loop.kind = ops[0].op == 0x22 ? LoopIdiom::FillUp : LoopIdiom::FillDown;
+        body = 1;
+    }
+    else {
+        return {};
+    }
+
+    bool copy = loop.kind == LoopIdiom::CopyHLToDE || loop.kind == LoopIdiom::CopyDEToHL;
+
+    if (matches(body, { 0x05 })) {
+        loop.counter = LoopIdiom::B;
+    }
+    else if (matches(body, { 0x0D })) {
+        loop.counter = LoopIdiom::C;
+    }
+    // D and E are the copies' source or destination
+    else if (!copy && matches(body, { 0x15 })) {
+        loop.counter = LoopIdiom::D;
+    }
+    else if (!copy && matches(body, { 0x1D })) {
+        loop.counter = LoopIdiom::E;
+    }
+    // A fill would store B | C from the second iteration on
+    else if (copy && matches(body, { 0x0B, 0x78, 0xB1 })) {
+        loop.counter = LoopIdiom::BC;
+    }
+    else {
+        return {};
+    }
+
+    return loop;
+}
+
+Block* BlockCache::insert(const uint8_t* code, uint16_t pc, const uint8_t* page, std::unique_ptr<Block> block) {
+    Block* stored = block.get();
+
+    if (page) {
+        block->inRAM = true;
+        Page& tracked = pages[page];
+        size_t offset = code - page;
+
+        tracked.starts.push_back({ code, pc });
+
+        for (size_t i = offset; i < offset + block->bytes; i++) {
+            tracked.code.set(i);
+        }
+    }
+
+    blocks[{ code, pc }] = std::move(block);
+    recent[slotOf(code)] = { { code, pc }, stored };
+    return stored;
+}
+
+bool BlockCache::invalidate(const uint8_t* page, uint8_t offset) {
+    auto tracked = pages.find(page);
+
+    if (tracked == pages.end() || !tracked->second.code.test(offset)) {
+        return false;
+    }
+
+    for (const Key& start : tracked->second.starts) {
+        auto it = blocks.find(start);
+        retired.push_back(std::move(it->second));
+        blocks.erase(it);
+    }
+
+    pages.erase(tracked);
+    recent.fill({});
+    return true;
+}
+
+void BlockCache::clear() {
+    blocks.clear();
+    pages.clear();
+    recent.fill({});
+}
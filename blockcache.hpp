@@ -0,0 +1,208 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief One instruction of a pre-decoded block.
+ */
+struct DecodedOp {
+    uint16_t op;      // Opcode, or one of the pseudo-opcodes of `Block`
+    uint16_t operand; // Immediate operand (8 or 16 bits), the opcode following a CB prefix, the native code index, the recompiled block index or the loop idiom
+    uint16_t pc;      // Guest address of the opcode
+    uint8_t cycles;   // M-cycles taken when no branch is taken, CB prefix included
+    uint8_t span = 0; // Instructions a `JIT_REGION` covers, or a `BULK_LOOP` iteration takes
+};
+
+/**
+ * @brief A copy or fill loop recognised by `Block::loopIdiom`: a block whose
+ * only instructions are one of these bodies, a counter decrement and a
+ * `jr nz` back to its start.
+ */
+struct LoopIdiom {
+    enum Kind : uint8_t {
+        None,
+        CopyHLToDE, // ld a,(hl+); ld (de),a; inc de
+        CopyDEToHL, // ld a,(de); ld (hl+),a; inc de
+        FillUp,     // ld (hl+),a
+        FillDown    // ld (hl-),a
+    };
+
+    enum Counter : uint8_t {
+        B, C, D, E, // dec r
+        BC          // dec bc; ld a,b; or c
+    };
+
+    Kind kind = None;
+    Counter counter = B;
+};
+
+/**
+ * @brief A straight run of instructions, ending after the first one that may
+ * jump or stop the CPU, at the end of its 256-byte page, or after `MAX_OPS`.
+ */
+struct Block {
+    /**
+     * @brief Pseudo-opcode of the sentinel after the last instruction.
+     * The cached dispatch jumps to it like to any opcode, so running a block
+     * needs no end-of-block test.
+     */
+    static constexpr uint16_t BLOCK_END = 0x100;
+
+    /**
+     * @brief Pseudo-opcode running the next `span` instructions as native code (see `Jit`).
+     * The instructions stay in the block after it for when the region cannot run natively.
+     */
+    static constexpr uint16_t JIT_REGION = 0x101;
+
+    /**
+     * @brief Pseudo-opcode running the whole block through its function compiled
+     * ahead of time (see `Recompiled`), whose index is the operand.
+     */
+    static constexpr uint16_t RECOMPILED = 0x102;
+
+    /**
+     * @brief Pseudo-opcode running the block's copy or fill loop (see `LoopIdiom`) in
+     * bulk. Its operand is the idiom's kind plus its counter shifted left by 8, its
+     * span the instructions of one iteration and its cycles their M-cycles, less
+     * the `jr nz`.
+     */
+    static constexpr uint16_t BULK_LOOP = 0x103;
+
+    /**
+     * @brief Longest block, in instructions.
+     */
+    static constexpr size_t MAX_OPS = 32;
+
+    /**
+     * @brief Decodes the block starting at the host address `code`.
+     * @param code Host address of the first opcode.
+     * @param pc Guest address of the first opcode.
+     * @param avail Bytes left in the page from `code`; no instruction may run past them.
+     * @return The block. It holds only the sentinel if the first instruction crosses the page.
+     */
+    static std::unique_ptr<Block> decode(const uint8_t* code, uint16_t pc, unsigned avail);
+
+    /**
+     * @brief Recognises a copy or fill loop in a freshly decoded block.
+     * @return The loop, or `LoopIdiom::None` if the block is anything else.
+     */
+    LoopIdiom loopIdiom() const;
+
+    std::vector<DecodedOp> ops; // Instructions followed by the sentinel
+    uint16_t bytes = 0;         // Guest bytes the instructions occupy
+    bool inRAM = false;         // Whether the block is in (watched) RAM
+    uint32_t runs = 0;          // Times the block was looked up, to find hot ones
+};
+
+/**
+ * @brief Pre-decoded blocks, keyed by the host address of their first opcode
+ * and the guest address they were decoded at.
+ *
+ * The host address tells apart the ROM (or RAM) banks mapped at the same PC,
+ * so blocks stay valid across bank switches. It does not tell apart the
+ * addresses one host byte is mapped at: echo RAM (0xE000-0xFDFF) mirrors work
+ * RAM, and MBC5 can map bank 0 at 0x4000-0x7FFF too. A block's instructions
+ * carry their guest addresses, so each of those gets a block of its own.
+ * Blocks in RAM are tracked per host page so a write to their bytes, through
+ * any of its addresses, can drop them.
+ */
+class BlockCache {
+public:
+    /**
+     * @brief Looks up the block starting at the host address `code`, decoded at the guest address `pc`.
+     * @return The block, or nullptr if it has not been decoded yet.
+     */
+    Block* find(const uint8_t* code, uint16_t pc) {
+        Recent& slot = recent[slotOf(code)];
+
+        if (slot.key.code != code || slot.key.pc != pc) {
+            auto it = blocks.find({ code, pc });
+
+            if (it == blocks.end()) {
+                return nullptr;
+            }
+
+            slot = { { code, pc }, it->second.get() };
+        }
+
+        return slot.block;
+    }
+
+    /**
+     * @brief Adds a decoded block.
+     * @param code Host address of its first opcode.
+     * @param pc Guest address it was decoded at.
+     * @param page Host address of the 256-byte RAM page holding it, or nullptr for ROM.
+     * @return The block as stored.
+     */
+    Block* insert(const uint8_t* code, uint16_t pc, const uint8_t* page, std::unique_ptr<Block> block);
+
+    /**
+     * @brief Drops the blocks of the RAM page `page` if the write to byte `offset` changed one of them.
+     * The dropped blocks are kept alive until `collect`, since one may still be running.
+     * @return True if blocks were dropped.
+     */
+    bool invalidate(const uint8_t* page, uint8_t offset);
+
+    /**
+     * @brief Frees the blocks dropped by `invalidate`.
+     */
+    void collect() {
+        retired.clear();
+    }
+
+    /**
+     * @brief Drops every block.
+     */
+    void clear();
+
+    bool empty() const {
+        return blocks.empty();
+    }
+
+private:
+    struct Key {
+        const uint8_t* code;
+        uint16_t pc;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<const uint8_t*>()(key.code) ^ key.pc;
+        }
+    };
+
+    struct Recent {
+        Key key = { nullptr, 0 };
+        Block* block = nullptr;
+    };
+
+    /**
+     * @brief Blocks and covered bytes of one RAM page.
+     */
+    struct Page {
+        std::vector<Key> starts;
+        std::bitset<256> code;
+    };
+
+    static size_t slotOf(const uint8_t* code) {
+        return (reinterpret_cast<uintptr_t>(code) ^ (reinterpret_cast<uintptr_t>(code) >> 10)) & (RECENT_SLOTS - 1);
+    }
+
+    static constexpr size_t RECENT_SLOTS = 1024;
+
+    std::unordered_map<Key, std::unique_ptr<Block>, KeyHash> blocks;
+    std::unordered_map<const uint8_t*, Page> pages;
+    std::array<Recent, RECENT_SLOTS> recent{};
+    std::vector<std::unique_ptr<Block>> retired;
+};
+
+#endif
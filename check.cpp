@@ -0,0 +1,482 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+
+#include "gba.hpp"
+#include "opcodes.h"
+
+/**
+ * @brief Where the instructions under test are placed for the interpreter (work RAM).
+ */
+static constexpr uint16_t CODE_START = 0xC000;
+
+/**
+ * @brief Returns a uniformly distributed integer in [0, n).
+ */
+static unsigned pick(std::mt19937& rng, unsigned n) {
+    return std::uniform_int_distribution<unsigned>(0, n - 1)(rng);
+}
+
+/**
+ * @brief Loads a blank 32 KiB ROM-only cartridge into `m`.
+ */
+static void loadBlank(Machine& m) {
+    std::string rom(0x8000, '\0'), error;
+    std::istringstream in(rom);
+
+    if (!m.loadCartridge(in, "", error)) {
+        std::cerr << error << std::endl;
+        std::exit(1);
+    }
+}
+
+/**
+ * @brief Returns a random register file. Half the time HL points into work RAM,
+ * so reads through it hit the inlined page table rather than the slow path.
+ */
+static CPUState randomState(std::mt19937& rng) {
+    CPUState s;
+
+    s.a = pick(rng, 256); s.b = pick(rng, 256); s.c = pick(rng, 256); s.d = pick(rng, 256);
+    s.e = pick(rng, 256); s.h = pick(rng, 256); s.l = pick(rng, 256);
+    s.setF(pick(rng, 256));
+    s.sp = pick(rng, 0x10000);
+
+    if (pick(rng, 2)) {
+        s.h = 0xC0 + pick(rng, 0x20);
+    }
+
+    return s;
+}
+
+/**
+ * @brief Returns instruction `op` (with `operand`) decoded as the block cache would at `pc`.
+ */
+static DecodedOp decodedOp(uint8_t op, uint16_t operand, uint16_t pc) {
+    return { op, operand, pc, op == 0xCB ? cb_cycles[operand & 0xFF] : cycles[op] };
+}
+
+/**
+ * @brief Runs `ops` through the switch interpreter of `m` from `start`, with their bytes
+ * stored at `CODE_START`.
+ * @return The registers afterwards, PC excepted.
+ */
+static CPUState interpret(Machine& m, const std::vector<DecodedOp>& ops, const CPUState& start) {
+    uint16_t at = CODE_START;
+
+    for (const DecodedOp& op : ops) {
+        m.memory->set(at++, op.op);
+
+        for (unsigned i = 1; i < lengths[op.op]; i++) {
+            m.memory->set(at++, op.operand >> (8 * (i - 1)));
+        }
+    }
+
+    // Drop any flags deferred by the previous run before replacing the registers
+    m.flags();
+    m.cpu = start;
+    m.cpu.pc = CODE_START;
+    m.ime_sched = false;
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        m.executeOp(m.memory->get(m.$PC));
+        m.$PC++;
+    }
+
+    CPUState result = m.flags();
+    result.pc = 0;
+    return result;
+}
+
+/**
+ * @brief Prints a register file on one line.
+ */
+static void printState(const char* label, const CPUState& s) {
+    std::cout << "    " << label << std::hex << std::setfill('0')
+              << " a=" << std::setw(2) << unsigned(s.a) << " f=" << std::setw(2) << unsigned(s.f())
+              << " b=" << std::setw(2) << unsigned(s.b) << " c=" << std::setw(2) << unsigned(s.c)
+              << " d=" << std::setw(2) << unsigned(s.d) << " e=" << std::setw(2) << unsigned(s.e)
+              << " h=" << std::setw(2) << unsigned(s.h) << " l=" << std::setw(2) << unsigned(s.l)
+              << " sp=" << std::setw(4) << s.sp << std::dec << std::setfill(' ') << "\n";
+}
+
+/**
+ * @brief Compiles `ops` into a region of a fresh `Jit` and runs it and the interpreter
+ * from the same random register files `states` times.
+ * @return False, after printing the first mismatch, if they ever disagree; true
+ * otherwise, including when `Jit` does not translate the whole of `ops`.
+ */
+static bool compareRun(Machine& m, const std::vector<DecodedOp>& ops, std::mt19937& rng, int states, bool& translated) {
+    Jit jit(m.memory.get());
+
+    translated = jit.compile(ops.data(), ops.size()) == ops.size();
+
+    if (!translated) {
+        return true;
+    }
+
+    for (int i = 0; i < states; i++) {
+        CPUState start = randomState(rng);
+        CPUState want = interpret(m, ops, start);
+        CPUState got = start;
+
+        jit.run(uint16_t(jit.regions() - 1), got);
+        got.pc = 0;
+
+        if (!(got == want)) {
+            std::cout << "  mismatch running";
+
+            for (const DecodedOp& op : ops) {
+                std::cout << " " << std::hex << std::setfill('0') << std::setw(2) << op.op;
+
+                if (lengths[op.op] > 1) {
+                    std::cout << ":" << std::setw(lengths[op.op] == 3 ? 4 : 2) << op.operand;
+                }
+
+                std::cout << std::dec << std::setfill(' ');
+            }
+
+            std::cout << "\n";
+            printState("from       ", start);
+            printState("interpreter", want);
+            printState("native     ", got);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Checks the native code of `Jit` against the switch interpreter.
+ *
+ * Every instruction `Jit` translates runs, followed by a NOP (regions need two
+ * instructions), from `iterations` random register files, with fresh random
+ * immediates every 16 of them. Then `iterations` random runs of translatable
+ * instructions are compiled as one region each, which also covers the
+ * registers a region carries from one instruction to the next.
+ * @return True if native code and interpreter always agreed.
+ */
+static bool checkJit(int iterations) {
+    if (!Jit::available()) {
+        std::cout << "jit: native code is not available in this build or on this host, skipped\n";
+        return true;
+    }
+
+    Machine m;
+    std::mt19937 rng(0x317);
+    std::vector<DecodedOp> translatable;
+    bool translated;
+
+    loadBlank(m);
+
+    for (unsigned op = 0; op < 0x100; op++) {
+        for (unsigned cb = 0; cb < (op == 0xCB ? 0x100u : 1u); cb++) {
+            bool immediate = lengths[op] > 1 && op != 0xCB;
+            int rounds = immediate ? iterations / 16 : 1;
+
+            for (int round = 0; round < rounds; round++) {
+                uint16_t operand = op == 0xCB ? cb : immediate ? pick(rng, 0x10000) : 0;
+                DecodedOp first = decodedOp(op, operand, CODE_START);
+                std::vector<DecodedOp> ops = { first, decodedOp(0x00, 0, CODE_START + lengths[op]) };
+
+                if (!compareRun(m, ops, rng, iterations / rounds, translated)) {
+                    return false;
+                }
+
+                if (!translated) {
+                    break;
+                }
+
+                if (round == 0) {
+                    translatable.push_back(first);
+                }
+            }
+        }
+    }
+
+    if (translatable.empty()) {
+        std::cout << "jit: no instruction was translated\n";
+        return false;
+    }
+
+    int runs = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        std::vector<DecodedOp> ops;
+        uint16_t pc = CODE_START;
+
+        for (unsigned n = Jit::MIN_SPAN + pick(rng, 4); n > 0; n--) {
+            DecodedOp op = translatable[pick(rng, translatable.size())];
+
+            if (lengths[op.op] > 1 && op.op != 0xCB) {
+                op.operand = pick(rng, 0x10000);
+            }
+
+            op.pc = pc;
+            pc += lengths[op.op];
+            ops.push_back(op);
+        }
+
+        // Regions are capped in M-cycles, so drop the instructions past the cap
+        Jit jit(m.memory.get());
+        size_t span = jit.compile(ops.data(), ops.size());
+
+        if (span < Jit::MIN_SPAN) {
+            continue;
+        }
+
+        ops.resize(span);
+
+        if (!compareRun(m, ops, rng, 4, translated)) {
+            return false;
+        }
+
+        runs++;
+    }
+
+    std::cout << "jit: " << translatable.size() << " instructions and " << runs
+              << " runs of them agree with the interpreter\n";
+    return true;
+}
+
+/**
+ * @brief Appends the little-endian bytes of `value` to `out`.
+ */
+static void word(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+/**
+ * @brief Appends a copy loop of `count` bytes (1-255) from `src` to `dst`:
+ * `ld hl,src; ld de,dst; ld b,count; ld a,(hl+); ld (de),a; inc de; dec b; jr nz`.
+ */
+static void copyLoop(std::vector<uint8_t>& out, uint16_t src, uint16_t dst, uint8_t count) {
+    out.push_back(0x21); word(out, src);
+    out.push_back(0x11); word(out, dst);
+    out.insert(out.end(), { 0x06, count, 0x2A, 0x12, 0x13, 0x05, 0x20, 0xFA });
+}
+
+/**
+ * @brief Builds a 32 KiB ROM-only cartridge that runs every copy and fill loop
+ * shape `LoopIdiom` recognises over and over, with the timer and VBlank
+ * interrupts splitting them at varying points.
+ *
+ * The loops copy to and fill work RAM, VRAM (tile data and maps), OAM and HRAM,
+ * across page boundaries. One of them is copied into work RAM at 0xC100 and
+ * called both there and through echo RAM at 0xE100; it calls a subroutine that
+ * stores its return address, so running it at the wrong address shows in memory.
+ */
+static std::string buildIdiomRom() {
+    static constexpr uint16_t SUBROUTINE = 0x0800, ROUTINE = 0x0900, DATA = 0x1000, LOOP = 0x0150;
+    std::vector<uint8_t> rom(0x8000, 0);
+    std::mt19937 rng(0x1D10);
+
+    // Interrupt handlers: VBlank counts into 0xD001, the others just return
+    const uint8_t vblank[] = { 0xF5, 0xFA, 0x01, 0xD0, 0x3C, 0xEA, 0x01, 0xD0, 0xF1, 0xD9 };
+    std::copy(std::begin(vblank), std::end(vblank), rom.begin() + 0x40);
+    rom[0x50] = rom[0x58] = rom[0x60] = 0xD9;
+    rom[0x100] = 0x00; rom[0x101] = 0xC3; rom[0x102] = LOOP & 0xFF; rom[0x103] = LOOP >> 8;
+
+    for (size_t i = DATA; i < DATA + 0x1800; i++) {
+        rom[i] = pick(rng, 256);
+    }
+
+    // pop hl; ld a,l; ld (0xD010),a; ld a,h; ld (0xD011),a; push hl; ret
+    std::vector<uint8_t> subroutine = { 0xE1, 0x7D, 0xEA };
+    word(subroutine, 0xD010);
+    subroutine.insert(subroutine.end(), { 0x7C, 0xEA });
+    word(subroutine, 0xD011);
+    subroutine.insert(subroutine.end(), { 0xE5, 0xC9 });
+    std::copy(subroutine.begin(), subroutine.end(), rom.begin() + SUBROUTINE);
+
+    // Copy loop, call SUBROUTINE, ret
+    std::vector<uint8_t> routine;
+    copyLoop(routine, DATA, 0xC800, 0x40);
+    routine.push_back(0xCD); word(routine, SUBROUTINE);
+    routine.push_back(0xC9);
+    std::copy(routine.begin(), routine.end(), rom.begin() + ROUTINE);
+
+    // ld sp,0xDFFE; LCD on; IE = VBlank | timer; TAC = 4096 Hz; ei; copy the routine to 0xC100
+    std::vector<uint8_t> code = { 0x31, 0xFE, 0xDF, 0x3E, 0x91, 0xE0, 0x40, 0x3E, 0x05, 0xE0, 0xFF, 0x3E, 0x04, 0xE0, 0x07, 0xFB };
+    copyLoop(code, ROUTINE, 0xC100, uint8_t(routine.size()));
+    uint16_t loop = LOOP + code.size();
+
+    // Copy 0x1800 bytes into tile data, counted in BC
+    code.push_back(0x21); word(code, DATA);
+    code.push_back(0x11); word(code, 0x8000);
+    code.push_back(0x01); word(code, 0x1800);
+    code.insert(code.end(), { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8 });
+
+    // Fill the tile map from (0xD000), counted in C
+    code.push_back(0x21); word(code, 0x9800);
+    code.insert(code.end(), { 0x0E, 0x00, 0xFA });
+    word(code, 0xD000);
+    code.insert(code.end(), { 0x22, 0x0D, 0x20, 0xFC });
+
+    // Fill 0xC0FF downwards across a page, counted in D
+    code.push_back(0x21); word(code, 0xC0FF);
+    code.insert(code.end(), { 0x16, 0x80, 0x32, 0x15, 0x20, 0xFC });
+
+    // Overlapping copy from DE to HL+1, counted in B
+    code.push_back(0x11); word(code, 0xC000);
+    code.push_back(0x21); word(code, 0xC001);
+    code.insert(code.end(), { 0x06, 0x40, 0x1A, 0x22, 0x13, 0x05, 0x20, 0xFA });
+
+    // Copies to OAM and HRAM
+    copyLoop(code, DATA, 0xFE00, 0xA0);
+    copyLoop(code, DATA, 0xFF80, 0x10);
+
+    // Fill work RAM from (0xD000), counted in E
+    code.push_back(0xFA); word(code, 0xD000);
+    code.push_back(0x21); word(code, 0xC200);
+    code.insert(code.end(), { 0x1E, 0x00, 0x22, 0x1D, 0x20, 0xFC });
+
+    // Run the routine through echo RAM, work RAM and echo RAM again, keeping each return address
+    for (uint16_t at : { 0xE100, 0xC100, 0xE100 }) {
+        code.push_back(0xCD); word(code, at);
+        code.push_back(0xFA); word(code, 0xD011);
+        code.push_back(0xEA); word(code, at == 0xC100 ? 0xD021 : 0xD020);
+    }
+
+    // Fill VRAM downwards across a page from (0xD001), counted in B
+    code.push_back(0xFA); word(code, 0xD001);
+    code.push_back(0x21); word(code, 0x8880);
+    code.insert(code.end(), { 0x06, 0xC0, 0x32, 0x05, 0x20, 0xFC });
+
+    // inc (0xD000); jp loop
+    code.push_back(0x21); word(code, 0xD000);
+    code.insert(code.end(), { 0x34, 0xC3 });
+    word(code, loop);
+
+    std::copy(code.begin(), code.end(), rom.begin() + LOOP);
+    return std::string(rom.begin(), rom.end());
+}
+
+/**
+ * @brief Runs `rom` with `dispatch` for `chunks` calls of `run_cycles` of an odd length.
+ * @return The clocks, the registers and a hash of 0x8000-0xFFFF.
+ */
+static std::string runState(const std::string& rom, Machine::Dispatch dispatch, int chunks) {
+    Machine m;
+    std::string error;
+    std::istringstream in(rom);
+
+    if (!m.loadCartridge(in, "", error)) {
+        std::cerr << error << std::endl;
+        std::exit(1);
+    }
+
+    m.dispatch = dispatch;
+
+    for (int i = 0; i < chunks; i++) {
+        m.run_cycles(997);
+    }
+
+    uint64_t hash = 14695981039346656037ull;
+
+    for (uint32_t addr = 0x8000; addr < 0x10000; addr++) {
+        hash = (hash ^ m.memory->get(addr)) * 1099511628211ull;
+    }
+
+    std::ostringstream state;
+    state << std::hex << std::setfill('0')
+          << "instructions=" << std::dec << m.total_instructions << " cycles=" << m.total_cycles << std::hex
+          << " pc=" << std::setw(4) << m.$PC << " af=" << std::setw(4) << m.$AF << " bc=" << std::setw(4) << m.$BC
+          << " de=" << std::setw(4) << m.$DE << " hl=" << std::setw(4) << m.$HL << " sp=" << std::setw(4) << m.$SP
+          << " memory=" << std::setw(16) << hash;
+    return state.str();
+}
+
+/**
+ * @brief Checks the bulk copy and fill loops of the cached dispatches (`BULK_LOOP`)
+ * against the switch interpreter: the idiom ROM (`buildIdiomRom`) must leave the
+ * same clocks, registers and memory under every dispatch.
+ * @return True if every dispatch agreed with the switch.
+ */
+static bool checkIdioms(int iterations) {
+    static const std::pair<const char*, Machine::Dispatch> dispatches[] = {
+        { "threaded", Machine::Dispatch::Threaded },
+        { "cached", Machine::Dispatch::Cached },
+        { "jit", Machine::Dispatch::Jit },
+        { "recompiled", Machine::Dispatch::Recompiled },
+    };
+
+    std::string rom = buildIdiomRom();
+    std::string want = runState(rom, Machine::Dispatch::Switch, iterations);
+
+    for (auto& [name, dispatch] : dispatches) {
+        std::string got = runState(rom, dispatch, iterations);
+
+        if (got != want) {
+            std::cout << "idioms: " << name << " differs from switch\n"
+                      << "    switch " << want << "\n"
+                      << "    " << name << " " << got << "\n";
+            return false;
+        }
+    }
+
+    std::cout << "idioms: every dispatch agrees with switch after " << iterations << " x 997 M-cycles\n";
+    return true;
+}
+
+/**
+ * @brief Prints command-line usage for the checks.
+ * @param name The executable name (argv[0]).
+ */
+static void usage(const char* name) {
+    std::cout << "usage: " << name << " [--iterations N] [--check NAME]\n"
+              << "  --iterations N  random cases per instruction and random runs, and calls of\n"
+              << "                  run_cycles (default 256)\n"
+              << "  --check NAME    only run one check: jit for the native code of the Jit dispatch\n"
+              << "                  against the interpreter, or idioms for the bulk copy and fill\n"
+              << "                  loops of the cached dispatches\n";
+}
+
+/**
+ * @brief Entry point for the differential checks.
+ *
+ * Runs the faster execution paths against the switch interpreter, the
+ * reference, on generated code and reports the first difference.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 if every check passed, 1 on a mismatch or error.
+ */
+int main(int argc, char* argv[])
+{
+    int iterations = 256;
+    std::string only;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max(16, std::atoi(argv[++i]));
+        }
+        else if (arg == "--check" && i + 1 < argc) {
+            only = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool passed = true;
+
+    if (only.empty() || only == "jit") {
+        passed = checkJit(iterations) && passed;
+    }
+
+    if (only.empty() || only == "idioms") {
+        passed = checkIdioms(iterations) && passed;
+    }
+
+    return passed ? 0 : 1;
+}
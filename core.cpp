@@ -0,0 +1,490 @@
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+
+#include "gba.hpp"
+
+template<class M>
+const Machine::Backend Machine::backendFor = {
+    &Machine::step<M>,
+    &Machine::executeOp<M>,
+    &Machine::checkInterrupts<M>,
+    &Machine::runUntil<M>,
+};
+
+/**
+ * @brief Installs a memory controller of type `M` and the CPU loop instantiated for it.
+ * @tparam M The concrete memory controller type.
+ * @param args Arguments forwarded to the controller's constructor.
+ */
+template<class M, class... Args>
+void Machine::attachMemory(Args... args) {
+    memory = std::make_unique<M>(args...);
+    backend = &backendFor<M>;
+}
+
+bool Machine::createMemory(uint8_t chip, size_t rom_size_factor, uint8_t nRAM) {
+    switch (chip) {
+    case 0:
+        attachMemory<NoMBC>();
+        return true;
+    case 8:
+    case 9:
+        attachMemory<NoMBC>(true);
+        return true;
+    case 1:
+    case 2:
+        attachMemory<MBC1>(nRAM, rom_size_factor, false);
+        return true;
+    case 3:
+        attachMemory<MBC1>(nRAM, rom_size_factor, true);
+        return true;
+    case 0x0F:
+        attachMemory<MBC3>(nRAM, rom_size_factor, true, false);
+        return true;
+    case 0x10:
+        attachMemory<MBC3>(nRAM, rom_size_factor, true, true);
+        return true;
+    case 0x11:
+    case 0x12:
+        attachMemory<MBC3>(nRAM, rom_size_factor, false, false);
+        return true;
+    case 0x13:
+        attachMemory<MBC3>(nRAM, rom_size_factor, false, true);
+        return true;
+    case 0x19:
+    case 0x1A:
+    case 0x1C:
+    case 0x1D:
+        attachMemory<MBC5>(nRAM, rom_size_factor, false);
+        return true;
+    case 0x1B:
+    case 0x1E:
+        attachMemory<MBC5>(nRAM, rom_size_factor, true);
+        return true;
+    default:
+        memory.reset();
+        backend = nullptr;
+        return false;
+    }
+}
+
+bool Machine::loadCartridge(const std::string& romPath, const std::string& bootRomPath, std::string& error) {
+    auto f = std::ifstream(romPath, std::ios::binary);
+
+    if (!f.is_open()) {
+        error = "Could not open ROM";
+        return false;
+    }
+
+    return loadCartridge(f, bootRomPath, error);
+}
+
+bool Machine::loadCartridge(std::istream& f, const std::string& bootRomPath, std::string& error) {
+    cpu = CPUState();
+#ifdef GB_LAZY_FLAGS
+    lazy.op = LazyOp::None;
+#endif
+    IME = true;
+    ime_sched = halted = stopped = false;
+    pending_interrupts = 0;
+    total_cycles = total_instructions = idle_cycles = 0;
+    event_batches = 0;
+    idle.branch = 0;
+
+    f.unsetf(std::ios::skipws);
+
+    f.seekg(0x147, std::ios::beg);
+
+    uint8_t chip = f.get();
+    size_t rom_size_factor = 1 << (f.get() + 1);
+    uint8_t nRAM = f.get();
+
+    f.seekg(0);
+
+    if (!createMemory(chip, rom_size_factor, nRAM)) {
+        std::stringstream msg;
+        msg << "Unsupported memory chip: 0x" << std::hex << unsigned(chip);
+        error = msg.str();
+        return false;
+    }
+
+    blocks.clear();
+    jit.reset();
+    memory->machine = this;
+    memory->loadROM(f);
+    recompiled_rom = Recompiled::matches(memory->romImage());
+
+    if (!bootRomPath.empty()) {
+        memory->loadBootROM(bootRomPath);
+    }
+
+    if (!memory->isBRActive()) {
+        $PC = 0x100; $SP = 0xFFFE;
+    }
+
+    timer = std::make_unique<Timer>(memory.get());
+    ppu = std::make_unique<PPUObj>(memory.get());
+
+    scheduler.clear();
+    scheduler.schedule(Event::Timer, timer->nextEvent());
+    scheduler.schedule(Event::PPU, ppu->nextEvent());
+
+    return true;
+}
+
+/**
+ * @brief Checks for and handles pending interrupts.
+ *
+ * This function tests `pending_interrupts`, the interrupt enable (IE) register
+ * (0xFFFF) masked by the interrupt flag (IF) register (0xFF0F). If any enabled
+ * interrupts are pending (i.e., the corresponding bits are set in both IE and
+ * IF), and the master interrupt enable flag (IME) is set, the function will:
+ * 1. Clear the `halted` flag if the CPU was halted.
+ * 2. Push the current program counter (PC) onto the stack.
+ * 3. Jump to the appropriate interrupt service routine (ISR) address.
+ * 4. Clear the corresponding bit in the IF register.
+ * 5. Clear the IME flag.
+ * The `ime_sched` flag is also cleared.
+ *
+ * @tparam M The concrete memory controller type of `memory`.
+ */
+template<class M>
+void Machine::checkInterrupts() {
+    uint8_t int_enabled = pending_interrupts;
+
+    if (int_enabled) {
+        if (halted) {
+            halted = false;
+        }
+
+        if (IME) {
+            M* bus = static_cast<M*>(memory.get());
+            uint8_t flags = bus->get(0xff0f);
+
+            bus->set(--$SP, $PC >> 8);
+            bus->set(--$SP, $PC & 0xFF);
+
+            if (int_enabled & 1) {
+                $PC = 0x40;
+                bus->set(0xff0f, flags & (~1));
+            }
+            else if (int_enabled & 2) {
+                $PC = 0x48;
+                bus->set(0xff0f, flags & (~2));
+            }
+            else if (int_enabled & 4) {
+                $PC = 0x50;
+                bus->set(0xff0f, flags & (~4));
+            }
+            else if (int_enabled & 8) {
+                $PC = 0x58;
+                bus->set(0xff0f, flags & (~8));
+            }
+            else if (int_enabled & 16) {
+                $PC = 0x60;
+                bus->set(0xff0f, flags & (~16));
+            }
+            else {
+                std::cout << "Unknown interrupt flag set";
+                $PC = 0;
+            }
+
+            IME = false;
+            ime_sched = false;
+        }
+    }
+}
+
+template<class M>
+uint8_t Machine::step() {
+    uint64_t start = total_cycles;
+
+    if (stopped) {
+        return 0;
+    }
+
+    if (!halted) {
+        uint16_t pc = $PC;
+        uint8_t op = static_cast<M*>(memory.get())->get(pc);
+        uint8_t cycles = executeOp<M>(op);
+
+        $PC++;
+        total_instructions++;
+        total_cycles += cycles;
+
+        if (loopedBack(op, pc)) {
+            skipIdleLoop<M>(pc, UINT8_MAX - cycles);
+        }
+    }
+    else {
+        // Only a scheduled event can end HALT, so skip the idle cycles up to the next one
+        total_cycles = std::min<uint64_t>(scheduler.next(), start + UINT8_MAX);
+    }
+
+    if (total_cycles >= scheduler.next()) {
+        runEvents<M>();
+    }
+
+    return total_cycles - start;
+}
+
+/**
+ * @brief Checks that the loop from `start` to the branch at `branch` can only change CPU registers.
+ *
+ * Allows register loads and arithmetic, memory reads, CB operations other than
+ * writes to (HL), and conditional jumps that leave the loop forwards. Anything
+ * that writes memory or I/O, touches the stack, IME or HALT/STOP, or could
+ * jump elsewhere and come back is rejected.
+ *
+ * @param mem The memory the loop runs from.
+ * @param start Address of the first instruction of the loop body.
+ * @param branch Address of the backward jump that closes the loop.
+ * @return True if running the loop has no side effects.
+ */
+static bool isSideEffectFree(Mem& mem, uint16_t start, uint16_t branch) {
+    uint16_t pc = start;
+
+    while (pc < branch) {
+        uint8_t op = mem.get(pc);
+        unsigned length = 1;
+
+        switch (op) {
+        case 0x00:
+        case 0x03: case 0x0B: case 0x13: case 0x1B: case 0x23: case 0x2B:
+        case 0x04: case 0x05: case 0x0C: case 0x0D: case 0x14: case 0x15:
+        case 0x1C: case 0x1D: case 0x24: case 0x25: case 0x2C: case 0x2D: case 0x3C: case 0x3D:
+        case 0x07: case 0x0F: case 0x17: case 0x1F: case 0x27: case 0x2F: case 0x37: case 0x3F:
+        case 0x09: case 0x19: case 0x29:
+        case 0x0A: case 0x1A: case 0x2A: case 0x3A:
+        case 0xF2:
+            break;
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+        case 0xF0:
+            length = 2;
+            break;
+        case 0x01: case 0x11: case 0x21:
+        case 0xFA:
+            length = 3;
+            break;
+        case 0xCB:
+        {
+            uint8_t cb = mem.get(pc + 1);
+
+            // Only BIT may operate on (HL); the other CB operations write it back
+            if ((cb & 7) == 6 && (cb < 0x40 || cb >= 0x80)) {
+                return false;
+            }
+
+            length = 2;
+            break;
+        }
+        case 0x20: case 0x28: case 0x30: case 0x38:
+            if (uint16_t(pc + 2 + int8_t(mem.get(pc + 1))) <= branch) {
+                return false;
+            }
+
+            length = 2;
+            break;
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+            if (uint16_t(mem.get(pc + 1) | (mem.get(pc + 2) << 8)) <= branch) {
+                return false;
+            }
+
+            length = 3;
+            break;
+        default:
+            // LD r,r' and the ALU block, except LD (HL),r and HALT
+            if (op >= 0x40 && op < 0xC0 && (op < 0x70 || op > 0x77)) {
+                break;
+            }
+
+            return false;
+        }
+
+        pc += length;
+    }
+
+    return pc == branch;
+}
+
+/**
+ * @brief Fast-forwards through a loop that is waiting for an event.
+ *
+ * Polling loops like `ldh a,(0x44); cp 0x90; jr nz` spin until the PPU or the
+ * timer changes a register. If an iteration of such a loop starts and ends in
+ * the same CPU state, no event ran during it and its body cannot write
+ * anything, the next iterations are exact repeats until the next event. So
+ * whole iterations are skipped up to the next scheduled event, and the loop
+ * carries on normally from there, reaching the event on the same cycle it
+ * would have without skipping. A loop that reads DIV or TIMA only repeats
+ * until they next change, which is not an event (see `Timer`).
+ *
+ * @tparam M The concrete memory controller type of `memory`.
+ * @param branch Address of the backward jump that was just taken.
+ * @param limit Maximum number of M-cycles to skip.
+ * @return The number of M-cycles skipped.
+ */
+template<class M>
+uint64_t Machine::skipIdleLoop(uint16_t branch, uint64_t limit) {
+    const CPUState& state = flags();
+
+    if (branch != idle.branch || state != idle.cpu || event_batches != idle.events || ime_sched) {
+        idle.branch = branch;
+        idle.cpu = state;
+        idle.cycles = total_cycles;
+        idle.instructions = total_instructions;
+        idle.events = event_batches;
+        idle.div_reads = timer->divReads();
+        idle.tima_reads = timer->timaReads();
+        return 0;
+    }
+
+    uint64_t period = total_cycles - idle.cycles;
+    uint64_t instructions = total_instructions - idle.instructions;
+    uint64_t until = scheduler.next();
+    uint64_t skipped = 0;
+
+    // DIV and TIMA change without an event: a loop reading them repeats only until they do
+    bool div = timer->divReads() != idle.div_reads, tima = timer->timaReads() != idle.tima_reads;
+
+    if (div || tima) {
+        until = std::min(until, timer->nextChange(idle.cycles, div, tima));
+    }
+
+    if (total_cycles < until && isSideEffectFree(*memory, $PC, branch)) {
+        skipped = std::min(until - total_cycles, limit) / period * period;
+
+        total_cycles += skipped;
+        total_instructions += skipped / period * instructions;
+        idle_cycles += skipped;
+    }
+
+    idle.cycles = total_cycles;
+    idle.instructions = total_instructions;
+    idle.div_reads = timer->divReads();
+    idle.tima_reads = timer->timaReads();
+
+    return skipped;
+}
+
+/**
+ * @brief Handles every event that is due at `total_cycles`.
+ *
+ * Events due at the same boundary run in the order the per-instruction loop
+ * used to run them: PPU, then timer, then the interrupt check, which sees any
+ * interrupt either of them just requested. Handlers can schedule more work for
+ * the same boundary (e.g. requesting an interrupt), so this loops until nothing
+ * is due.
+ *
+ * @tparam M The concrete memory controller type of `memory`.
+ */
+template<class M>
+void Machine::runEvents() {
+    event_batches++;
+
+    while (scheduler.next() <= total_cycles) {
+        if (scheduler.take(Event::PPU, total_cycles)) {
+            scheduler.schedule(Event::PPU, ppu->update<M>(total_cycles));
+        }
+
+        if (scheduler.take(Event::Timer, total_cycles)) {
+            scheduler.schedule(Event::Timer, timer->update<M>(total_cycles));
+        }
+
+        if (scheduler.take(Event::Interrupts, total_cycles)) {
+            checkInterrupts<M>();
+        }
+
+        // Nothing to do: the run loop checks its own targets (and the cached dispatch
+        // `code_changed`) after every batch of events
+        scheduler.take(Event::RunTarget, total_cycles);
+        scheduler.take(Event::Code, total_cycles);
+    }
+}
+
+template<class M>
+void Machine::runUntil(uint64_t cycle_target, uint64_t frame_target) {
+    scheduler.schedule(Event::RunTarget, cycle_target);
+
+    while (total_cycles < cycle_target && ppu->frameCount() < frame_target && !stopped) {
+        if (dispatch == Dispatch::Threaded && !halted) {
+            runThreaded<M>(cycle_target, frame_target);
+        }
+        else if ((dispatch == Dispatch::Cached || dispatch == Dispatch::Jit || dispatch == Dispatch::Recompiled) && !halted) {
+            runCached<M>(cycle_target, frame_target);
+        }
+        else {
+            step<M>();
+        }
+    }
+
+    scheduler.cancel(Event::RunTarget);
+}
+
+#define GB_INSTANTIATE_EVENTS(M) \
+    template void Machine::runEvents<M>(); \
+    template uint64_t Machine::skipIdleLoop<M>(uint16_t, uint64_t);
+GB_MAPPERS(GB_INSTANTIATE_EVENTS)
+#undef GB_INSTANTIATE_EVENTS
+
+void Machine::checkInterrupts() {
+    (this->*backend->checkInterrupts)();
+}
+
+void Machine::codeWritten(const uint8_t* page, uint8_t offset) {
+    if (blocks.invalidate(page, offset)) {
+        memory->unwatchCode(page);
+        code_changed = true;
+        scheduler.expedite(Event::Code, total_cycles);
+    }
+}
+
+void Machine::codeMoved() {
+    if (!blocks.empty()) {
+        code_changed = true;
+        scheduler.expedite(Event::Code, total_cycles);
+    }
+}
+
+void Machine::setButtons(uint8_t buttons) {
+    joypad.buttons = buttons;
+
+    if (!memory) {
+        return;
+    }
+
+    // Rewriting the select bits makes handleIO recompute the input lines from the new latch
+    uint8_t before = memory->get(0xff00);
+    memory->set(0xff00, before);
+
+    if (before & ~memory->get(0xff00) & 0x0F) {
+        memory->set(0xff0f, memory->get(0xff0f) | 0x10);
+    }
+}
+
+uint8_t Machine::step() {
+    return (this->*backend->step)();
+}
+
+uint8_t Machine::executeOp(uint8_t op) {
+    return (this->*backend->executeOp)(op);
+}
+
+uint64_t Machine::run_cycles(uint64_t n) {
+    uint64_t start = total_cycles;
+
+    (this->*backend->runUntil)(start + n, UINT64_MAX);
+
+    return total_cycles - start;
+}
+
+uint64_t Machine::run_frames(uint64_t n) {
+    uint64_t start = total_cycles;
+
+    (this->*backend->runUntil)(UINT64_MAX, ppu->frameCount() + n);
+
+    return total_cycles - start;
+}
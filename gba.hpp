@@ -4,79 +4,553 @@
 #include <array>
 #include <vector>
 #include <memory>
+#include <string>
 
 #include "memory.hpp"
 #include "timer.hpp"
+#include "ppu.hpp"
+#include "scheduler.hpp"
+#include "blockcache.hpp"
+#include "jit.hpp"
+#include "recompiled.hpp"
 
 /**
- * @brief Union representing a 16-bit CPU register.
- * Allows access to the register as a whole 16-bit word,
- * or as two separate 8-bit bytes (high and low).
- * Also provides a bitfield structure for the F (Flags) register.
+ * @brief A 16-bit view over two 8-bit registers (BC, DE or HL).
+ * Reads combine the two bytes and writes split the value back, so the pair
+ * never has to share storage with its halves.
  */
-union Register {
-    uint16_t word;
-#pragma pack(2) // Ensure byte packing for hi/lo members
-    struct {
-        uint8_t lo; // Low byte of the register (e.g., C, E, L, F)
-        uint8_t hi; // High byte of the register (e.g., B, D, H, A)
-    } bytes;
-    struct {
-        unsigned int : 4;        // Offset bits
-        unsigned int carry : 1;   // Carry flag (C)
-        unsigned int half : 1;    // Half-carry flag (H)
-        unsigned int subtract : 1;// Subtract flag (N)
-        unsigned int zero : 1;    // Zero flag (Z)
-        unsigned int : 8;        // Offset bits
-    } flags;
-#pragma pack()
+struct RegisterPair {
+    uint8_t& hi; // High byte (B, D, H)
+    uint8_t& lo; // Low byte (C, E, L)
+
+    operator uint16_t() const { return (hi << 8) | lo; }
+
+    RegisterPair& operator=(uint16_t value) {
+        hi = value >> 8; lo = value & 0xFF;
+        return *this;
+    }
+
+    RegisterPair& operator++() { return *this = uint16_t(*this + 1); }
+    RegisterPair& operator--() { return *this = uint16_t(*this - 1); }
 };
 
 /**
- * @brief Array of CPU registers (AF, BC, DE, HL, PC, SP).
- * AF is registers[0], BC is registers[1], etc.
+ * @brief CPU register file.
+ * Every 8-bit register is a plain byte and every flag a plain bool, so the
+ * compiler can keep them in host registers and update a flag with a single
+ * store. The F register and the 16-bit pairs are synthesised on access.
  */
-inline std::array< Register, 6 > registers;
-/**
- * @brief Global unique pointer to the Timer object.
- */
-inline std::unique_ptr<Timer> timer;
+struct CPUState {
+    uint8_t a = 0, b = 0, c = 0, d = 0, e = 0, h = 0, l = 0;
+    bool zf = false; // Zero flag (Z)
+    bool nf = false; // Subtract flag (N)
+    bool hf = false; // Half-carry flag (H)
+    bool cf = false; // Carry flag (C)
+    uint16_t pc = 0, sp = 0;
+
+    /**
+     * @brief Packs the flags into the F register layout (ZNHC0000).
+     */
+    uint8_t f() const {
+        return (zf << 7) | (nf << 6) | (hf << 5) | (cf << 4);
+    }
+
+    /**
+     * @brief Unpacks an F register value into the flags. The low nibble is ignored.
+     */
+    void setF(uint8_t f) {
+        zf = f & 0x80; nf = f & 0x40; hf = f & 0x20; cf = f & 0x10;
+    }
+
+    RegisterPair bc() { return { b, c }; }
+    RegisterPair de() { return { d, e }; }
+    RegisterPair hl() { return { h, l }; }
+
+    uint16_t af() const { return (a << 8) | f(); }
+    void setAF(uint16_t value) { a = value >> 8; setF(value & 0xFF); }
+
+    bool operator==(const CPUState&) const = default;
+};
 
 /**
- * @brief Flag to schedule enabling of IME (Interrupt Master Enable) after the next instruction.
- */
-inline bool ime_sched = false;
-/**
- * @brief Interrupt Master Enable flag. If false, CPU will not jump to interrupt vectors.
- */
-inline bool IME = true;
-/**
- * @brief CPU Halted flag. Set when HALT instruction is executed.
- */
-inline bool halted = false;
-/**
- * @brief CPU Stopped flag. Set when STOP instruction is executed.
+ * @brief A complete emulated Game Boy.
+ * Owns the CPU registers, memory controller, timer and PPU, so any number of
+ * independent machines can run side by side (e.g. one per worker thread).
  */
-inline bool stopped = false;
-
-// Registers
-#define $A  registers[0].bytes.hi
-#define $B  registers[1].bytes.hi
-#define $C  registers[1].bytes.lo
-#define $BC registers[1].word
-#define $D  registers[2].bytes.hi
-#define $E  registers[2].bytes.lo
-#define $DE registers[2].word
-#define $F  registers[0].bytes.lo
-#define $Z  registers[0].flags.zero
-#define $N  registers[0].flags.subtract
-#define $HF  registers[0].flags.half
-#define $CR  registers[0].flags.carry
-#define $AF registers[0].word
-#define $H  registers[3].bytes.hi
-#define $L  registers[3].bytes.lo
-#define $HL registers[3].word
-#define $PC registers[4].word
-#define $SP registers[5].word
+class Machine {
+public:
+    /**
+     * @brief Interpreter dispatch strategy used by `run_cycles` and `run_frames`.
+     */
+    enum class Dispatch {
+        Switch,    // One big switch per instruction (portable reference)
+        Threaded,  // Per-opcode handlers that dispatch the next opcode themselves
+        Cached,    // Threaded handlers running blocks of pre-decoded instructions
+        Jit,       // Cached, with hot ROM blocks partly translated to x86-64 code (see `Jit`)
+        Recompiled // Cached, with ROM blocks compiled ahead of time where built in (see `Recompiled`)
+    };
+
+    Machine() = default;
+    ~Machine() = default;
+
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    /**
+     * @brief Loads a cartridge and prepares the machine to run it.
+     *
+     * Reads the cartridge header to pick the memory controller, loads the ROM
+     * and (optionally) the boot ROM, resets the CPU registers and timer and
+     * constructs the PPU. Never touches SDL, so it is safe to call headless.
+     *
+     * @param romPath Path to the .gb/.gbc file.
+     * @param bootRomPath Path to the boot ROM. If empty or unreadable the CPU starts at 0x100.
+     * @param error Receives a human-readable message when loading fails.
+     * @return True if the cartridge was loaded successfully, false otherwise.
+     */
+    bool loadCartridge(const std::string& romPath, const std::string& bootRomPath, std::string& error);
+
+    /**
+     * @brief Loads a cartridge from a binary stream (e.g. a ROM image already in memory).
+     * @param rom Binary stream over the ROM image.
+     * @param bootRomPath Path to the boot ROM. If empty or unreadable the CPU starts at 0x100.
+     * @param error Receives a human-readable message when loading fails.
+     * @return True if the cartridge was loaded successfully, false otherwise.
+     */
+    bool loadCartridge(std::istream& rom, const std::string& bootRomPath, std::string& error);
+
+    /**
+     * @brief Executes a single instruction and runs any PPU, timer or interrupt
+     * events that came due meanwhile. While halted, instead advances the clock
+     * straight to the next scheduled event (at most 255 M-cycles), since nothing
+     * else can happen before it; the same goes for the rest of an idle polling
+     * loop the instruction closed (see `skipIdleLoop`).
+     * @return The number of M-cycles that elapsed.
+     */
+    uint8_t step();
+
+    /**
+     * @brief Runs the machine for at least `n` M-cycles.
+     * @param n The number of M-cycles to run.
+     * @return The number of M-cycles actually run (may overshoot by one instruction).
+     */
+    uint64_t run_cycles(uint64_t n);
+
+    /**
+     * @brief Runs the machine until `n` more frames have been completed by the PPU.
+     * @param n The number of frames to run.
+     * @return The number of M-cycles that elapsed.
+     */
+    uint64_t run_frames(uint64_t n);
+
+    /**
+     * @brief Checks for and handles pending interrupts.
+     */
+    void checkInterrupts();
+
+    /**
+     * @brief Executes a non-prefixed Game Boy opcode.
+     * Fetches operands if necessary, performs the operation, updates flags,
+     * and returns the number of CPU cycles taken by the instruction.
+     * Handles instruction timing, immediate IME scheduling, and CB prefix.
+     * @param op The 8-bit opcode to execute.
+     * @return The number of M-cycles the instruction took.
+     */
+    uint8_t executeOp(uint8_t op);
+
+    /**
+     * @brief CPU registers.
+     * Read F and the flags through `flags()` (or the $F/$AF/flag macros): with
+     * lazy flags the stored flags can be stale.
+     */
+    CPUState cpu;
+
+    /**
+     * @brief Returns the register file with the flags up to date.
+     * With GB_LAZY_FLAGS, first computes the flags of the last deferred ALU operation.
+     * @return Reference to the register file.
+     */
+    CPUState& flags() {
+#ifdef GB_LAZY_FLAGS
+        if (lazy.op != LazyOp::None) {
+            materializeFlags();
+        }
+#endif
+        return cpu;
+    }
+
+    /**
+     * @brief Reads the Z flag without materialising the rest of F.
+     * @return The current zero flag.
+     */
+    bool zeroFlag() {
+#ifdef GB_LAZY_FLAGS
+        if (lazy.op != LazyOp::None) {
+            return lazy.op != LazyOp::ShiftA && !lazy.res;
+        }
+#endif
+        return cpu.zf;
+    }
+
+    /**
+     * @brief Reads the C flag without materialising the rest of F.
+     * @return The current carry flag.
+     */
+    bool carryFlag() {
+#ifdef GB_LAZY_FLAGS
+        switch (lazy.op) {
+        case LazyOp::Add:
+            return lazy.y > UINT8_MAX - (lazy.x + lazy.c);
+        case LazyOp::Sub:
+            return lazy.y > (lazy.x - lazy.c);
+        case LazyOp::Shift:
+        case LazyOp::ShiftA:
+            return lazy.y;
+        case LazyOp::And:
+        case LazyOp::Or:
+            return false;
+        case LazyOp::None:
+            break;
+        }
+#endif
+        return cpu.cf;
+    }
+    /**
+     * @brief Memory controller for the loaded cartridge.
+     */
+    std::unique_ptr<Mem> memory;
+    /**
+     * @brief Timer (DIV/TIMA/TMA/TAC).
+     */
+    std::unique_ptr<Timer> timer;
+    /**
+     * @brief Pixel Processing Unit.
+     */
+    std::unique_ptr<PPUObj> ppu;
+
+    /**
+     * @brief Due times of the PPU, timer and interrupt work, against `total_cycles`.
+     */
+    Scheduler scheduler;
+
+    /**
+     * @brief Makes the CPU loop check for interrupts at the end of the current instruction.
+     * Must be called whenever IE, IF, IME or `halted` changes; nothing else polls them.
+     */
+    void pollInterrupts() {
+        scheduler.expedite(Event::Interrupts, total_cycles);
+    }
+
+    /**
+     * @brief Requested and enabled interrupts, IF & IE. Updated by `handleIO`, which
+     * every write to IF or IE goes through (including the PPU's and timer's requests).
+     */
+    uint8_t pending_interrupts = 0;
+
+    /**
+     * @brief Called by the memory controller when a watched RAM page (see `Mem::watchCode`)
+     * is written. Drops its pre-decoded blocks if the write hit one of them.
+     * @param page Host address of the page.
+     * @param offset Offset of the written byte in the page.
+     */
+    void codeWritten(const uint8_t* page, uint8_t offset);
+
+    /**
+     * @brief Called by the memory controller after its page tables changed (bank switch,
+     * boot ROM unmapped), which may have changed the code behind the running block.
+     */
+    void codeMoved();
+
+    /**
+     * @brief Dispatch strategy for `run_cycles` and `run_frames`. `step` always uses the switch.
+     */
+    Dispatch dispatch = Dispatch::Threaded;
+
+    /**
+     * @brief Host button state, latched by `setButtons` and read when JOYP (0xFF00) is written.
+     */
+    struct Joypad {
+        /**
+         * @brief Pressed buttons: bits 0-3 are A, B, Select, Start and bits 4-7 are
+         * Right, Left, Up, Down (1 = pressed).
+         */
+        uint8_t buttons = 0;
+    } joypad;
+
+    /**
+     * @brief Latches the host buttons, typically once per frame.
+     * Refreshes JOYP for the currently selected button group and requests the
+     * joypad interrupt if that makes an input line go low (a selected button was
+     * newly pressed).
+     * @param buttons Pressed buttons, in the layout of `Joypad::buttons`.
+     */
+    void setButtons(uint8_t buttons);
+
+    /**
+     * @brief Flag to schedule enabling of IME (Interrupt Master Enable) after the next instruction.
+     */
+    bool ime_sched = false;
+    /**
+     * @brief Interrupt Master Enable flag. If false, CPU will not jump to interrupt vectors.
+     */
+    bool IME = true;
+    /**
+     * @brief CPU Halted flag. Set when HALT instruction is executed.
+     */
+    bool halted = false;
+    /**
+     * @brief CPU Stopped flag. Set when STOP instruction is executed.
+     */
+    bool stopped = false;
+
+    /**
+     * @brief Total number of M-cycles run since the cartridge was loaded.
+     * This is the master clock every scheduled event is stamped against.
+     */
+    uint64_t total_cycles = 0;
+    /**
+     * @brief Total number of instructions executed since the cartridge was loaded.
+     */
+    uint64_t total_instructions = 0;
+    /**
+     * @brief M-cycles skipped by fast-forwarding idle polling loops (see `skipIdleLoop`).
+     * Already counted in `total_cycles`, as are the skipped iterations' instructions
+     * in `total_instructions`.
+     */
+    uint64_t idle_cycles = 0;
+
+private:
+    friend struct Recompiled;
+
+#ifdef GB_LAZY_FLAGS
+    /**
+     * @brief Kind of ALU operation whose flags are deferred.
+     */
+    enum class LazyOp : uint8_t {
+        None,   // F is up to date
+        Add,    // ADD/ADC: x + y + c
+        Sub,    // SUB/SBC/CP: x - y - c
+        And,    // Z 0 1 0
+        Or,     // Z 0 0 0 (OR, XOR, SWAP)
+        Shift,  // Z 0 0 C, with C in y (CB rotates and shifts)
+        ShiftA  // 0 0 0 C, with C in y (RLCA, RLA, RRCA, RRA)
+    };
+
+    /**
+     * @brief Operands and result of the last flag-setting ALU operation,
+     * turned into F by `materializeFlags` only when a flag is actually read.
+     */
+    struct {
+        LazyOp op = LazyOp::None;
+        uint8_t x, y, c, res;
+    } lazy;
+
+    void deferFlags(LazyOp op, uint8_t x, uint8_t y, uint8_t c, uint8_t res) {
+        lazy.op = op; lazy.x = x; lazy.y = y; lazy.c = c; lazy.res = res;
+    }
+    void materializeFlags();
+#endif
+
+    /**
+     * @brief Entry points of the CPU loop instantiated for one memory controller type.
+     * Picked once in `loadCartridge`; everything below these calls accesses the
+     * bus through the concrete mapper, so reads and writes inline.
+     */
+    struct Backend {
+        uint8_t (Machine::*step)();
+        uint8_t (Machine::*executeOp)(uint8_t op);
+        void (Machine::*checkInterrupts)();
+        void (Machine::*runUntil)(uint64_t cycle_target, uint64_t frame_target);
+    };
+
+    template<class M> static const Backend backendFor;
+
+    /**
+     * @brief CPU loop entry points for the loaded cartridge's memory controller.
+     */
+    const Backend* backend = nullptr;
+
+    /**
+     * @brief Creates the memory controller matching the cartridge type byte (0x147)
+     * and selects the matching `backend`.
+     * @param chip The cartridge type from the ROM header.
+     * @param rom_size_factor Number of 16 KiB ROM banks.
+     * @param nRAM The RAM size byte from the ROM header.
+     * @return False if the chip is not supported.
+     */
+    bool createMemory(uint8_t chip, size_t rom_size_factor, uint8_t nRAM);
+
+    template<class M, class... Args> void attachMemory(Args... args);
+
+    template<class M> uint8_t step();
+    template<class M> void checkInterrupts();
+
+    /**
+     * @brief Handles every scheduled event that is due at `total_cycles`.
+     * Called by the CPU loop whenever the clock reaches `scheduler.next()`.
+     */
+    template<class M> void runEvents();
+
+    /**
+     * @brief Number of `runEvents` calls so far, so idle loop detection can tell
+     * whether anything outside the CPU ran during a loop iteration.
+     */
+    uint64_t event_batches = 0;
+
+    /**
+     * @brief Longest loop, in bytes from target to branch, that is checked for idling.
+     */
+    static constexpr uint16_t IDLE_LOOP_BYTES = 32;
+
+    /**
+     * @brief The short backward branch last taken, and the machine state when it was.
+     */
+    struct {
+        uint16_t branch = 0;
+        CPUState cpu;
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t events = 0;
+        uint64_t div_reads = 0;
+        uint64_t tima_reads = 0;
+    } idle;
+
+    /**
+     * @brief Checks whether the jump `op` at `from` just went a short way back (to `$PC`),
+     * i.e. whether it may close an idle loop.
+     */
+    bool loopedBack(uint8_t op, uint16_t from) const {
+        switch (op) {
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+            return cpu.pc <= from && from - cpu.pc <= IDLE_LOOP_BYTES;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * @brief Fast-forwards through an idle loop closed by the branch at `branch`.
+     * Called after the branch has run and `total_cycles` has been advanced past it.
+     * @param limit Maximum number of M-cycles to skip.
+     * @return The number of M-cycles skipped.
+     */
+    template<class M> uint64_t skipIdleLoop(uint16_t branch, uint64_t limit);
+
+    /**
+     * @brief Runs until `total_cycles` reaches `cycle_target`, the PPU completes
+     * frame number `frame_target`, or the CPU stops, using the selected dispatch.
+     */
+    template<class M> void runUntil(uint64_t cycle_target, uint64_t frame_target);
+    template<class M> void runThreaded(uint64_t cycle_target, uint64_t frame_target);
+    template<class M> void runCached(uint64_t cycle_target, uint64_t frame_target);
+
+    /**
+     * @brief Finds or decodes the block starting at `$PC` for the cached dispatch.
+     * @return Its first instruction, or nullptr if code at `$PC` is not cached
+     * (it is outside ROM and RAM, or crosses into the next page).
+     */
+    template<class M> const DecodedOp* findBlock();
+
+    /**
+     * @brief Runs the copy or fill loop of the `BULK_LOOP` op `decoded` in bulk:
+     * as many whole iterations as finish by the next event, or all of them.
+     * @return False, with nothing run, if not even one iteration fits or the loop
+     * touches memory with side effects (see `bulkAccessible`).
+     */
+    template<class M> bool runBulkLoop();
+
+    /**
+     * @brief Pre-decoded blocks of the cached dispatch.
+     */
+    BlockCache blocks;
+
+    /**
+     * @brief Native code of the Jit dispatch, created on first use when `Jit::available`.
+     */
+    std::unique_ptr<Jit> jit;
+
+    /**
+     * @brief Whether the ROM blocks built in (see `Recompiled`) belong to the loaded cartridge.
+     */
+    bool recompiled_rom = false;
+
+    /**
+     * @brief Runs instruction `OP` of a block compiled ahead of time, as the cached
+     * dispatch would run `op`.
+     * @return False if an event came due, so the block must return to the dispatch.
+     */
+    template<class M, uint8_t OP> bool recompiledStep(const DecodedOp* op);
+
+    /**
+     * @brief Instruction of the running block the cached dispatch is executing.
+     */
+    const DecodedOp* decoded = nullptr;
+
+    /**
+     * @brief Set when the running block may no longer match memory, so the cached
+     * dispatch looks its next instruction up again.
+     */
+    bool code_changed = false;
+
+    template<class M, bool Decoded = false> uint8_t execute(uint8_t op);
+    template<class M> uint8_t executeOp(uint8_t op);
+    template<class M, uint8_t OP, bool Decoded = false> uint8_t executeOp();
+
+    // Memory access and ALU helpers used by the opcode implementations (opcodes.cpp)
+    template<class M> uint8_t read(uint16_t addr);
+    template<class M> uint16_t read16(uint16_t addr);
+    template<class M> void write(uint16_t addr, uint8_t val);
+    template<class M, bool Decoded> uint8_t imm8();
+    template<class M, bool Decoded> uint16_t imm16();
+    void clearFlags();
+    uint8_t add(uint8_t x, uint8_t y, bool carry);
+    uint8_t add(uint8_t x, uint8_t y);
+    uint16_t add(uint16_t x, uint16_t y);
+    uint16_t add(uint16_t x, uint8_t y);
+    uint8_t sub(uint8_t x, uint8_t y, bool carry);
+    uint8_t sub(uint8_t x, uint8_t y);
+    uint8_t inc(uint8_t x);
+    uint16_t inc(uint16_t x);
+    uint8_t dec(uint8_t x);
+    uint16_t dec(uint16_t x);
+    uint8_t and8(uint8_t x, uint8_t y);
+    uint8_t or8(uint8_t x, uint8_t y);
+    uint8_t xor8(uint8_t x, uint8_t y);
+    uint8_t swap(uint8_t x);
+    uint8_t sl(uint8_t x);
+    uint8_t sr(uint8_t x, bool logical);
+    uint8_t rl(uint8_t x, bool carry, bool isA);
+    uint8_t rl(uint8_t x, bool carry);
+    uint8_t rr(uint8_t x, bool carry, bool isA);
+    uint8_t rr(uint8_t x, bool carry);
+    void test(uint8_t x, int pos);
+    uint8_t set(uint8_t x, int pos);
+    uint8_t res(uint8_t x, int pos);
+    template<class M> void executePrefixOp(uint8_t op);
+    template<class M, uint8_t OP> void executePrefixOp();
+    template<uint8_t OP> uint8_t prefixOperation(uint8_t x);
+    template<int R> uint8_t& reg8();
+};
+
+// Registers (members of Machine). F and the flags go through flags() so lazy flags are materialised.
+#define $A  cpu.a
+#define $B  cpu.b
+#define $C  cpu.c
+#define $BC cpu.bc()
+#define $D  cpu.d
+#define $E  cpu.e
+#define $DE cpu.de()
+#define $F  flags().f()
+#define $Z  flags().zf
+#define $N  flags().nf
+#define $HF  flags().hf
+#define $CR  flags().cf
+#define $AF flags().af()
+#define $H  cpu.h
+#define $L  cpu.l
+#define $HL cpu.hl()
+#define $PC cpu.pc
+#define $SP cpu.sp
 
 #endif
\ No newline at end of file
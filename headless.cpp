@@ -0,0 +1,155 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "gba.hpp"
+
+/**
+ * @brief Prints command-line usage for the headless driver.
+ * @param name The executable name (argv[0]).
+ */
+static void usage(const char* name) {
+    std::cout << "usage: " << name << " <rom> [--frames N] [--cycles N] [--boot PATH] [--instances N] [--render N]\n"
+              << "       [--dispatch switch|threaded|cached|jit|recompiled]\n"
+              << "  --frames N     run N frames (default 600)\n"
+              << "  --cycles N     run N M-cycles instead of a number of frames\n"
+              << "  --boot PATH    boot ROM to run before the cartridge\n"
+              << "  --instances N  run N independent machines, one per thread (default 1)\n"
+              << "  --render N     render every Nth frame, 0 for none; the rest keep their timing\n"
+              << "                 but produce no pixels (default 1)\n"
+              << "  --dispatch D   interpreter dispatch: switch, threaded, cached, jit or recompiled\n"
+              << "                 (default threaded)\n";
+}
+
+/**
+ * @brief Entry point for the headless emulator.
+ *
+ * Loads the ROM given on the command line, runs it for a fixed number of
+ * frames or M-cycles without any video, audio or input, and reports the
+ * achieved throughput.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 on success, 1 on error.
+ */
+int main(int argc, char* argv[])
+{
+    std::string romPath, bootRomPath;
+    uint64_t frames = 600, cycles = 0;
+    unsigned instances = 1, render = 1;
+    Machine::Dispatch dispatch = Machine::Dispatch::Threaded;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--cycles" && i + 1 < argc) {
+            cycles = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--boot" && i + 1 < argc) {
+            bootRomPath = argv[++i];
+        }
+        else if (arg == "--instances" && i + 1 < argc) {
+            instances = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--render" && i + 1 < argc) {
+            render = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--dispatch" && i + 1 < argc) {
+            std::string mode = argv[++i];
+
+            if (mode == "switch") {
+                dispatch = Machine::Dispatch::Switch;
+            }
+            else if (mode == "threaded") {
+                dispatch = Machine::Dispatch::Threaded;
+            }
+            else if (mode == "cached") {
+                dispatch = Machine::Dispatch::Cached;
+            }
+            else if (mode == "jit") {
+                dispatch = Machine::Dispatch::Jit;
+            }
+            else if (mode == "recompiled") {
+                dispatch = Machine::Dispatch::Recompiled;
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (romPath.empty() && arg[0] != '-') {
+            romPath = arg;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (romPath.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Machine>> machines;
+
+    for (unsigned i = 0; i < instances; i++) {
+        auto machine = std::make_unique<Machine>();
+        std::string error;
+
+        if (!machine->loadCartridge(romPath, bootRomPath, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+
+        machine->dispatch = dispatch;
+        machine->ppu->setRenderInterval(render);
+        machines.push_back(std::move(machine));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+
+    for (auto& machine : machines) {
+        threads.emplace_back([&machine, cycles, frames] {
+            if (cycles) {
+                machine->run_cycles(cycles);
+            }
+            else {
+                machine->run_frames(frames);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double seconds = elapsed.count();
+
+    uint64_t ran = 0, instructions = 0, idle = 0;
+
+    for (auto& machine : machines) {
+        ran += machine->total_cycles;
+        instructions += machine->total_instructions;
+        idle += machine->idle_cycles;
+    }
+
+    std::cout << "instances:    " << instances << "\n"
+              << "cycles:       " << ran << "\n"
+              << "instructions: " << instructions << "\n"
+              << "idle cycles:  " << idle << " (skipped in polling loops)\n"
+              << "seconds:      " << seconds << "\n"
+              << "MIPS:         " << (seconds > 0 ? instructions / seconds / 1e6 : 0) << "\n"
+              << "speed:        " << (seconds > 0 ? ran / seconds / 1048576.0 : 0) << "x realtime\n";
+
+    return 0;
+}
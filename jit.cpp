@@ -0,0 +1,896 @@
+#include "jit.hpp"
+#include "gba.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+#ifdef GB_JIT_X86_64
+#include <sys/mman.h>
+
+/**
+ * @brief Size of the executable buffer shared by every region of a machine.
+ */
+static constexpr size_t CODE_SIZE = 4 << 20;
+
+/**
+ * @brief Longest native code of one region: 32 instructions of at most ~110 bytes plus entry and exit.
+ */
+static constexpr size_t MAX_REGION_CODE = 4096;
+
+/**
+ * @brief Slow path of native reads, for pages without a host pointer.
+ * A region runs with the machine's clock at its start; registers computed from
+ * the clock (DIV, TIMA) are read as of the reading instruction, `elapsed`
+ * M-cycles into the region, like the interpreter would.
+ */
+static uint8_t readSlow(Mem* memory, uint16_t addr, unsigned elapsed) {
+    uint64_t& now = memory->machine->total_cycles;
+
+    now += elapsed;
+    uint8_t value = memory->get(addr);
+    now -= elapsed;
+
+    return value;
+}
+
+namespace {
+
+enum Reg : uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Where the guest registers live inside a region. RDI holds the CPUState, RSI the context,
+// and RAX, RCX, RDX and R15 are scratch. Every 8-bit register is kept zero-extended.
+constexpr Reg A = R8, B = R9, C = R10, D = R11, E = RBX, H = RBP, L = R12, SP = R13, F = R14;
+
+// Register operand of an opcode: 0=B, 1=C, 2=D, 3=E, 4=H, 5=L, 6=(HL), 7=A
+constexpr Reg operands[8] = { B, C, D, E, H, L, RAX, A };
+
+// Guest register bits, to load and store only what a region uses
+enum Use : uint16_t {
+    UA = 1 << 0, UB = 1 << 1, UC = 1 << 2, UD = 1 << 3, UE = 1 << 4, UH = 1 << 5, UL = 1 << 6,
+    USP = 1 << 7, UF = 1 << 8
+};
+
+constexpr uint16_t useOf(Reg r) {
+    switch (r) {
+    case A: return UA;
+    case B: return UB;
+    case C: return UC;
+    case D: return UD;
+    case E: return UE;
+    case H: return UH;
+    case L: return UL;
+    case SP: return USP;
+    case F: return UF;
+    default: return 0;
+    }
+}
+
+// Arithmetic group (/digit of the 0x80/0x81 immediate forms)
+enum Alu : uint8_t { ADD, OR, ADC, SBB, AND, SUB, XOR, CMP };
+
+// Shift group (/digit of the 0xC0/0xC1/0xD0 forms)
+enum Shift : uint8_t { ROL, ROR, RCL, RCR, SHL, SHR, SAR = 7 };
+
+// Condition codes of SETcc/Jcc
+enum Cond : uint8_t { CC_C = 0x2, CC_Z = 0x4 };
+
+/**
+ * @brief Minimal x86-64 encoder for the instructions the regions need.
+ */
+class Assembler {
+public:
+    std::vector<uint8_t> bytes;
+
+    void byte(uint8_t b) { bytes.push_back(b); }
+
+    void imm32(uint32_t v) {
+        for (int i = 0; i < 4; i++) byte(v >> (i * 8));
+    }
+
+    void imm64(uint64_t v) {
+        for (int i = 0; i < 8; i++) byte(v >> (i * 8));
+    }
+
+    // REX prefix; `force` makes SPL/BPL/SIL/DIL addressable instead of AH/CH/DH/BH
+    void rex(bool w, unsigned reg, unsigned index, unsigned rm, bool force) {
+        uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (rm >> 3);
+
+        if (r != 0x40 || force) {
+            byte(r);
+        }
+    }
+
+    // Register-direct ModRM
+    void direct(unsigned reg, unsigned rm) {
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // ModRM (and SIB) for [base + index * 2^scale + disp]; index < 0 for none
+    void memory(unsigned reg, unsigned base, int index, unsigned scale, int32_t disp) {
+        uint8_t mod = disp == 0 && (base & 7) != RBP ? 0 : (disp >= -128 && disp < 128 ? 1 : 2);
+
+        if (index >= 0 || (base & 7) == RSP) {
+            byte((mod << 6) | ((reg & 7) << 3) | 4);
+            byte((scale << 6) | ((index >= 0 ? index & 7 : 4) << 3) | (base & 7));
+        }
+        else {
+            byte((mod << 6) | ((reg & 7) << 3) | (base & 7));
+        }
+
+        if (mod == 1) {
+            byte(disp);
+        }
+        else if (mod == 2) {
+            imm32(disp);
+        }
+    }
+
+    // op r/m32, r32 (MOV 0x89, ADD 0x01, OR 0x09, AND 0x21, SUB 0x29, XOR 0x31, CMP 0x39)
+    void rr32(uint8_t op, Reg dst, Reg src) {
+        rex(false, src, 0, dst, false);
+        byte(op);
+        direct(src, dst);
+    }
+
+    // op r/m8, r8 (MOV 0x88, ADD 0x00, ADC 0x10, SUB 0x28, SBB 0x18, AND 0x20, XOR 0x30, OR 0x08, TEST 0x84)
+    void rr8(uint8_t op, Reg dst, Reg src) {
+        rex(false, src, 0, dst, true);
+        byte(op);
+        direct(src, dst);
+    }
+
+    void mov(Reg dst, Reg src) { rr32(0x89, dst, src); }
+
+    void movImm(Reg dst, uint32_t imm) {
+        rex(false, 0, 0, dst, false);
+        byte(0xB8 | (dst & 7));
+        imm32(imm);
+    }
+
+    void movImm64(Reg dst, uint64_t imm) {
+        rex(true, 0, 0, dst, false);
+        byte(0xB8 | (dst & 7));
+        imm64(imm);
+    }
+
+    // op r/m32, imm
+    void alu32(Alu op, Reg dst, int32_t imm) {
+        rex(false, 0, 0, dst, false);
+
+        if (imm >= -128 && imm < 128) {
+            byte(0x83);
+            direct(op, dst);
+            byte(imm);
+        }
+        else {
+            byte(0x81);
+            direct(op, dst);
+            imm32(imm);
+        }
+    }
+
+    // op r/m8, imm8
+    void alu8(Alu op, Reg dst, uint8_t imm) {
+        rex(false, 0, 0, dst, true);
+        byte(0x80);
+        direct(op, dst);
+        byte(imm);
+    }
+
+    // op r/m8, r8
+    void alu8(Alu op, Reg dst, Reg src) {
+        static constexpr uint8_t opcodes[8] = { 0x00, 0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38 };
+        rr8(opcodes[op], dst, src);
+    }
+
+    // shift r/m32, imm8
+    void shift32(Shift op, Reg dst, uint8_t count) {
+        rex(false, 0, 0, dst, false);
+        byte(0xC1);
+        direct(op, dst);
+        byte(count);
+    }
+
+    // shift r/m8, imm8 (by 1 with the short form)
+    void shift8(Shift op, Reg dst, uint8_t count) {
+        rex(false, 0, 0, dst, true);
+
+        if (count == 1) {
+            byte(0xD0);
+            direct(op, dst);
+        }
+        else {
+            byte(0xC0);
+            direct(op, dst);
+            byte(count);
+        }
+    }
+
+    void test8(Reg dst, uint8_t imm) {
+        rex(false, 0, 0, dst, true);
+        byte(0xF6);
+        direct(0, dst);
+        byte(imm);
+    }
+
+    // BT r/m32, imm8: CF = bit
+    void bt(Reg dst, uint8_t bit) {
+        rex(false, 0, 0, dst, false);
+        byte(0x0F); byte(0xBA);
+        direct(4, dst);
+        byte(bit);
+    }
+
+    void setcc(Cond cc, Reg dst) {
+        rex(false, 0, 0, dst, true);
+        byte(0x0F); byte(0x90 | cc);
+        direct(0, dst);
+    }
+
+    // MOVZX r32, r/m8
+    void movzx8(Reg dst, Reg src) {
+        rex(false, dst, 0, src, true);
+        byte(0x0F); byte(0xB6);
+        direct(dst, src);
+    }
+
+    // MOVZX r32, byte [base + index + disp]
+    void loadByte(Reg dst, Reg base, int index, int32_t disp) {
+        rex(false, dst, index >= 0 ? index : 0, base, false);
+        byte(0x0F); byte(0xB6);
+        memory(dst, base, index, 0, disp);
+    }
+
+    // MOVZX r32, word [base + disp]
+    void loadWord(Reg dst, Reg base, int32_t disp) {
+        rex(false, dst, 0, base, false);
+        byte(0x0F); byte(0xB7);
+        memory(dst, base, -1, 0, disp);
+    }
+
+    // MOV byte [base + disp], r8
+    void storeByte(Reg base, int32_t disp, Reg src) {
+        rex(false, src, 0, base, true);
+        byte(0x88);
+        memory(src, base, -1, 0, disp);
+    }
+
+    // MOV word [base + disp], r16
+    void storeWord(Reg base, int32_t disp, Reg src) {
+        byte(0x66);
+        rex(false, src, 0, base, false);
+        byte(0x89);
+        memory(src, base, -1, 0, disp);
+    }
+
+    // MOV r64, [base + index * 2^scale + disp]
+    void loadQword(Reg dst, Reg base, int index, unsigned scale, int32_t disp) {
+        rex(true, dst, index >= 0 ? index : 0, base, false);
+        byte(0x8B);
+        memory(dst, base, index, scale, disp);
+    }
+
+    // LEA r32, [base + index]
+    void lea(Reg dst, Reg base, Reg index) {
+        rex(false, dst, index, base, false);
+        byte(0x8D);
+        memory(dst, base, index, 0, 0);
+    }
+
+    void testQword(Reg dst, Reg src) {
+        rex(true, src, 0, dst, false);
+        byte(0x85);
+        direct(src, dst);
+    }
+
+    void push(Reg r) {
+        rex(false, 0, 0, r, false);
+        byte(0x50 | (r & 7));
+    }
+
+    void pop(Reg r) {
+        rex(false, 0, 0, r, false);
+        byte(0x58 | (r & 7));
+    }
+
+    void callRax() { byte(0xFF); byte(0xD0); }
+    void ret() { byte(0xC3); }
+
+    void rsp(Alu op, int8_t imm) {
+        byte(0x48); byte(0x83);
+        direct(op, RSP);
+        byte(imm);
+    }
+
+    // Short jump with its offset patched by `bind`; returns the patch position
+    size_t jump(uint8_t opcode) {
+        byte(opcode); byte(0);
+        return bytes.size();
+    }
+
+    void bind(size_t patch) {
+        bytes[patch - 1] = uint8_t(bytes.size() - patch);
+    }
+};
+
+/**
+ * @brief Emits the native code of one region, tracking which guest registers it touches.
+ */
+class Translator {
+public:
+    Assembler body;
+    uint16_t reads = 0;  // Registers whose entry value the region uses
+    uint16_t writes = 0; // Registers the region changes
+    unsigned elapsed = 0; // M-cycles into the region of the instruction being emitted
+
+    /**
+     * @brief Emits one instruction.
+     * @return False, with nothing emitted, if it cannot be translated.
+     */
+    bool op(const DecodedOp& d) {
+        uint8_t op = uint8_t(d.op);
+        Reg dst = operands[(op >> 3) & 7];
+        Reg src = operands[op & 7];
+
+        if (d.op >= 0x100) {
+            return false;
+        }
+
+        if (op == 0x00) { // NOP
+            return true;
+        }
+
+        if (op >= 0x40 && op < 0x80) { // LD r, r' / LD r, (HL)
+            if (op == 0x76 || (op & 0x38) == 0x30) {
+                return false; // HALT, LD (HL), r
+            }
+
+            source(op & 7);
+            body.mov(dst, src);
+            def(dst);
+            return true;
+        }
+
+        if (op >= 0x80 && op < 0xC0) { // ALU A, r / ALU A, (HL)
+            source(op & 7);
+            body.mov(RCX, src);
+            alu((op >> 3) & 7);
+            return true;
+        }
+
+        switch (op) {
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // ALU A, d8
+            body.movImm(RCX, uint8_t(d.operand));
+            alu((op >> 3) & 7);
+            return true;
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r, d8
+            body.movImm(dst, uint8_t(d.operand));
+            def(dst);
+            return true;
+        case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // INC r
+            use(dst); use(F);
+            body.alu8(ADD, dst, 1);
+            body.alu32(AND, F, 0x10);
+            setZ(dst);
+            body.test8(dst, 0x0F);
+            flagFromCond(CC_Z, 5);
+            def(dst); def(F);
+            return true;
+        case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // DEC r
+            use(dst); use(F);
+            body.alu8(SUB, dst, 1);
+            body.alu32(AND, F, 0x10);
+            body.alu32(OR, F, 0x40);
+            setZ(dst);
+            body.mov(RAX, dst);
+            body.alu32(AND, RAX, 0x0F);
+            body.alu32(CMP, RAX, 0x0F);
+            flagFromCond(CC_Z, 5);
+            def(dst); def(F);
+            return true;
+        case 0x01: case 0x11: case 0x21: // LD rr, d16
+            body.movImm(pairHi(op), d.operand >> 8);
+            body.movImm(pairLo(op), d.operand & 0xFF);
+            def(pairHi(op)); def(pairLo(op));
+            return true;
+        case 0x31: // LD SP, d16
+            body.movImm(SP, d.operand);
+            def(SP);
+            return true;
+        case 0x03: case 0x13: case 0x23: case 0x0B: case 0x1B: case 0x2B: // INC rr, DEC rr
+            loadPair(RAX, pairHi(op), pairLo(op));
+            body.alu32(op & 0x08 ? SUB : ADD, RAX, 1);
+            storePair(RAX, pairHi(op), pairLo(op));
+            return true;
+        case 0x33: case 0x3B: // INC SP, DEC SP
+            use(SP);
+            body.alu32(op & 0x08 ? SUB : ADD, SP, 1);
+            body.alu32(AND, SP, 0xFFFF);
+            def(SP);
+            return true;
+        case 0x09: case 0x19: case 0x29: case 0x39: // ADD HL, rr
+            loadPair(RAX, H, L);
+
+            if (op == 0x39) {
+                use(SP);
+                body.mov(RCX, SP);
+            }
+            else {
+                loadPair(RCX, pairHi(op), pairLo(op));
+            }
+
+            body.lea(RDX, RAX, RCX);
+            body.mov(R15, RAX);
+            body.rr32(0x31, R15, RCX);
+            body.rr32(0x31, R15, RDX);
+            body.alu32(AND, R15, 0x1000);
+            body.shift32(SHR, R15, 7);           // H: carry out of bit 11
+            body.mov(RAX, RDX);
+            body.shift32(SHR, RAX, 12);
+            body.alu32(AND, RAX, 0x10);          // C: carry out of bit 15
+            use(F);
+            body.alu32(AND, F, 0x80);
+            body.rr32(0x09, F, R15);
+            body.rr32(0x09, F, RAX);
+            def(F);
+            storePair(RDX, H, L);
+            return true;
+        case 0xF9: // LD SP, HL
+            loadPair(RAX, H, L);
+            body.mov(SP, RAX);
+            def(SP);
+            return true;
+        case 0x0A: case 0x1A: // LD A, (BC) / LD A, (DE)
+            loadPair(RAX, pairHi(op), pairLo(op));
+            read();
+            body.mov(A, RAX);
+            def(A);
+            return true;
+        case 0x2A: case 0x3A: // LD A, (HL+) / LD A, (HL-)
+            loadPair(RAX, H, L);
+            read();
+            body.mov(A, RAX);
+            def(A);
+            loadPair(RAX, H, L);
+            body.alu32(op == 0x2A ? ADD : SUB, RAX, 1);
+            storePair(RAX, H, L);
+            return true;
+        case 0xF0: // LDH A, (a8)
+            body.movImm(RAX, 0xFF00 | uint8_t(d.operand));
+            read();
+            body.mov(A, RAX);
+            def(A);
+            return true;
+        case 0xF2: // LD A, (C)
+            use(C);
+            body.mov(RAX, C);
+            body.alu32(OR, RAX, 0xFF00);
+            read();
+            body.mov(A, RAX);
+            def(A);
+            return true;
+        case 0xFA: // LD A, (a16)
+            body.movImm(RAX, d.operand);
+            read();
+            body.mov(A, RAX);
+            def(A);
+            return true;
+        case 0x07: // RLCA
+            rotate(A, ROL, false, false);
+            return true;
+        case 0x0F: // RRCA
+            rotate(A, ROR, false, false);
+            return true;
+        case 0x17: // RLA
+            rotate(A, RCL, true, false);
+            return true;
+        case 0x1F: // RRA
+            rotate(A, RCR, true, false);
+            return true;
+        case 0x2F: // CPL
+            use(A); use(F);
+            body.alu32(XOR, A, 0xFF);
+            body.alu32(OR, F, 0x60);
+            def(A); def(F);
+            return true;
+        case 0x37: // SCF
+            use(F);
+            body.alu32(AND, F, 0x80);
+            body.alu32(OR, F, 0x10);
+            def(F);
+            return true;
+        case 0x3F: // CCF
+            use(F);
+            body.alu32(AND, F, 0x90);
+            body.alu32(XOR, F, 0x10);
+            def(F);
+            return true;
+        case 0xCB:
+            return prefixed(uint8_t(d.operand));
+        default:
+            return false;
+        }
+    }
+
+private:
+    void use(Reg r) {
+        // Only values read before the region writes them come from the CPUState
+        reads |= useOf(r) & ~writes;
+    }
+
+    void def(Reg r) {
+        writes |= useOf(r);
+    }
+
+    static Reg pairHi(uint8_t op) { return op < 0x10 ? B : op < 0x20 ? D : H; }
+    static Reg pairLo(uint8_t op) { return op < 0x10 ? C : op < 0x20 ? E : L; }
+
+    // dst = hi << 8 | lo
+    void loadPair(Reg dst, Reg hi, Reg lo) {
+        use(hi); use(lo);
+        body.mov(dst, hi);
+        body.shift32(SHL, dst, 8);
+        body.rr32(0x09, dst, lo);
+    }
+
+    // hi, lo = src & 0xFFFF (clobbers src)
+    void storePair(Reg src, Reg hi, Reg lo) {
+        body.mov(lo, src);
+        body.alu32(AND, lo, 0xFF);
+        body.shift32(SHR, src, 8);
+        body.alu32(AND, src, 0xFF);
+        body.mov(hi, src);
+        def(hi); def(lo);
+    }
+
+    // Makes register operand `r` available: (HL) is read into RAX
+    void source(unsigned r) {
+        if (r == 6) {
+            loadPair(RAX, H, L);
+            read();
+        }
+        else {
+            use(operands[r]);
+        }
+    }
+
+    // RAX = byte at guest address RAX, inlined through the page table when mapped
+    void read() {
+        body.mov(RCX, RAX);
+        body.shift32(SHR, RCX, 8);
+        body.loadQword(RDX, RSI, -1, 0, 0);
+        body.loadQword(RDX, RDX, RCX, 3, 0);
+        body.testQword(RDX, RDX);
+        size_t slow = body.jump(0x74);            // JZ slow
+        body.movzx8(RCX, RAX);
+        body.loadByte(RAX, RDX, RCX, 0);
+        size_t done = body.jump(0xEB);            // JMP done
+        body.bind(slow);
+
+        static constexpr Reg saved[] = { RDI, RSI, R8, R9, R10, R11 }; // Keeps RSP 16-byte aligned
+
+        for (Reg r : saved) {
+            body.push(r);
+        }
+
+        body.loadQword(RDI, RSI, -1, 0, 8);
+        body.mov(RSI, RAX);
+        body.movImm(RDX, elapsed);
+        body.movImm64(RAX, reinterpret_cast<uint64_t>(&readSlow));
+        body.callRax();
+
+        for (int i = 5; i >= 0; i--) {
+            body.pop(saved[i]);
+        }
+
+        body.movzx8(RAX, RAX);
+        body.bind(done);
+    }
+
+    // F |= (condition ? 1 : 0) << bit (clobbers RAX)
+    void flagFromCond(Cond cc, uint8_t bit) {
+        body.setcc(cc, RAX);
+        body.movzx8(RAX, RAX);
+        body.shift32(SHL, RAX, bit);
+        body.rr32(0x09, F, RAX);
+    }
+
+    // Z = (r == 0)
+    void setZ(Reg r) {
+        body.rr8(0x84, r, r);
+        flagFromCond(CC_Z, 7);
+    }
+
+    // A = A op RCX in the order of the opcode table: ADD ADC SUB SBC AND XOR OR CP
+    void alu(unsigned kind) {
+        use(A);
+
+        switch (kind) {
+        case 4: case 5: case 6:
+            body.alu8(kind == 4 ? AND : kind == 5 ? XOR : OR, A, RCX);
+            body.movImm(F, kind == 4 ? 0x20 : 0);
+            setZ(A);
+            def(A); def(F);
+            return;
+        }
+
+        static constexpr Alu ops[] = { ADD, ADC, SUB, SBB, SUB, SUB, SUB, SUB };
+        Reg res = kind == 7 ? R15 : A;
+
+        body.mov(RAX, A);
+
+        if (kind == 7) {
+            body.mov(R15, A);
+        }
+
+        if (kind == 1 || kind == 3) {
+            use(F);
+            body.bt(F, 4);
+        }
+
+        body.alu8(ops[kind], res, RCX);
+        body.setcc(CC_C, RDX);
+        body.movzx8(RDX, RDX);
+        body.shift32(SHL, RDX, 4);               // C
+        body.rr32(0x31, RAX, RCX);
+        body.rr32(0x31, RAX, res);
+        body.alu32(AND, RAX, 0x10);
+        body.shift32(SHL, RAX, 1);               // H: carry or borrow out of bit 3
+        body.rr32(0x09, RDX, RAX);
+
+        if (kind >= 2) {
+            body.alu32(OR, RDX, 0x40);           // N
+        }
+
+        body.mov(F, RDX);
+        setZ(res);
+
+        if (kind != 7) {
+            def(A);
+        }
+
+        def(F);
+    }
+
+    // Rotate or shift `r` by one, C from the bit shifted out, Z from the result unless `isA`
+    void rotate(Reg r, Shift op, bool throughCarry, bool setsZ) {
+        use(r);
+
+        if (throughCarry) {
+            use(F);
+            body.bt(F, 4);
+        }
+
+        body.shift8(op, r, 1);
+        body.setcc(CC_C, RAX);
+        body.movzx8(RAX, RAX);
+        body.shift32(SHL, RAX, 4);
+        body.mov(F, RAX);
+
+        if (setsZ) {
+            setZ(r);
+        }
+
+        def(r); def(F);
+    }
+
+    bool prefixed(uint8_t code) {
+        unsigned group = code >> 6, bit = (code >> 3) & 7, r = code & 7;
+        Reg reg = operands[r];
+
+        if (group == 1) { // BIT n, r / BIT n, (HL)
+            source(r);
+            use(F);
+            body.alu32(AND, F, 0x10);
+            body.alu32(OR, F, 0x20);
+            body.test8(reg, 1 << bit);
+            flagFromCond(CC_Z, 7);
+            def(F);
+            return true;
+        }
+
+        if (r == 6) {
+            return false; // Writes (HL)
+        }
+
+        use(reg);
+
+        if (group == 2) { // RES
+            body.alu32(AND, reg, ~(1 << bit) & 0xFF);
+            def(reg);
+            return true;
+        }
+
+        if (group == 3) { // SET
+            body.alu32(OR, reg, 1 << bit);
+            def(reg);
+            return true;
+        }
+
+        static constexpr Shift shifts[] = { ROL, ROR, RCL, RCR, SHL, SAR, ROL, SHR };
+
+        if (bit == 6) { // SWAP
+            body.shift8(ROL, reg, 4);
+            body.movImm(F, 0);
+            setZ(reg);
+            def(reg); def(F);
+            return true;
+        }
+
+        rotate(reg, shifts[bit], bit == 2 || bit == 3, true);
+        return true;
+    }
+};
+
+constexpr Reg saved[] = { RBX, RBP, R12, R13, R14, R15 };
+
+struct Slot {
+    Reg reg;
+    uint16_t use;
+    size_t offset;
+};
+
+const Slot slots[] = {
+    { A, UA, offsetof(CPUState, a) }, { B, UB, offsetof(CPUState, b) }, { C, UC, offsetof(CPUState, c) },
+    { D, UD, offsetof(CPUState, d) }, { E, UE, offsetof(CPUState, e) }, { H, UH, offsetof(CPUState, h) },
+    { L, UL, offsetof(CPUState, l) }
+};
+
+// Flag bools of CPUState and their bit in F
+const std::pair<size_t, uint8_t> flagSlots[] = {
+    { offsetof(CPUState, zf), 7 }, { offsetof(CPUState, nf), 6 }, { offsetof(CPUState, hf), 5 }, { offsetof(CPUState, cf), 4 }
+};
+
+}
+
+Jit::Jit(Mem* memory) : context{ memory->readPageTable(), memory } {
+    void* buffer = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    code = buffer == MAP_FAILED ? nullptr : static_cast<uint8_t*>(buffer);
+}
+
+Jit::~Jit() {
+    if (code) {
+        munmap(code, CODE_SIZE);
+    }
+}
+
+bool Jit::available() {
+    return true;
+}
+
+size_t Jit::compile(const DecodedOp* ops, size_t count) {
+    if (!code || used + MAX_REGION_CODE > CODE_SIZE || natives.size() >= UINT16_MAX) {
+        return 0;
+    }
+
+    Translator t;
+    size_t span = 0;
+    unsigned cycles = 0;
+
+    while (span < count && cycles + ops[span].cycles <= MAX_CYCLES) {
+        t.elapsed = cycles;
+
+        if (!t.op(ops[span])) {
+            break;
+        }
+
+        cycles += ops[span].cycles;
+        span++;
+    }
+
+    if (span < MIN_SPAN) {
+        return 0;
+    }
+
+    Assembler a;
+
+    for (Reg r : saved) {
+        a.push(r);
+    }
+
+    a.rsp(SUB, 8);
+
+    for (const Slot& s : slots) {
+        if (t.reads & s.use) {
+            a.loadByte(s.reg, RDI, -1, s.offset);
+        }
+    }
+
+    if (t.reads & USP) {
+        a.loadWord(SP, RDI, offsetof(CPUState, sp));
+    }
+
+    if (t.reads & UF) {
+        a.movImm(F, 0);
+
+        for (auto [offset, bit] : flagSlots) {
+            a.loadByte(RAX, RDI, -1, offset);
+            a.shift32(SHL, RAX, bit);
+            a.rr32(0x09, F, RAX);
+        }
+    }
+
+    a.bytes.insert(a.bytes.end(), t.body.bytes.begin(), t.body.bytes.end());
+
+    for (const Slot& s : slots) {
+        if (t.writes & s.use) {
+            a.storeByte(RDI, s.offset, s.reg);
+        }
+    }
+
+    if (t.writes & USP) {
+        a.storeWord(RDI, offsetof(CPUState, sp), SP);
+    }
+
+    if (t.writes & UF) {
+        for (auto [offset, bit] : flagSlots) {
+            a.mov(RAX, F);
+            a.shift32(SHR, RAX, bit);
+            a.alu32(AND, RAX, 1);
+            a.storeByte(RDI, offset, RAX);
+        }
+    }
+
+    a.rsp(ADD, 8);
+
+    for (int i = 5; i >= 0; i--) {
+        a.pop(saved[i]);
+    }
+
+    a.ret();
+
+    if (a.bytes.size() > MAX_REGION_CODE) {
+        return 0;
+    }
+
+    mprotect(code, CODE_SIZE, PROT_READ | PROT_WRITE);
+    std::memcpy(code + used, a.bytes.data(), a.bytes.size());
+    mprotect(code, CODE_SIZE, PROT_READ | PROT_EXEC);
+
+    natives.push_back(reinterpret_cast<Native>(code + used));
+    used += (a.bytes.size() + 15) & ~size_t(15);
+    return span;
+}
+
+void Jit::translate(Block& block) {
+    std::vector<DecodedOp> ops;
+    size_t count = block.ops.size() - 1;
+
+    for (size_t i = 0; i < count; ) {
+        size_t span = compile(&block.ops[i], count - i);
+
+        if (span) {
+            uint8_t cycles = 0;
+
+            for (size_t j = i; j < i + span; j++) {
+                cycles += block.ops[j].cycles;
+            }
+
+            ops.push_back({ Block::JIT_REGION, uint16_t(natives.size() - 1), block.ops[i].pc, cycles, uint8_t(span) });
+        }
+
+        size_t end = i + std::max<size_t>(span, 1);
+        ops.insert(ops.end(), block.ops.begin() + i, block.ops.begin() + end);
+        i = end;
+    }
+
+    ops.push_back(block.ops.back());
+    block.ops = std::move(ops);
+}
+#else
+Jit::Jit(Mem* memory) : context{ memory->readPageTable(), memory } {}
+
+Jit::~Jit() = default;
+
+bool Jit::available() {
+    return false;
+}
+
+size_t Jit::compile(const DecodedOp*, size_t) {
+    return 0;
+}
+
+void Jit::translate(Block&) {}
+#endif
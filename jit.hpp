@@ -0,0 +1,119 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "blockcache.hpp"
+
+class Mem;
+struct CPUState;
+
+// Native code generation needs an x86-64 host with the System V calling convention
+#if defined(GB_JIT) && defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32)
+#define GB_JIT_X86_64
+#endif
+
+/**
+ * @brief Translates runs of simple instructions in hot ROM blocks to x86-64 code.
+ *
+ * A region is a run of instructions that only touch registers, flags and
+ * memory reads: register loads, 8-bit ALU, INC/DEC, 16-bit increments and
+ * ADD HL, rotates and the CB register operations, and loads into A or any
+ * register from (HL). Jumps, calls, writes, stack operations, EI/DI and HALT
+ * end a region. Inside one, A, F, BC, DE, HL and SP live in host registers and
+ * reads of mapped pages are inlined from the memory controller's page table;
+ * other pages call out to `Mem::get`.
+ *
+ * Writes are what could make the PPU, timer or interrupts need attention, so
+ * a region can only be interrupted by an event already scheduled. The
+ * dispatch runs it natively when the whole region ends before the next event
+ * (`Machine::runCached`), adding the same M-cycles the interpreter would, and
+ * interprets its instructions one by one otherwise. Blocks in RAM are never
+ * translated, so self-modifying code always runs in the interpreter.
+ *
+ * Without GB_JIT or on other hosts `available` is false and nothing is translated.
+ */
+class Jit {
+public:
+    /**
+     * @brief Native code of one region: updates `cpu` as its instructions would.
+     */
+    using Native = void (*)(CPUState* cpu, const void* context);
+
+    /**
+     * @brief Lookups of a block before it is translated.
+     */
+    static constexpr uint32_t HOT_RUNS = 8;
+
+    /**
+     * @brief Shortest run of instructions worth a region.
+     */
+    static constexpr size_t MIN_SPAN = 2;
+
+    /**
+     * @brief Longest region, in M-cycles. Short regions fit between events far
+     * more often; a long run becomes several regions.
+     */
+    static constexpr unsigned MAX_CYCLES = 8;
+
+    /**
+     * @param memory The memory controller whose page table native reads use.
+     */
+    explicit Jit(Mem* memory);
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    /**
+     * @brief Checks whether native code can be generated in this build and on this host.
+     */
+    static bool available();
+
+    /**
+     * @brief Puts a `JIT_REGION` op in front of every run of translatable instructions in `block`.
+     * Stops translating once the code buffer is full.
+     */
+    void translate(Block& block);
+
+    /**
+     * @brief Compiles the longest translatable run at the start of `ops` into a new
+     * region, numbered `regions() - 1`.
+     * @param ops The instructions.
+     * @param count Number of instructions available.
+     * @return Number of instructions in the region, or 0 if none was made (run
+     * shorter than `MIN_SPAN`, or the code buffer is full).
+     */
+    size_t compile(const DecodedOp* ops, size_t count);
+
+    /**
+     * @brief Returns the number of regions compiled so far.
+     */
+    size_t regions() const {
+        return natives.size();
+    }
+
+    /**
+     * @brief Runs the native code of region `index` on `cpu`.
+     */
+    void run(uint16_t index, CPUState& cpu) const {
+        natives[index](&cpu, &context);
+    }
+
+private:
+    /**
+     * @brief What native code reads besides the registers.
+     */
+    struct Context {
+        const uint8_t* const* readPages; // Host page per guest page, or null for the slow path
+        Mem* memory;                     // Slow path for reads
+    } context;
+
+    uint8_t* code = nullptr; // Executable buffer
+    size_t used = 0;
+    std::vector<Native> natives;
+};
+
+#endif
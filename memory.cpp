@@ -1,45 +1,33 @@
 #include "memory.hpp"
 #include "iostream"
 #include "gba.hpp"
-#include <SDL.h>
-#include <bitset>
+#include <iterator>
 
 /**
  * @brief Gets the current joypad input state based on the value written to the JOYP register.
  *
- * This function reads the keyboard state using SDL and maps the appropriate keys
+ * This function reads the buttons latched in the machine's `joypad` and maps them
  * to the Game Boy joypad buttons (A, B, Select, Start, Right, Left, Up, Down).
  * The specific buttons read depend on bits 4 and 5 of the input value `val`.
  *
+ * @param m The machine whose input source is read.
  * @param val The value written to the JOYP register (0xFF00).
  * @return The updated value for the JOYP register, reflecting the current input state.
  */
-uint8_t getInput(uint8_t val) {
-    const uint8_t* keys = SDL_GetKeyboardState(NULL);
+uint8_t getInput(Machine* m, uint8_t val) {
+    uint8_t buttons = m ? m->joypad.buttons : 0;
     uint8_t joypad = 0x0F; // Initialize with all buttons unpressed (1 = unpressed in GB hardware)
     
     // Action buttons (bit 5 low selects these buttons)
     if (!(val & 0x20)) {
-        // Clear the bits that will be set based on button state
-        joypad &= 0xF0;
-        
-        // Set bits based on button state (0 = pressed, 1 = unpressed)
-        if (!keys[SDL_SCANCODE_A]) joypad |= 0x01; // A button
-        if (!keys[SDL_SCANCODE_S]) joypad |= 0x02; // B button
-        if (!keys[SDL_SCANCODE_X]) joypad |= 0x04; // Select button
-        if (!keys[SDL_SCANCODE_Z]) joypad |= 0x08; // Start button
+        // Clear the bits that are pressed (0 = pressed, 1 = unpressed)
+        joypad &= ~(buttons & 0x0F);
     }
     
     // Direction buttons (bit 4 low selects these buttons)
     if (!(val & 0x10)) {
-        // Clear the bits that will be set based on button state
-        joypad &= 0xF0;
-        
-        // Set bits based on button state (0 = pressed, 1 = unpressed)
-        if (!keys[SDL_SCANCODE_RIGHT]) joypad |= 0x01; // Right
-        if (!keys[SDL_SCANCODE_LEFT])  joypad |= 0x02; // Left
-        if (!keys[SDL_SCANCODE_UP])    joypad |= 0x04; // Up
-        if (!keys[SDL_SCANCODE_DOWN])  joypad |= 0x08; // Down
+        // Clear the bits that are pressed (0 = pressed, 1 = unpressed)
+        joypad &= ~(buttons >> 4);
     }
     
     // Combine the input value (preserving bits 4-7) with the joypad state (bits 0-3)
@@ -49,11 +37,12 @@ uint8_t getInput(uint8_t val) {
 /**
  * @brief Handles writes to I/O registers.
  *
- * This function is called when a value is written to an I/O register.
+ * This function is called when a value is written to an I/O register or IE.
  * It updates the corresponding I/O register in the `io` vector and performs
- * specific actions based on the address being written to.
+ * specific actions based on the address being written to. Writes the timer,
+ * PPU or interrupt logic depend on are passed on to them.
  *
- * @param addr The offset of the I/O register from 0xFF00.
+ * @param addr The offset of the I/O register from 0xFF00 (0xFF for IE).
  * @param val The value being written to the register.
  * @param m A pointer to the memory controller, used for certain I/O operations (e.g., serial transfer, DMA).
  * @param io A reference to the vector storing the state of I/O registers.
@@ -64,7 +53,7 @@ void handleIO(uint8_t addr, uint8_t val, Mem* m, std::vector<uint8_t> &io) {
 
 	switch (addr) {
 	case 0x00:
-		io[addr] = getInput(val);
+		io[addr] = getInput(m->machine, val);
 		break;
 	case 0x02:
 		if (val == 0x81) {
@@ -74,10 +63,33 @@ void handleIO(uint8_t addr, uint8_t val, Mem* m, std::vector<uint8_t> &io) {
 		break;
 	case 0x04:
 		io[addr] = 0;
-		timer->resetdiv();
+		m->machine->timer->resetdiv();
+		break;
+	case 0x05:
+		m->machine->timer->setCounter(val);
 		break;
 	case 0x07:
 		io[addr] = (prev & ~7) | (val & 7);
+		m->machine->timer->setControl(io[addr]);
+		break;
+	case 0x0F:
+		m->machine->pending_interrupts = io[0x0F] & io[0xFF];
+
+		// A request masked by IE (or cleared) leaves nothing for the check to do
+		if (m->machine->pending_interrupts) {
+			m->machine->pollInterrupts();
+		}
+		break;
+	case 0x41:
+		// The mode and LY=LYC bits are read-only
+		io[addr] = (val & 0x78) | (prev & 0x87);
+		m->machine->ppu->updateStat();
+		break;
+	case 0x44:
+		io[addr] = prev;
+		break;
+	case 0x45:
+		m->machine->ppu->updateStat();
 		break;
 	case 0x46:
 		{
@@ -90,19 +102,104 @@ void handleIO(uint8_t addr, uint8_t val, Mem* m, std::vector<uint8_t> &io) {
 	case 0x50:
 		m->disableBR();
 		break;
+	case 0xFF:
+		m->machine->pending_interrupts = io[0x0F] & io[0xFF];
+
+		if (m->machine->pending_interrupts) {
+			m->machine->pollInterrupts();
+		}
+		break;
+	}
+}
+
+/**
+ * @brief Handles reads of I/O registers and IE that miss the mappers' fast path.
+ *
+ * Registers read back what was last stored in `io`, except DIV and TIMA, which
+ * the timer computes from the master clock.
+ *
+ * @param addr The offset of the I/O register from 0xFF00.
+ * @param m A pointer to the memory controller, for the machine the registers belong to.
+ * @param io The stored I/O registers.
+ * @return The register's value.
+ */
+uint8_t readIO(uint8_t addr, Mem* m, const std::vector<uint8_t> &io) {
+	switch (addr) {
+	case 0x04:
+		return m->machine->timer->div();
+	case 0x05:
+		return m->machine->timer->counter();
+	default:
+		return io[addr];
+	}
+}
+
+void Mem::watchCode(uint16_t addr) {
+	const uint8_t* page = hostPage(addr >> 8);
+
+	if (std::find(watchedPages.begin(), watchedPages.end(), page) == watchedPages.end()) {
+		watchedPages.push_back(page);
+		protectCode();
+	}
+}
+
+void Mem::unwatchCode(const uint8_t* page) {
+	watchedPages.erase(std::remove(watchedPages.begin(), watchedPages.end(), page), watchedPages.end());
+
+	// RAM pages are mapped alike for reads and writes, except tile data and page 0xFF
+	// whose writes all go through `set`
+	for (unsigned i = 0x80; i < 0x100; i++) {
+		if (codePages[i] && hostPage(i) == page) {
+			codePages[i] = false;
+			writePages[i] = i < 0x98 || i == 0xFF ? nullptr : readPages[i];
+		}
+	}
+}
+
+void Mem::tileWritten(uint16_t addr) {
+	if (machine && machine->ppu) {
+		machine->ppu->tileWritten((addr - 0x8000) >> 4);
+	}
+}
+
+void Mem::codeWritten(uint16_t addr) {
+	if (machine) {
+		machine->codeWritten(hostPage(addr >> 8), addr & 0xFF);
+	}
+}
+
+void Mem::protectCode() {
+	if (watchedPages.empty()) {
+		return;
+	}
+
+	for (unsigned i = 0x80; i < 0x100; i++) {
+		codePages[i] = hostPage(i) && std::find(watchedPages.begin(), watchedPages.end(), hostPage(i)) != watchedPages.end();
+
+		if (codePages[i]) {
+			writePages[i] = nullptr;
+		}
+	}
+}
+
+void Mem::pagesChanged() {
+	protectCode();
+
+	if (machine) {
+		machine->codeMoved();
 	}
 }
 
 /**
- * @brief Loads ROM data from an input file stream into a vector.
+ * @brief Loads ROM data from an input stream into a vector.
  *
- * This function reads all bytes from the given input file stream `f`
+ * This function reads all bytes from the given input stream `f`
  * and inserts them at the beginning of the `rom` vector.
  *
- * @param f An input file stream opened to the ROM file.
+ * @param f A binary input stream over the ROM image (e.g. an opened ROM file).
  * @param rom A reference to the vector where the ROM data will be stored.
  */
-void loadR(std::ifstream& f, std::vector<uint8_t>& rom) {
+void loadR(std::istream& f, std::vector<uint8_t>& rom) {
 	f.seekg(0, std::ios::beg);
 	rom.assign(std::istream_iterator<uint8_t>(f), std::istream_iterator<uint8_t>());
 }
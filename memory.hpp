@@ -1,12 +1,16 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <array>
 #include <vector>
+#include <algorithm>
 #include <cmath>
 #include <string>
 #include <fstream>
 #include <iostream>
 
+class Machine;
+
 /**
  * @brief Abstract base class for memory controllers.
  * Defines the interface for memory operations like reading, writing,
@@ -19,21 +23,249 @@ public:
 	virtual inline uint8_t get(uint16_t addr) = 0;
 	virtual inline void set(uint16_t addr, uint8_t val) = 0;
 
-	virtual void loadROM(std::ifstream &rom) = 0;
+	virtual void loadROM(std::istream &rom) = 0;
 	virtual void loadBootROM(std::string file) = 0;
 	virtual inline bool isBRActive() = 0;
 	virtual void disableBR() = 0;
+
+	/**
+	 * @brief The machine this memory belongs to, used by I/O side effects (timer, joypad).
+	 */
+	Machine* machine = nullptr;
+
+	/**
+	 * @brief Returns the host address of the byte at `addr` if its page is mapped for reads.
+	 * @return The host address, or nullptr for pages only the slow path can read.
+	 */
+	const uint8_t* hostAddress(uint16_t addr) const {
+		const uint8_t* page = readPages[addr >> 8];
+		return page ? page + (addr & 0xFF) : nullptr;
+	}
+
+	/**
+	 * @brief Returns the host address of the byte at `addr` for running code from it:
+	 * that of `hostAddress`, or `io` for page 0xFF (HRAM), whose reads go through
+	 * `get` only for the sake of the I/O registers. It tells apart the banks that can
+	 * be mapped at the same address, which makes it, with the address, the key of the
+	 * machine's pre-decoded code.
+	 * @return The host address, or nullptr for pages code cannot run from directly.
+	 */
+	const uint8_t* codeAddress(uint16_t addr) const {
+		const uint8_t* page = hostPage(addr >> 8);
+		return page ? page + (addr & 0xFF) : nullptr;
+	}
+
+	/**
+	 * @brief Returns the host address of the byte at `addr` if its page is mapped for writes,
+	 * i.e. if storing to it directly is all a write does.
+	 * @return The host address, or nullptr for pages only the slow path can write.
+	 */
+	uint8_t* hostWriteAddress(uint16_t addr) const {
+		uint8_t* page = writePages[addr >> 8];
+		return page ? page + (addr & 0xFF) : nullptr;
+	}
+
+	/**
+	 * @brief Returns the I/O registers, HRAM and IE (0xFF00-0xFFFF), for devices that
+	 * update their own registers without going through the side effects of `set`.
+	 */
+	uint8_t* ioRegisters() const {
+		return ioPage;
+	}
+
+	/**
+	 * @brief Returns whether `addr` is VRAM tile data outside watched code, whose
+	 * writes miss `writePages` only so that the PPU hears of them (see `writeVRAM`).
+	 */
+	bool isTileData(uint16_t addr) const {
+		return addr >= 0x8000 && addr < 0x9800 && !codePages[addr >> 8];
+	}
+
+	/**
+	 * @brief Returns the read page table (see `readPages`), for native code that inlines its own reads.
+	 */
+	const uint8_t* const* readPageTable() const {
+		return readPages.data();
+	}
+
+	/**
+	 * @brief Returns the cartridge ROM image as loaded by `loadROM` (empty before).
+	 */
+	const std::vector<uint8_t>& romImage() const {
+		static const std::vector<uint8_t> none;
+		return cartridgeROM ? *cartridgeROM : none;
+	}
+
+	/**
+	 * @brief Returns the offset in the cartridge ROM of the byte at `addr`, which
+	 * names the same code whatever bank it is mapped through.
+	 * @return The offset, or -1 if `addr` is not mapped to the cartridge ROM.
+	 */
+	int64_t romOffset(uint16_t addr) const {
+		const uint8_t* host = hostAddress(addr);
+
+		if (!host || !cartridgeROM || host < cartridgeROM->data() || host >= cartridgeROM->data() + cartridgeROM->size()) {
+			return -1;
+		}
+
+		return host - cartridgeROM->data();
+	}
+
+	/**
+	 * @brief Sends writes to the RAM page backing `addr` (wherever it is mapped) through
+	 * the slow path, which reports them to the machine (`Machine::codeWritten`).
+	 * Used once code in that page has been pre-decoded.
+	 */
+	void watchCode(uint16_t addr);
+
+	/**
+	 * @brief Stops watching the RAM page at host address `page` (see `watchCode`).
+	 */
+	void unwatchCode(const uint8_t* page);
+
+protected:
+	/**
+	 * @brief The mapper's ROM, set by `loadROM`.
+	 */
+	const std::vector<uint8_t>* cartridgeROM = nullptr;
+
+	/**
+	 * @brief Pages currently mapped to a watched host page (see `watchCode`).
+	 * Their write pages are unmapped, and HRAM skips the fast path of `set` when page 0xFF is set.
+	 */
+	std::array<bool, 256> codePages{};
+
+	/**
+	 * @brief Host pages holding pre-decoded code, in RAM.
+	 */
+	std::vector<const uint8_t*> watchedPages;
+
+	/**
+	 * @brief Reports a write to a watched page to the machine. Called by `setSlow` before storing.
+	 */
+	void checkCode(uint16_t addr) {
+		if (codePages[addr >> 8]) {
+			codeWritten(addr);
+		}
+	}
+
+	void codeWritten(uint16_t addr);
+
+	/**
+	 * @brief Unmaps the write pages of every page mapped to a watched host page.
+	 */
+	void protectCode();
+
+	/**
+	 * @brief Finishes `remap`: re-applies the watches (see `watchCode`) to the new
+	 * page tables and lets the machine know the code at some addresses may have changed.
+	 */
+	void pagesChanged();
+
+	/**
+	 * @brief Host pointers to every 256-byte page of the address space, indexed by `addr >> 8`.
+	 * A null entry sends the access to the mapper's slow path: I/O and HRAM, OAM,
+	 * MBC registers, writes to VRAM tile data and disabled or out-of-range cartridge RAM. Mappers rebuild
+	 * the tables (`remap`) whenever a bank register or the boot ROM state changes.
+	 */
+	std::array<uint8_t*, 256> readPages{};
+	std::array<uint8_t*, 256> writePages{};
+
+	/**
+	 * @brief Host address of page 0xFF (`io`), which is not in `readPages`.
+	 */
+	uint8_t* ioPage = nullptr;
+
+	/**
+	 * @brief Returns the host page behind page `page` as far as code is concerned (see `codeAddress`).
+	 */
+	const uint8_t* hostPage(unsigned page) const {
+		return page == 0xFF ? ioPage : readPages[page];
+	}
+
+	/**
+	 * @brief Points `count` pages starting at page `first` at consecutive 256-byte blocks
+	 * of `data`, beginning at byte `offset`. Pages that would run past the end of `data`
+	 * are left to the slow path.
+	 */
+	static void mapPages(std::array<uint8_t*, 256>& pages, unsigned first, unsigned count, std::vector<uint8_t>& data, size_t offset) {
+		for (unsigned i = 0; i < count; i++, offset += 0x100) {
+			pages[first + i] = offset + 0x100 <= data.size() ? data.data() + offset : nullptr;
+		}
+	}
+
+	/**
+	 * @brief Reads a byte of banked ROM or cartridge RAM. Offsets past the end of the
+	 * cartridge (a bank number the cartridge does not have) read as 0xFF.
+	 */
+	static uint8_t readBanked(const std::vector<uint8_t>& data, size_t offset) {
+		return offset < data.size() ? data[offset] : 0xFF;
+	}
+
+	/**
+	 * @brief Writes a byte of cartridge RAM, ignoring offsets past the end of the cartridge.
+	 */
+	static void writeBanked(std::vector<uint8_t>& data, size_t offset, uint8_t val) {
+		if (offset < data.size()) {
+			data[offset] = val;
+		}
+	}
+
+	/**
+	 * @brief Writes a byte of VRAM from the slow path, telling the PPU when a byte of
+	 * tile data changes so it decodes that tile again (`tileWritten`).
+	 */
+	void writeVRAM(std::vector<uint8_t>& vRAM, uint16_t addr, uint8_t val) {
+		uint8_t& byte = vRAM[addr - 0x8000];
+
+		if (addr < 0x9800 && byte != val) {
+			tileWritten(addr);
+		}
+
+		byte = val;
+	}
+
+	void tileWritten(uint16_t addr);
+
+	/**
+	 * @brief Sends `count` pages starting at page `first` to the slow path.
+	 */
+	static void unmapPages(std::array<uint8_t*, 256>& pages, unsigned first, unsigned count) {
+		std::fill_n(pages.begin() + first, count, nullptr);
+	}
+
+	/**
+	 * @brief Maps VRAM, work RAM and its echo for reads and writes. The layout is the
+	 * same for every mapper. `io` holds all of 0xFF00-0xFFFF (I/O registers, HRAM and
+	 * IE); it stays unmapped, as some registers are computed when read (`readIO`) and
+	 * writes have side effects, and the mappers' `get` and `set` handle HRAM themselves.
+	 * Tile data (0x8000-0x97FF) is only mapped for reads, so that writes to it go
+	 * through `writeVRAM`.
+	 */
+	void mapInternalRAM(std::vector<uint8_t>& vRAM, std::vector<uint8_t>& wRAM, std::vector<uint8_t>& io) {
+		for (auto* pages : { &readPages, &writePages }) {
+			mapPages(*pages, 0x80, 0x20, vRAM, 0);
+			mapPages(*pages, 0xC0, 0x20, wRAM, 0);
+			mapPages(*pages, 0xE0, 0x1E, wRAM, 0);
+		}
+
+		unmapPages(writePages, 0x80, 0x18);
+
+		ioPage = io.data();
+	}
 };
 
 void handleIO(uint8_t addr, uint8_t val, Mem* m, std::vector<uint8_t> &io);
-void loadR(std::ifstream& f, std::vector<uint8_t>& rom);
+uint8_t readIO(uint8_t addr, Mem* m, const std::vector<uint8_t> &io);
+
+void loadR(std::istream& f, std::vector<uint8_t>& rom);
 bool loadBR(std::string& file, std::vector<uint8_t>& rom);
 
 /**
  * @brief Memory controller for cartridges with no Memory Bank Controller (MBC).
  * Handles direct memory mapping for ROM, VRAM, CRAM (cartridge RAM), WRAM (work RAM), OAM, and I/O registers.
  */
-class NoMBC : public Mem {
+class NoMBC final : public Mem {
 public:
 	/**
 	 * @brief Constructs a NoMBC memory controller.
@@ -45,11 +277,11 @@ public:
 		rom = std::vector<uint8_t>(0x8000);
 		vRAM = std::vector<uint8_t>(0x2000);
 		cRAM = std::vector<uint8_t>(0x2000 * ram);
-		wRAM = std::vector<uint8_t>(0x207F);
+		wRAM = std::vector<uint8_t>(0x2000);
 		oam = std::vector<uint8_t>(0xA0);
-		io = std::vector<uint8_t>(0x80);
-		ie = 0;
+		io = std::vector<uint8_t>(0x100);
 		cRAM_enabled = ram;
+		remap();
 	};
 
 	NoMBC() : NoMBC(0) {};
@@ -58,16 +290,90 @@ public:
 
 	/**
 	 * @brief Reads a byte from the memory map.
-	 * Handles reads from boot ROM (if active), ROM, VRAM, CRAM, WRAM, OAM, I/O, and HRAM.
+	 * Mapped pages are a single indexed load, as are HRAM and IE, which share page 0xFF
+	 * with the I/O registers; everything else goes through `getSlow`.
 	 * @param addr The 16-bit memory address to read from.
 	 * @return The byte value at the given address.
 	 */
 	inline uint8_t get(uint16_t addr) {
+		if (const uint8_t* page = readPages[addr >> 8]) {
+			return page[addr & 0xFF];
+		}
+		else if (addr >= 0xFF80) {
+			return io[addr - 0xFF00];
+		}
+
+		return getSlow(addr);
+	}
+
+	/**
+	 * @brief Writes a byte to the memory map.
+	 * Mapped pages are a single indexed store. HRAM has no side effects, so it is
+	 * stored directly even though it shares page 0xFF with the I/O registers and IE;
+	 * everything else goes through `setSlow`.
+	 * @param addr The 16-bit memory address to write to.
+	 * @param val The byte value to write.
+	 */
+	inline void set(uint16_t addr, uint8_t val) {
+		if (uint8_t* page = writePages[addr >> 8]) {
+			page[addr & 0xFF] = val;
+		}
+		else if (addr >= 0xFF80 && addr != 0xFFFF && !codePages[0xFF]) {
+			io[addr - 0xFF00] = val;
+		}
+		else {
+			setSlow(addr, val);
+		}
+	}
+
+	/**
+	 * @brief Loads the game ROM into the ROM region.
+	 * @param f An input file stream for the ROM file.
+	 */
+	void loadROM(std::istream& f) {
+		loadR(f, rom);
+		cartridgeROM = &rom;
+		remap();
+	}
+
+	/**
+	 * @brief Loads the boot ROM into its dedicated memory region.
+	 * @param f A string path to the boot ROM file.
+	 */
+	void loadBootROM(std::string f) {
+		boot_rom_active = loadBR(f, bROM);
+		remap();
+	}
+
+	/**
+	 * @brief Checks if the boot ROM is currently active.
+	 * @return True if boot ROM is active, false otherwise.
+	 */
+	inline bool isBRActive() {
+		return boot_rom_active;
+	}
+
+	/**
+	 * @brief Disables the boot ROM.
+	 */
+	void disableBR() {
+		boot_rom_active = false;
+		remap();
+	}
+
+private:
+	/**
+	 * @brief Slow path of `get` for pages without a host pointer.
+	 * Handles reads from boot ROM (if active), ROM, VRAM, CRAM, WRAM, OAM and I/O (`readIO`).
+	 * @param addr The 16-bit memory address to read from.
+	 * @return The byte value at the given address.
+	 */
+	uint8_t getSlow(uint16_t addr) {
 		if (boot_rom_active && addr < 0x100) {
 			return bROM[addr];
 		}
 		else if (addr < 0x8000) {
-			return rom[addr];
+			return readBanked(rom, addr);
 		}
 		else if (addr < 0xA000) {
 			return vRAM[addr - 0x8000];
@@ -87,33 +393,27 @@ public:
 		else if (addr < 0xFF00) {
 			return 0;
 		}
-		else if (addr < 0xFF80) {
-			return io[addr - 0xFF00];
-		}
 		else {
-			if (addr == 0xFFFF) {
-				return ie;
-			}
-			else {
-				return wRAM[0x2000 + (addr - 0xFF80)];
-			}
+			return readIO(addr - 0xFF00, this, io);
 		}
 	}
 
 	/**
-	 * @brief Writes a byte to the memory map.
-	 * Handles writes to VRAM, CRAM (if enabled), WRAM, OAM, I/O, and HRAM.
+	 * @brief Slow path of `set` for pages without a host pointer.
+	 * Handles writes to VRAM, CRAM (if enabled), WRAM, OAM, I/O registers and IE.
 	 * Writes to ROM are ignored.
 	 * @param addr The 16-bit memory address to write to.
 	 * @param val The byte value to write.
 	 */
-	inline void set(uint16_t addr, uint8_t val) {
+	void setSlow(uint16_t addr, uint8_t val) {
+		checkCode(addr);
+
 		if (addr >= 0x8000 && addr < 0xA000) {
-			vRAM[addr - 0x8000] = val;
+			writeVRAM(vRAM, addr, val);
 		}
 		else if (addr < 0xC000) {
 			if (cRAM_enabled) {
-				cRAM[addr - 0xA000] = val;
+				writeBanked(cRAM, addr - 0xA000, val);
 			}
 		}
 		else if (addr < 0xE000) {
@@ -125,54 +425,38 @@ public:
 		else if (addr < 0xFEA0) {
 			oam[addr - 0xFE00] = val;
 		}
-		else if (addr >= 0xFF00 && addr < 0xFF80) {	
-			handleIO(addr - 0xFF00, val, this, this->io);
-		}
+		else if (addr < 0xFF00) {}
 		else {
-			if (addr == 0xFFFF) {
-				ie = val;
-			}
-			else {
-				wRAM[0x2000 + (addr - 0xFF80)] = val;
-			}
+			handleIO(addr - 0xFF00, val, this, this->io);
 		}
 	}
 
 	/**
-	 * @brief Loads the game ROM into the ROM region.
-	 * @param f An input file stream for the ROM file.
+	 * @brief Rebuilds the page tables from the boot ROM state.
 	 */
-	void loadROM(std::ifstream& f) {
-		loadR(f, rom);
-	}
+	void remap() {
+		mapPages(readPages, 0x00, 0x80, rom, 0);
+		unmapPages(writePages, 0x00, 0x80);
 
-	/**
-	 * @brief Loads the boot ROM into its dedicated memory region.
-	 * @param f A string path to the boot ROM file.
-	 */
-	void loadBootROM(std::string f) {
-		boot_rom_active = loadBR(f, bROM);
-	}
+		if (boot_rom_active) {
+			mapPages(readPages, 0x00, 1, bROM, 0);
+		}
 
-	/**
-	 * @brief Checks if the boot ROM is currently active.
-	 * @return True if boot ROM is active, false otherwise.
-	 */
-	inline bool isBRActive() {
-		return boot_rom_active;
-	}
+		if (cRAM_enabled) {
+			mapPages(readPages, 0xA0, 0x20, cRAM, 0);
+			mapPages(writePages, 0xA0, 0x20, cRAM, 0);
+		}
+		else {
+			unmapPages(readPages, 0xA0, 0x20);
+			unmapPages(writePages, 0xA0, 0x20);
+		}
 
-	/**
-	 * @brief Disables the boot ROM.
-	 */
-	void disableBR() {
-		boot_rom_active = false;
+		mapInternalRAM(vRAM, wRAM, io);
+		pagesChanged();
 	}
 
-private:
 	bool cRAM_enabled;
 	std::vector<uint8_t> bROM, rom, vRAM, cRAM, wRAM, oam, io;
-	uint8_t ie;
 	bool boot_rom_active = false;
 };
 
@@ -180,7 +464,7 @@ private:
  * @brief Memory Bank Controller 1 (MBC1).
  * Handles ROM and RAM banking for cartridges using the MBC1 chip.
  */
-class MBC1 : public Mem {
+class MBC1 final : public Mem {
 public:
 	/**
 	 * @brief Constructs an MBC1 memory controller.
@@ -200,22 +484,81 @@ public:
 		case 3:
 			cRAM = std::vector<uint8_t>(0x8000); break;
 		}
-		wRAM = std::vector<uint8_t>(0x207F);
+		wRAM = std::vector<uint8_t>(0x2000);
 		oam = std::vector<uint8_t>(0xA0);
-		io = std::vector<uint8_t>(0x80);
-		ie = 0;
+		io = std::vector<uint8_t>(0x100);
 		rom_banks = nROM;
 		cRAM_enabled = ram_banks = nRAM;
+		remap();
 	}
 
 	~MBC1() = default;
 
 	/**
-	 * @brief Reads a byte from the memory map, considering MBC1 banking.
+	 * @brief Reads a byte from the memory map.
+	 * Mapped pages are a single indexed load, as are HRAM and IE, which share page 0xFF
+	 * with the I/O registers; everything else goes through `getSlow`.
 	 * @param addr The 16-bit memory address to read from.
 	 * @return The byte value at the given address.
 	 */
 	inline uint8_t get(uint16_t addr) {
+		if (const uint8_t* page = readPages[addr >> 8]) {
+			return page[addr & 0xFF];
+		}
+		else if (addr >= 0xFF80) {
+			return io[addr - 0xFF00];
+		}
+
+		return getSlow(addr);
+	}
+
+	/**
+	 * @brief Writes a byte to the memory map.
+	 * Mapped pages are a single indexed store. HRAM has no side effects, so it is
+	 * stored directly even though it shares page 0xFF with the I/O registers and IE;
+	 * everything else goes through `setSlow`.
+	 * @param addr The 16-bit memory address to write to.
+	 * @param val The byte value to write.
+	 */
+	inline void set(uint16_t addr, uint8_t val) {
+		if (uint8_t* page = writePages[addr >> 8]) {
+			page[addr & 0xFF] = val;
+		}
+		else if (addr >= 0xFF80 && addr != 0xFFFF && !codePages[0xFF]) {
+			io[addr - 0xFF00] = val;
+		}
+		else {
+			setSlow(addr, val);
+		}
+	}
+
+	void loadROM(std::istream& f) {
+		loadR(f, rom);
+		cartridgeROM = &rom;
+		remap();
+	}
+
+	void loadBootROM(std::string f) {
+		boot_rom_active = loadBR(f, bROM);
+		remap();
+	}
+
+	inline bool isBRActive() {
+		return boot_rom_active;
+	}
+
+	void disableBR() {
+		boot_rom_active = false;
+		remap();
+	}
+
+private:
+	/**
+	 * @brief Slow path of `get` for pages without a host pointer, considering MBC1 banking.
+	 * @param addr The 16-bit memory address to read from.
+	 * @return The byte value at the given address.
+	 */
+	uint8_t getSlow(uint16_t addr) {
 		if (boot_rom_active && addr < 0x100) {
 			return bROM[addr];
 		}
@@ -232,7 +575,7 @@ public:
 				zero_bank_number = ((ram_bank_number & 1) << 5) | ((ram_bank_number & 2) << 5);
 			}
 
-			return mode ? rom[addr] : rom[0x4000 * zero_bank_number + addr];
+			return mode ? readBanked(rom, addr) : readBanked(rom, 0x4000 * zero_bank_number + addr);
 		}
 		else if (addr < 0x8000) {
 			uint8_t high_bank_number = rom_bank_number;
@@ -244,7 +587,7 @@ public:
 				high_bank_number |= ((ram_bank_number & 1) << 5) | ((ram_bank_number & 2) << 5);
 			}
 
-			return rom[0x4000 * high_bank_number + (addr - 0x4000)];
+			return readBanked(rom, 0x4000 * high_bank_number + (addr - 0x4000));
 		}
 		else if (addr < 0xA000) {
 			return vRAM[addr - 0x8000];
@@ -252,10 +595,10 @@ public:
 		else if (addr < 0xC000) {
 			if (cRAM_enabled) {
 				if (ram_banks == 3) {
-					return mode ? cRAM[addr - 0xA000] : cRAM[0x2000 * ram_bank_number + (addr - 0xA000)];
+					return mode ? readBanked(cRAM, addr - 0xA000) : readBanked(cRAM, 0x2000 * ram_bank_number + (addr - 0xA000));
 				}
 
-				return cRAM[(addr - 0xA000) % cRAM.size()];
+				return readBanked(cRAM, (addr - 0xA000) % cRAM.size());
 			}
 			
 			return 0xFF;
@@ -272,54 +615,56 @@ public:
 		else if (addr < 0xFF00) {
 			return 0;
 		}
-		else if (addr < 0xFF80) {
-			return io[addr - 0xFF00];
-		}
 		else {
-			if (addr == 0xFFFF) {
-				return ie;
-			}
-			else {
-				return wRAM[0x2000 + (addr - 0xFF80)];
-			}
+			return readIO(addr - 0xFF00, this, io);
 		}
 	}
 
 	/**
-	 * @brief Writes a byte to the memory map, handling MBC1 register writes for banking.
+	 * @brief Slow path of `set` for pages without a host pointer, handling MBC1 register writes for banking.
 	 * @param addr The 16-bit memory address to write to.
 	 * @param val The byte value to write.
 	 */
-	inline void set(uint16_t addr, uint8_t val) {
+	void setSlow(uint16_t addr, uint8_t val) {
+		checkCode(addr);
+
 		if (addr < 0x2000) {
 				cRAM_enabled = ((val & 0xF) == 0xA) && ram_banks;
+
+			remap();
 		}
 		else if (addr < 0x4000) {
 			uint16_t num = val & (std::min(rom_banks - 1, 31));
 
 			rom_bank_number = val == 0 ? 1 : num;
+
+			remap();
 		}
 		else if (addr < 0x6000) {
 			ram_bank_number = val & 3;
+
+			remap();
 		}
 		else if (addr < 0x8000) {
 			mode = val & 1;
+
+			remap();
 		}
 		else if (addr < 0xA000) {
-			vRAM[addr - 0x8000] = val;
+			writeVRAM(vRAM, addr, val);
 		}
 		else if (addr < 0xC000) {
 			if (cRAM_enabled) {
 				if (ram_banks == 3) {
 					if (mode) {
-						cRAM[addr - 0xA000] = val;
+						writeBanked(cRAM, addr - 0xA000, val);
 					}
 					else {
-						cRAM[0x2000 * ram_bank_number + (addr - 0xA000)] = val;
+						writeBanked(cRAM, 0x2000 * ram_bank_number + (addr - 0xA000), val);
 					}
 				}
 				else {
-					cRAM[(addr - 0xA000) % cRAM.size()] = val;
+					writeBanked(cRAM, (addr - 0xA000) % cRAM.size(), val);
 				}
 			}
 		}
@@ -332,39 +677,58 @@ public:
 		else if (addr < 0xFEA0) {
 			oam[addr - 0xFE00] = val;
 		}
-		else if (addr >= 0xFF00 && addr < 0xFF80) {
+		else if (addr < 0xFF00) {}
+		else {
 			handleIO(addr - 0xFF00, val, this, this->io);
 		}
-		else {
-			if (addr == 0xFFFF) {
-				ie = val;
-			}
-			else {
-				wRAM[0x2000 + (addr - 0xFF80)] = val;
+	}
+
+	/**
+	 * @brief Rebuilds the page tables from the bank registers, banking mode and boot ROM state.
+	 */
+	void remap() {
+		uint8_t zero_bank_number = 0;
+		uint8_t high_bank_number = rom_bank_number;
+
+		if (rom_banks == 64) {
+			zero_bank_number = (ram_bank_number & 1) << 5;
+			high_bank_number |= zero_bank_number;
+		}
+		else if (rom_banks > 32) {
+			zero_bank_number = ((ram_bank_number & 1) << 5) | ((ram_bank_number & 2) << 5);
+
+			if (rom_banks == 128) {
+				high_bank_number |= zero_bank_number;
 			}
 		}
-	}
 
-	void loadROM(std::ifstream& f) {
-		loadR(f, rom);
-	}
+		mapPages(readPages, 0x00, 0x40, rom, mode ? 0 : 0x4000 * zero_bank_number);
+		mapPages(readPages, 0x40, 0x40, rom, 0x4000 * high_bank_number);
+		unmapPages(writePages, 0x00, 0x80);
 
-	void loadBootROM(std::string f) {
-		boot_rom_active = loadBR(f, bROM);
-	}
+		if (boot_rom_active) {
+			mapPages(readPages, 0x00, 1, bROM, 0);
+		}
 
-	inline bool isBRActive() {
-		return boot_rom_active;
-	}
+		if (cRAM_enabled && !cRAM.empty()) {
+			for (unsigned i = 0; i < 0x20; i++) {
+				size_t offset = ram_banks == 3 ? (mode ? 0 : 0x2000 * ram_bank_number) + i * 0x100 : (i * 0x100) % cRAM.size();
 
-	void disableBR() {
-		boot_rom_active = false;
+				mapPages(readPages, 0xA0 + i, 1, cRAM, offset);
+				mapPages(writePages, 0xA0 + i, 1, cRAM, offset);
+			}
+		}
+		else {
+			unmapPages(readPages, 0xA0, 0x20);
+			unmapPages(writePages, 0xA0, 0x20);
+		}
+
+		mapInternalRAM(vRAM, wRAM, io);
+		pagesChanged();
 	}
 
-private:
 	bool cRAM_enabled = false;
 	std::vector<uint8_t> bROM, rom, vRAM, cRAM, wRAM, oam, io;
-	uint8_t ie;
 	uint16_t rom_banks;
 	uint8_t ram_banks;
 	uint16_t rom_bank_number = 1;
@@ -377,7 +741,7 @@ private:
  * @brief Memory Bank Controller 3 (MBC3).
  * Handles ROM and RAM banking, and potentially Real-Time Clock (RTC) for cartridges using the MBC3 chip.
  */
-class MBC3 : public Mem {
+class MBC3 final : public Mem {
 public:
 	/**
 	 * @brief Constructs an MBC3 memory controller.
@@ -398,37 +762,96 @@ public:
 		case 3:
 			cRAM = std::vector<uint8_t>(0x8000); break;
 		}
-		wRAM = std::vector<uint8_t>(0x207F);
+		wRAM = std::vector<uint8_t>(0x2000);
 		oam = std::vector<uint8_t>(0xA0);
-		io = std::vector<uint8_t>(0x80);
-		ie = 0;
+		io = std::vector<uint8_t>(0x100);
 		rom_banks = nROM;
 		cRAM_enabled = ram_banks = nRAM;
+		remap();
 	}
 
 	~MBC3() = default;
 
 	/**
-	 * @brief Reads a byte from the memory map, considering MBC3 banking.
+	 * @brief Reads a byte from the memory map.
+	 * Mapped pages are a single indexed load, as are HRAM and IE, which share page 0xFF
+	 * with the I/O registers; everything else goes through `getSlow`.
 	 * @param addr The 16-bit memory address to read from.
 	 * @return The byte value at the given address.
 	 */
 	inline uint8_t get(uint16_t addr) {
+		if (const uint8_t* page = readPages[addr >> 8]) {
+			return page[addr & 0xFF];
+		}
+		else if (addr >= 0xFF80) {
+			return io[addr - 0xFF00];
+		}
+
+		return getSlow(addr);
+	}
+
+	/**
+	 * @brief Writes a byte to the memory map.
+	 * Mapped pages are a single indexed store. HRAM has no side effects, so it is
+	 * stored directly even though it shares page 0xFF with the I/O registers and IE;
+	 * everything else goes through `setSlow`.
+	 * @param addr The 16-bit memory address to write to.
+	 * @param val The byte value to write.
+	 */
+	inline void set(uint16_t addr, uint8_t val) {
+		if (uint8_t* page = writePages[addr >> 8]) {
+			page[addr & 0xFF] = val;
+		}
+		else if (addr >= 0xFF80 && addr != 0xFFFF && !codePages[0xFF]) {
+			io[addr - 0xFF00] = val;
+		}
+		else {
+			setSlow(addr, val);
+		}
+	}
+
+	void loadROM(std::istream& f) {
+		loadR(f, rom);
+		cartridgeROM = &rom;
+		remap();
+	}
+
+	void loadBootROM(std::string f) {
+		boot_rom_active = loadBR(f, bROM);
+		remap();
+	}
+
+	inline bool isBRActive() {
+		return boot_rom_active;
+	}
+
+	void disableBR() {
+		boot_rom_active = false;
+		remap();
+	}
+
+private:
+	/**
+	 * @brief Slow path of `get` for pages without a host pointer, considering MBC3 banking.
+	 * @param addr The 16-bit memory address to read from.
+	 * @return The byte value at the given address.
+	 */
+	uint8_t getSlow(uint16_t addr) {
 		if (boot_rom_active && addr < 0x100) {
 			return bROM[addr];
 		}
 		else if (addr < 0x4000) {
-			return rom[addr];
+			return readBanked(rom, addr);
 		}
 		else if (addr < 0x8000) {
-			return rom[0x4000 * rom_bank_number + (addr - 0x4000)];
+			return readBanked(rom, 0x4000 * rom_bank_number + (addr - 0x4000));
 		}
 		else if (addr < 0xA000) {
 			return vRAM[addr - 0x8000];
 		}
 		else if (addr < 0xC000) {
 			if (cRAM_enabled) {
-				return cRAM[0x2000 * ram_bank_number + (addr - 0xA000)];
+				return readBanked(cRAM, 0x2000 * ram_bank_number + (addr - 0xA000));
 			}
 
 			return 0xFF;
@@ -445,30 +868,28 @@ public:
 		else if (addr < 0xFF00) {
 			return 0;
 		}
-		else if (addr < 0xFF80) {
-			return io[addr - 0xFF00];
-		}
 		else {
-			if (addr == 0xFFFF) {
-				return ie;
-			}
-			else {
-				return wRAM[0x2000 + (addr - 0xFF80)];
-			}
+			return readIO(addr - 0xFF00, this, io);
 		}
 	}
 
 	/**
-	 * @brief Writes a byte to the memory map, handling MBC3 register writes for banking and RTC.
+	 * @brief Slow path of `set` for pages without a host pointer, handling MBC3 register writes for banking and RTC.
 	 * @param addr The 16-bit memory address to write to.
 	 * @param val The byte value to write.
 	 */
-	inline void set(uint16_t addr, uint8_t val) {
+	void setSlow(uint16_t addr, uint8_t val) {
+		checkCode(addr);
+
 		if (addr < 0x2000) {
 			cRAM_enabled = ((val & 0xF) == 0xA) && ram_banks;
+
+			remap();
 		}
 		else if (addr < 0x4000) {
 			rom_bank_number = val == 0 ? 1 : val & 127;
+
+			remap();
 		}
 		else if (addr < 0x6000) {
 			if (val < 3) {
@@ -476,15 +897,17 @@ public:
 			} else if (val > 7 && val < 0xD) {
 				// RTC
 			}
+
+			remap();
 		}
 		else if (addr < 0x8000) {
 			// RTC Latch
 		}
 		else if (addr < 0xA000) {
-			vRAM[addr - 0x8000] = val;
+			writeVRAM(vRAM, addr, val);
 		}
 		else if (addr < 0xC000) {
-			cRAM[0x2000 * ram_bank_number + (addr - 0xA000)] = val;
+			writeBanked(cRAM, 0x2000 * ram_bank_number + (addr - 0xA000), val);
 		}
 		else if (addr < 0xE000) {
 			wRAM[addr - 0xC000] = val;
@@ -495,39 +918,39 @@ public:
 		else if (addr < 0xFEA0) {
 			oam[addr - 0xFE00] = val;
 		}
-		else if (addr >= 0xFF00 && addr < 0xFF80) {
-			handleIO(addr - 0xFF00, val, this, this->io);
-		}
+		else if (addr < 0xFF00) {}
 		else {
-			if (addr == 0xFFFF) {
-				ie = val;
-			}
-			else {
-				wRAM[0x2000 + (addr - 0xFF80)] = val;
-			}
+			handleIO(addr - 0xFF00, val, this, this->io);
 		}
 	}
 
-	void loadROM(std::ifstream& f) {
-		loadR(f, rom);
-	}
+	/**
+	 * @brief Rebuilds the page tables from the bank registers and boot ROM state.
+	 */
+	void remap() {
+		mapPages(readPages, 0x00, 0x40, rom, 0);
+		mapPages(readPages, 0x40, 0x40, rom, 0x4000 * rom_bank_number);
+		unmapPages(writePages, 0x00, 0x80);
 
-	void loadBootROM(std::string f) {
-		boot_rom_active = loadBR(f, bROM);
-	}
+		if (boot_rom_active) {
+			mapPages(readPages, 0x00, 1, bROM, 0);
+		}
 
-	inline bool isBRActive() {
-		return boot_rom_active;
-	}
+		if (cRAM_enabled) {
+			mapPages(readPages, 0xA0, 0x20, cRAM, 0x2000 * ram_bank_number);
+			mapPages(writePages, 0xA0, 0x20, cRAM, 0x2000 * ram_bank_number);
+		}
+		else {
+			unmapPages(readPages, 0xA0, 0x20);
+			unmapPages(writePages, 0xA0, 0x20);
+		}
 
-	void disableBR() {
-		boot_rom_active = false;
+		mapInternalRAM(vRAM, wRAM, io);
+		pagesChanged();
 	}
 
-private:
 	bool cRAM_enabled = false;
 	std::vector<uint8_t> bROM, rom, vRAM, cRAM, wRAM, oam, io;
-	uint8_t ie;
 	uint16_t rom_banks;
 	uint8_t ram_banks;
 	uint16_t rom_bank_number = 1;
@@ -539,7 +962,7 @@ private:
  * @brief Memory Bank Controller 5 (MBC5).
  * Handles ROM and RAM banking for cartridges using the MBC5 chip.
  */
-class MBC5 : public Mem {
+class MBC5 final : public Mem {
 public:
 	/**
 	 * @brief Constructs an MBC5 memory controller.
@@ -559,37 +982,96 @@ public:
 		case 3:
 			cRAM = std::vector<uint8_t>(0x8000); break;
 		}
-		wRAM = std::vector<uint8_t>(0x207F);
+		wRAM = std::vector<uint8_t>(0x2000);
 		oam = std::vector<uint8_t>(0xA0);
-		io = std::vector<uint8_t>(0x80);
-		ie = 0;
+		io = std::vector<uint8_t>(0x100);
 		rom_banks = nROM;
 		cRAM_enabled = ram_banks = nRAM;
+		remap();
 	}
 
 	~MBC5() = default;
 
 	/**
-	 * @brief Reads a byte from the memory map, considering MBC5 banking.
+	 * @brief Reads a byte from the memory map.
+	 * Mapped pages are a single indexed load, as are HRAM and IE, which share page 0xFF
+	 * with the I/O registers; everything else goes through `getSlow`.
 	 * @param addr The 16-bit memory address to read from.
 	 * @return The byte value at the given address.
 	 */
 	inline uint8_t get(uint16_t addr) {
+		if (const uint8_t* page = readPages[addr >> 8]) {
+			return page[addr & 0xFF];
+		}
+		else if (addr >= 0xFF80) {
+			return io[addr - 0xFF00];
+		}
+
+		return getSlow(addr);
+	}
+
+	/**
+	 * @brief Writes a byte to the memory map.
+	 * Mapped pages are a single indexed store. HRAM has no side effects, so it is
+	 * stored directly even though it shares page 0xFF with the I/O registers and IE;
+	 * everything else goes through `setSlow`.
+	 * @param addr The 16-bit memory address to write to.
+	 * @param val The byte value to write.
+	 */
+	inline void set(uint16_t addr, uint8_t val) {
+		if (uint8_t* page = writePages[addr >> 8]) {
+			page[addr & 0xFF] = val;
+		}
+		else if (addr >= 0xFF80 && addr != 0xFFFF && !codePages[0xFF]) {
+			io[addr - 0xFF00] = val;
+		}
+		else {
+			setSlow(addr, val);
+		}
+	}
+
+	void loadROM(std::istream& f) {
+		loadR(f, rom);
+		cartridgeROM = &rom;
+		remap();
+	}
+
+	void loadBootROM(std::string f) {
+		boot_rom_active = loadBR(f, bROM);
+		remap();
+	}
+
+	inline bool isBRActive() {
+		return boot_rom_active;
+	}
+
+	void disableBR() {
+		boot_rom_active = false;
+		remap();
+	}
+
+private:
+	/**
+	 * @brief Slow path of `get` for pages without a host pointer, considering MBC5 banking.
+	 * @param addr The 16-bit memory address to read from.
+	 * @return The byte value at the given address.
+	 */
+	uint8_t getSlow(uint16_t addr) {
 		if (boot_rom_active && addr < 0x100) {
 			return bROM[addr];
 		}
 		else if (addr < 0x4000) {
-			return rom[addr];
+			return readBanked(rom, addr);
 		}
 		else if (addr < 0x8000) {
-			return rom[0x4000 * rom_bank_number + (addr - 0x4000)];
+			return readBanked(rom, 0x4000 * rom_bank_number + (addr - 0x4000));
 		}
 		else if (addr < 0xA000) {
 			return vRAM[addr - 0x8000];
 		}
 		else if (addr < 0xC000) {
 			if (cRAM_enabled) {
-				return cRAM[0x2000 * ram_bank_number + (addr - 0xA000)];
+				return readBanked(cRAM, 0x2000 * ram_bank_number + (addr - 0xA000));
 			}
 
 			return 0xFF;
@@ -606,43 +1088,45 @@ public:
 		else if (addr < 0xFF00) {
 			return 0;
 		}
-		else if (addr < 0xFF80) {
-			return io[addr - 0xFF00];
-		}
 		else {
-			if (addr == 0xFFFF) {
-				return ie;
-			}
-			else {
-				return wRAM[0x2000 + (addr - 0xFF80)];
-			}
+			return readIO(addr - 0xFF00, this, io);
 		}
 	}
 
 	/**
-	 * @brief Writes a byte to the memory map, handling MBC5 register writes for banking.
+	 * @brief Slow path of `set` for pages without a host pointer, handling MBC5 register writes for banking.
 	 * @param addr The 16-bit memory address to write to.
 	 * @param val The byte value to write.
 	 */
-	inline void set(uint16_t addr, uint8_t val) {
+	void setSlow(uint16_t addr, uint8_t val) {
+		checkCode(addr);
+
 		if (addr < 0x2000) {
 			cRAM_enabled = ((val & 0xF) == 0xA) && ram_banks;
+
+			remap();
 		}
 		else if (addr < 0x2000) {
 			rom_bank_number = val;
+
+			remap();
 		}
 		else if (addr < 0x3000) {
 			rom_bank_number = (rom_bank_number & ~(1UL << 8)) | (val & 1 << 8);
+
+			remap();
 		}
 		else if (addr < 0x6000) {
 			ram_bank_number = val;
+
+			remap();
 		}
 		else if (addr < 0x8000) {}
 		else if (addr < 0xA000) {
-			vRAM[addr - 0x8000] = val;
+			writeVRAM(vRAM, addr, val);
 		}
 		else if (addr < 0xC000) {
-			cRAM[0x2000 * ram_bank_number + (addr - 0xA000)] = val;
+			writeBanked(cRAM, 0x2000 * ram_bank_number + (addr - 0xA000), val);
 		}
 		else if (addr < 0xE000) {
 			wRAM[addr - 0xC000] = val;
@@ -653,39 +1137,39 @@ public:
 		else if (addr < 0xFEA0) {
 			oam[addr - 0xFE00] = val;
 		}
-		else if (addr >= 0xFF00 && addr < 0xFF80) {
-			handleIO(addr - 0xFF00, val, this, this->io);
-		}
+		else if (addr < 0xFF00) {}
 		else {
-			if (addr == 0xFFFF) {
-				ie = val;
-			}
-			else {
-				wRAM[0x2000 + (addr - 0xFF80)] = val;
-			}
+			handleIO(addr - 0xFF00, val, this, this->io);
 		}
 	}
 
-	void loadROM(std::ifstream& f) {
-		loadR(f, rom);
-	}
+	/**
+	 * @brief Rebuilds the page tables from the bank registers and boot ROM state.
+	 */
+	void remap() {
+		mapPages(readPages, 0x00, 0x40, rom, 0);
+		mapPages(readPages, 0x40, 0x40, rom, 0x4000 * rom_bank_number);
+		unmapPages(writePages, 0x00, 0x80);
 
-	void loadBootROM(std::string f) {
-		boot_rom_active = loadBR(f, bROM);
-	}
+		if (boot_rom_active) {
+			mapPages(readPages, 0x00, 1, bROM, 0);
+		}
 
-	inline bool isBRActive() {
-		return boot_rom_active;
-	}
+		if (cRAM_enabled) {
+			mapPages(readPages, 0xA0, 0x20, cRAM, 0x2000 * ram_bank_number);
+			mapPages(writePages, 0xA0, 0x20, cRAM, 0x2000 * ram_bank_number);
+		}
+		else {
+			unmapPages(readPages, 0xA0, 0x20);
+			unmapPages(writePages, 0xA0, 0x20);
+		}
 
-	void disableBR() {
-		boot_rom_active = false;
+		mapInternalRAM(vRAM, wRAM, io);
+		pagesChanged();
 	}
 
-private:
 	bool cRAM_enabled = false;
 	std::vector<uint8_t> bROM, rom, vRAM, cRAM, wRAM, oam, io;
-	uint8_t ie;
 	uint16_t rom_banks;
 	uint8_t ram_banks;
 	uint16_t rom_bank_number = 1;
@@ -693,6 +1177,12 @@ private:
 	bool boot_rom_active = false;
 };
 
-inline std::unique_ptr<Mem> memory;
+/**
+ * @brief X-macro over every concrete memory controller.
+ * The CPU loop, PPU and timer are instantiated once per entry, so their bus
+ * accesses are direct (inlinable) calls on the final mapper class instead of
+ * virtual calls through `Mem`.
+ */
+#define GB_MAPPERS(M) M(NoMBC) M(MBC1) M(MBC3) M(MBC5)
 
 #endif // MEMORY_H
\ No newline at end of file
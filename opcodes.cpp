@@ -1,5 +1,30 @@
 #include <cstdint>
+#include <algorithm>
+#include <cstring>
 #include "gba.hpp"
+#include "opcodes.h"
+
+#ifdef GB_ALU_TABLES
+#include "alu.hpp"
+#endif
+
+#if defined(__GNUC__)
+#define GB_ALWAYS_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define GB_ALWAYS_INLINE __forceinline
+#else
+#define GB_ALWAYS_INLINE inline
+#endif
+
+// X-macro over all 256 opcodes, used to build the dispatch tables
+#define GB_OPCODE_ROW(M, h) \
+    M(0x##h##0) M(0x##h##1) M(0x##h##2) M(0x##h##3) M(0x##h##4) M(0x##h##5) M(0x##h##6) M(0x##h##7) \
+    M(0x##h##8) M(0x##h##9) M(0x##h##A) M(0x##h##B) M(0x##h##C) M(0x##h##D) M(0x##h##E) M(0x##h##F)
+#define GB_OPCODES(M) \
+    GB_OPCODE_ROW(M, 0) GB_OPCODE_ROW(M, 1) GB_OPCODE_ROW(M, 2) GB_OPCODE_ROW(M, 3) \
+    GB_OPCODE_ROW(M, 4) GB_OPCODE_ROW(M, 5) GB_OPCODE_ROW(M, 6) GB_OPCODE_ROW(M, 7) \
+    GB_OPCODE_ROW(M, 8) GB_OPCODE_ROW(M, 9) GB_OPCODE_ROW(M, A) GB_OPCODE_ROW(M, B) \
+    GB_OPCODE_ROW(M, C) GB_OPCODE_ROW(M, D) GB_OPCODE_ROW(M, E) GB_OPCODE_ROW(M, F)
 
 // from https://github.com/retrio/gb-test-roms/tree/master/instr_timing
 const uint8_t cycles[256] = {
@@ -40,43 +65,143 @@ const uint8_t cb_cycles[256] = {
     2,2,2,2,2,2,4,2,2,2,2,2,2,2,4,2
 };
 
+// Instruction lengths in bytes, as far as this core advances PC (STOP is a single byte)
+const uint8_t lengths[256] = {
+    1,3,1,1,1,1,2,1,3,1,1,1,1,1,2,1,
+    1,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
+    2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
+    2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,3,3,3,1,2,1,1,1,3,2,3,3,2,1,
+    1,1,3,1,3,1,2,1,1,1,3,1,3,1,2,1,
+    2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1,
+    2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1
+};
+
 /**
  * @brief Reads a byte from the specified memory address.
+ * @tparam M The concrete memory controller type of `memory`.
  * @param addr The 16-bit memory address to read from.
  * @return The 8-bit value read from memory.
  */
-uint8_t read(uint16_t addr) {
-    return memory->get(addr);
+template<class M>
+GB_ALWAYS_INLINE uint8_t Machine::read(uint16_t addr) {
+    return static_cast<M*>(memory.get())->get(addr);
 }
 
 /**
  * @brief Reads a 16-bit word from the specified memory address (little-endian).
+ * @tparam M The concrete memory controller type of `memory`.
  * @param addr The 16-bit memory address to read the low byte from.
  * @return The 16-bit value read from memory.
  */
-uint16_t read16(uint16_t addr) {
-    uint8_t a = memory->get(addr);
-    uint8_t b = memory->get(addr + 1);
+template<class M>
+GB_ALWAYS_INLINE uint16_t Machine::read16(uint16_t addr) {
+    uint8_t a = read<M>(addr);
+    uint8_t b = read<M>(addr + 1);
     return a | (b << 8);
 }
 
 /**
  * @brief Writes a byte to the specified memory address.
+ * @tparam M The concrete memory controller type of `memory`.
  * @param addr The 16-bit memory address to write to.
  * @param val The 8-bit value to write.
  */
-void write(uint16_t addr, uint8_t val) {
-    memory->set(addr, val);
+template<class M>
+GB_ALWAYS_INLINE void Machine::write(uint16_t addr, uint8_t val) {
+    static_cast<M*>(memory.get())->set(addr, val);
+}
+
+/**
+ * @brief Fetches the 8-bit immediate operand following the opcode at `$PC`, leaving `$PC` on it.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @tparam Decoded Whether the operand was pre-decoded into `decoded` (cached dispatch).
+ * @return The operand byte.
+ */
+template<class M, bool Decoded>
+GB_ALWAYS_INLINE uint8_t Machine::imm8() {
+    if constexpr (Decoded) {
+        ++$PC;
+        return uint8_t(decoded->operand);
+    }
+    else {
+        return read<M>(++$PC);
+    }
+}
+
+/**
+ * @brief Fetches the 16-bit immediate operand following the opcode at `$PC`, leaving `$PC` on its low byte.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @tparam Decoded Whether the operand was pre-decoded into `decoded` (cached dispatch).
+ * @return The operand word.
+ */
+template<class M, bool Decoded>
+GB_ALWAYS_INLINE uint16_t Machine::imm16() {
+    if constexpr (Decoded) {
+        ++$PC;
+        return decoded->operand;
+    }
+    else {
+        return read16<M>(++$PC);
+    }
 }
 
 /**
  * @brief Clears all CPU flags (Z, N, H, C).
  * Sets Z, N, H, C flags to 0.
  */
-void clearFlags() {
+void Machine::clearFlags() {
     $Z = 0; $N = 0; $HF = 0; $CR = 0;
 }
 
+#ifdef GB_LAZY_FLAGS
+/**
+ * @brief Computes the flags of the deferred ALU operation and stores them in the register file.
+ * Uses the same flag formulas as the eager helpers below.
+ */
+void Machine::materializeFlags() {
+    const uint8_t x = lazy.x, y = lazy.y, c = lazy.c, res = lazy.res;
+    bool z = !res, n = false, h = false, cr = false;
+
+    switch (lazy.op) {
+    case LazyOp::Add:
+        h = (x & 0xF) + (y & 0xF) + c > 0xF;
+        cr = y > UINT8_MAX - (x + c);
+        break;
+    case LazyOp::Sub:
+        n = true;
+        h = (x & 0xF) - c < (y & 0xF);
+        cr = y > (x - c);
+        break;
+    case LazyOp::And:
+        h = true;
+        break;
+    case LazyOp::Or:
+        break;
+    case LazyOp::Shift:
+        cr = y;
+        break;
+    case LazyOp::ShiftA:
+        z = false;
+        cr = y;
+        break;
+    case LazyOp::None:
+        return;
+    }
+
+    cpu.zf = z; cpu.nf = n; cpu.hf = h; cpu.cf = cr;
+    lazy.op = LazyOp::None;
+}
+#endif
+
 /**
  * @brief Adds two 8-bit values with an optional carry-in.
  * Updates Z, N, H, C flags.
@@ -84,19 +209,26 @@ void clearFlags() {
  * N: Reset (0).
  * H: Set if carry from bit 3.
  * C: Set if carry from bit 7.
+ * With GB_ALU_TABLES the flags are looked up in `Alu::tables`.
  * @param x The first 8-bit operand.
  * @param y The second 8-bit operand.
  * @param carry If true, the current carry flag ($CR) is added to the sum.
  * @return The 8-bit result of the addition.
  */
-uint8_t add(uint8_t x, uint8_t y, bool carry) {
-    uint8_t c = (carry ? $CR : 0);
+uint8_t Machine::add(uint8_t x, uint8_t y, bool carry) {
+    uint8_t c = (carry ? carryFlag() : 0);
     uint8_t res = x + c + y;
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::Add, x, y, c, res);
+#elif defined(GB_ALU_TABLES)
+    cpu.setF(Alu::tables.add[c][x][y] >> 8);
+#else
     $Z = !res;
     $N = 0;
     $HF = (x & 0xF) + (y & 0xF) + c > 0xF;
     $CR = y > UINT8_MAX - (x + c);
+#endif
 
     return res;
 }
@@ -112,7 +244,7 @@ uint8_t add(uint8_t x, uint8_t y, bool carry) {
  * @param y The second 8-bit operand.
  * @return The 8-bit result of the addition.
  */
-uint8_t add(uint8_t x, uint8_t y) {
+uint8_t Machine::add(uint8_t x, uint8_t y) {
     return add(x, y, false);
 }
 
@@ -126,7 +258,7 @@ uint8_t add(uint8_t x, uint8_t y) {
  * @param y The second 16-bit operand.
  * @return The 16-bit result of the addition.
  */
-uint16_t add(uint16_t x, uint16_t y) {
+uint16_t Machine::add(uint16_t x, uint16_t y) {
     uint16_t res = x + y;
 
     $N = 0;
@@ -147,7 +279,7 @@ uint16_t add(uint16_t x, uint16_t y) {
  * @param y The 8-bit operand (treated as signed).
  * @return The 16-bit result of the addition.
  */
-uint16_t add(uint16_t x, uint8_t y) {
+uint16_t Machine::add(uint16_t x, uint8_t y) {
     int16_t res = x + static_cast<int8_t>(y);
 
     $Z = 0;
@@ -165,19 +297,26 @@ uint16_t add(uint16_t x, uint8_t y) {
  * N: Set (1).
  * H: Set if borrow from bit 4.
  * C: Set if borrow from bit 8.
+ * With GB_ALU_TABLES the flags are looked up in `Alu::tables`.
  * @param x The 8-bit minuend.
  * @param y The 8-bit subtrahend.
  * @param carry If true, the current carry flag ($CR) is also subtracted.
  * @return The 8-bit result of the subtraction.
  */
-uint8_t sub(uint8_t x, uint8_t y, bool carry) {
-    uint8_t c = (carry ? $CR : 0);
+uint8_t Machine::sub(uint8_t x, uint8_t y, bool carry) {
+    uint8_t c = (carry ? carryFlag() : 0);
     uint8_t res = x - c - y;
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::Sub, x, y, c, res);
+#elif defined(GB_ALU_TABLES)
+    cpu.setF(Alu::tables.sub[c][x][y] >> 8);
+#else
     $Z = !res;
     $N = 1;
     $HF = (x & 0xF) - c < (y & 0xF);
     $CR = y > (x - c);
+#endif
 
     return res;
 }
@@ -193,7 +332,7 @@ uint8_t sub(uint8_t x, uint8_t y, bool carry) {
  * @param y The 8-bit subtrahend.
  * @return The 8-bit result of the subtraction.
  */
-uint8_t sub(uint8_t x, uint8_t y) {
+uint8_t Machine::sub(uint8_t x, uint8_t y) {
     return sub(x, y, false);
 }
 
@@ -206,7 +345,7 @@ uint8_t sub(uint8_t x, uint8_t y) {
  * @param x The 8-bit value to increment.
  * @return The incremented 8-bit value.
  */
-uint8_t inc(uint8_t x) {
+uint8_t Machine::inc(uint8_t x) {
     uint8_t res = x + 1;
 
     $Z = !res; $N = 0; $HF = (x & 0xF) + 1 > 0xF;
@@ -220,7 +359,7 @@ uint8_t inc(uint8_t x) {
  * @param x The 16-bit value to increment.
  * @return The incremented 16-bit value.
  */
-uint16_t inc(uint16_t x) {
+uint16_t Machine::inc(uint16_t x) {
     return x + 1;
 }
 
@@ -233,7 +372,7 @@ uint16_t inc(uint16_t x) {
  * @param x The 8-bit value to decrement.
  * @return The decremented 8-bit value.
  */
-uint8_t dec(uint8_t x) {
+uint8_t Machine::dec(uint8_t x) {
     uint8_t res = x - 1;
 
     $Z = !res; $N = 1; $HF = (x & 0xF) < 1;
@@ -247,7 +386,7 @@ uint8_t dec(uint8_t x) {
  * @param x The 16-bit value to decrement.
  * @return The decremented 16-bit value.
  */
-uint16_t dec(uint16_t x) {
+uint16_t Machine::dec(uint16_t x) {
     return x - 1;
 }
 
@@ -262,10 +401,14 @@ uint16_t dec(uint16_t x) {
  * @param y The second 8-bit operand.
  * @return The 8-bit result of the AND operation.
  */
-uint8_t and8(uint8_t x, uint8_t y) {
+uint8_t Machine::and8(uint8_t x, uint8_t y) {
     uint8_t res = x & y;
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::And, x, y, 0, res);
+#else
     $Z = !res; $N = 0; $HF = 1; $CR = 0;
+#endif
 
     return res;
 }
@@ -281,10 +424,14 @@ uint8_t and8(uint8_t x, uint8_t y) {
  * @param y The second 8-bit operand.
  * @return The 8-bit result of the OR operation.
  */
-uint8_t or8(uint8_t x, uint8_t y) {
+uint8_t Machine::or8(uint8_t x, uint8_t y) {
     uint8_t res = x | y;
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::Or, x, y, 0, res);
+#else
     $Z = !res; $N = 0; $HF = 0; $CR = 0;
+#endif
 
     return res;
 }
@@ -300,10 +447,14 @@ uint8_t or8(uint8_t x, uint8_t y) {
  * @param y The second 8-bit operand.
  * @return The 8-bit result of the XOR operation.
  */
-uint8_t xor8(uint8_t x, uint8_t y) {
+uint8_t Machine::xor8(uint8_t x, uint8_t y) {
     uint8_t res = x ^ y;
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::Or, x, y, 0, res);
+#else
     $Z = !res; $N = 0; $HF = 0; $CR = 0;
+#endif
 
     return res;
 }
@@ -318,10 +469,14 @@ uint8_t xor8(uint8_t x, uint8_t y) {
  * @param x The 8-bit value to swap nibbles.
  * @return The 8-bit value with swapped nibbles.
  */
-uint8_t swap(uint8_t x) {
+uint8_t Machine::swap(uint8_t x) {
     uint8_t res = (x << 4) | (x >> 4);
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::Or, x, 0, 0, res);
+#else
     $Z = !res; $N = 0; $HF = 0; $CR = 0;
+#endif
 
     return res;
 }
@@ -336,10 +491,14 @@ uint8_t swap(uint8_t x) {
  * @param x The 8-bit value to shift.
  * @return The 8-bit result of the shift operation.
  */
-uint8_t sl(uint8_t x) {
+uint8_t Machine::sl(uint8_t x) {
     uint8_t res = x << 1;
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::Shift, x, (x & 128) != 0, 0, res);
+#else
     $Z = !res; $N = 0; $HF = 0; $CR = (x & 128) != 0;
+#endif
 
     return res;
 }
@@ -357,10 +516,14 @@ uint8_t sl(uint8_t x) {
  * @param logical True for logical shift (SRL), false for arithmetic shift (SRA).
  * @return The 8-bit result of the shift operation.
  */
-uint8_t sr(uint8_t x, bool logical) {
+uint8_t Machine::sr(uint8_t x, bool logical) {
     uint8_t res = logical ? x >> 1 : ((x >> 1) | (x & 0x80));
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(LazyOp::Shift, x, (x & 1) != 0, 0, res);
+#else
     $Z = !res; $N = 0; $HF = 0; $CR = (x & 1) != 0;
+#endif
 
     return res;
 }
@@ -379,12 +542,16 @@ uint8_t sr(uint8_t x, bool logical) {
  * @param isA True if the operation is on register A (RLCA/RLA), affects Z flag.
  * @return The 8-bit result of the rotation.
  */
-uint8_t rl(uint8_t x, bool carry, bool isA) {
-    uint8_t res = (x << 1) | (carry ? (x & 128) != 0 : $CR);
+uint8_t Machine::rl(uint8_t x, bool carry, bool isA) {
+    uint8_t res = (x << 1) | (carry ? (x & 128) != 0 : carryFlag());
 
+#ifdef GB_LAZY_FLAGS
+    deferFlags(isA ? LazyOp::ShiftA : LazyOp::Shift, x, (x & 128) != 0, 0, res);
+#else
     $Z = isA ? 0 : !res;
     
     $N = 0; $HF = 0; $CR = (x & 128) != 0;
+#endif
 
     return res;
 }
@@ -396,7 +563,7 @@ uint8_t rl(uint8_t x, bool carry, bool isA) {
  * @param carry True for RLC, false for RL.
  * @return The 8-bit result of the rotation.
  */
-uint8_t rl(uint8_t x, bool carry) {
+uint8_t Machine::rl(uint8_t x, bool carry) {
     return rl(x, carry, false);
 }
 
@@ -405,850 +572,200 @@ uint8_t rl(uint8_t x, bool carry) {
  * If `carry` is true (RRC), bit 0 is moved to bit 7 and also to the Carry flag.
  * If `carry` is false (RR), the Carry flag is moved to bit 7, and bit 0 is moved to the Carry flag.
  * Updates Z, N, H, C flags.
- * Z: Set if result is 0 (unless `isA` is true, then Z is 0).
- * N: Reset (0).
- * H: Reset (0).
- * C: Set to the value of bit 0 of the original `x`.
- * @param x The 8-bit value to rotate.
- * @param carry True for RRC (rotate right through carry), false for RR (rotate right).
- * @param isA True if the operation is on register A (RRCA/RRA), affects Z flag.
- * @return The 8-bit result of the rotation.
- */
-uint8_t rr(uint8_t x, bool carry, bool isA) {
-    uint8_t res = (x >> 1) | ((carry ? x & 1 : $CR) << 7);
-
-    $Z = isA ? 0 : !res;
-
-    $N = 0; $HF = 0; $CR = x & 1;
-
-    return res;
-}
-
-/**
- * @brief Rotates an 8-bit value right (not specific to register A).
- * Calls `rr(x, carry, false)`.
- * @param x The 8-bit value to rotate.
- * @param carry True for RRC, false for RR.
- * @return The 8-bit result of the rotation.
- */
-uint8_t rr(uint8_t x, bool carry) {
-    return rr(x, carry, false);
-}
-
-/**
- * @brief Tests a specific bit of an 8-bit value.
- * Updates Z, N, H flags. C flag is not affected.
- * Z: Set if the tested bit is 0.
- * N: Reset (0).
- * H: Set (1).
- * @param x The 8-bit value to test.
- * @param pos The bit position to test (0-7).
- */
-void test(uint8_t x, int pos) {
-    $Z = ((x >> pos) & 1) == 0; $N = 0; $HF = 1;
-}
-
-/**
- * @brief Sets a specific bit of an 8-bit value to 1.
- * Flags are not affected.
- * @param x The 8-bit value.
- * @param pos The bit position to set (0-7).
- * @return The 8-bit value with the specified bit set.
- */
-uint8_t set(uint8_t x, int pos) {
-    return x | (1 << pos);
-}
-
-/**
- * @brief Resets (clears) a specific bit of an 8-bit value to 0.
- * Flags are not affected.
- * @param x The 8-bit value.
- * @param pos The bit position to reset (0-7).
- * @return The 8-bit value with the specified bit reset.
- */
-uint8_t res(uint8_t x, int pos) {
-    return x & (~(1 << pos));
-}
-
-/**
- * @brief Executes a CB-prefixed opcode.
- * These opcodes are typically bit manipulation, shift, and rotate instructions.
- * @param op The 8-bit CB-prefixed opcode.
- */
-inline void executePrefixOp(uint8_t op) {
-    switch (op) {
-    case 0x0:
-        $B = rl($B, true);
-        break;
-    case 0x1:
-        $C = rl($C, true);
-        break;
-    case 0x2:
-        $D = rl($D, true);
-        break;
-    case 0x3:
-        $E = rl($E, true);
-        break;
-    case 0x4:
-        $H = rl($H, true);
-        break;
-    case 0x5:
-        $L = rl($L, true);
-        break;
-    case 0x6:
-        write($HL, rl(read($HL), true));
-        break;
-    case 0x7:
-        $A = rl($A, true);
-        break;
-    case 0x8:
-        $B = rr($B, true);
-        break;
-    case 0x9:
-        $C = rr($C, true);
-        break;
-    case 0xa:
-        $D = rr($D, true);
-        break;
-    case 0xb:
-        $E = rr($E, true);
-        break;
-    case 0xc:
-        $H = rr($H, true);
-        break;
-    case 0xd:
-        $L = rr($L, true);
-        break;
-    case 0xe:
-        write($HL, rr(read($HL), true));
-        break;
-    case 0xf:
-        $A = rr($A, true);
-        break;
-    case 0x10:
-        $B = rl($B, false);
-        break;
-    case 0x11:
-        $C = rl($C, false);
-        break;
-    case 0x12:
-        $D = rl($D, false);
-        break;
-    case 0x13:
-        $E = rl($E, false);
-        break;
-    case 0x14:
-        $H = rl($H, false);
-        break;
-    case 0x15:
-        $L = rl($L, false);
-        break;
-    case 0x16:
-        write($HL, rl(read($HL), false));
-        break;
-    case 0x17:
-        $A = rl($A, false);
-        break;
-    case 0x18:
-        $B = rr($B, false);
-        break;
-    case 0x19:
-        $C = rr($C, false);
-        break;
-    case 0x1a:
-        $D = rr($D, false);
-        break;
-    case 0x1b:
-        $E = rr($E, false);
-        break;
-    case 0x1c:
-        $H = rr($H, false);
-        break;
-    case 0x1d:
-        $L = rr($L, false);
-        break;
-    case 0x1e:
-        write($HL, rr(read($HL), false));
-        break;
-    case 0x1f:
-        $A = rr($A, false);
-        break;
-    case 0x20:
-        $B = sl($B);
-        break;
-    case 0x21:
-        $C = sl($C);
-        break;
-    case 0x22:
-        $D = sl($D);
-        break;
-    case 0x23:
-        $E = sl($E);
-        break;
-    case 0x24:
-        $H = sl($H);
-        break;
-    case 0x25:
-        $L = sl($L);
-        break;
-    case 0x26:
-        write($HL, sl(read($HL)));
-        break;
-    case 0x27:
-        $A = sl($A);
-        break;
-    case 0x28:
-        $B = sr($B, false);
-        break;
-    case 0x29:
-        $C = sr($C, false);
-        break;
-    case 0x2a:
-        $D = sr($D, false);
-        break;
-    case 0x2b:
-        $E = sr($E, false);
-        break;
-    case 0x2c:
-        $H = sr($H, false);
-        break;
-    case 0x2d:
-        $L = sr($L, false);
-        break;
-    case 0x2e:
-        write($HL, sr(read($HL), false));
-        break;
-    case 0x2f:
-        $A = sr($A, false);
-        break;
-    case 0x30:
-        $B = swap($B);
-        break;
-    case 0x31:
-        $C = swap($C);
-        break;
-    case 0x32:
-        $D = swap($D);
-        break;
-    case 0x33:
-        $E = swap($E);
-        break;
-    case 0x34:
-        $H = swap($H);
-        break;
-    case 0x35:
-        $L = swap($L);
-        break;
-    case 0x36:
-        write($HL, swap(read($HL)));
-        break;
-    case 0x37:
-        $A = swap($A);
-        break;
-    case 0x38:
-        $B = sr($B, true);
-        break;
-    case 0x39:
-        $C = sr($C, true);
-        break;
-    case 0x3a:
-        $D = sr($D, true);
-        break;
-    case 0x3b:
-        $E = sr($E, true);
-        break;
-    case 0x3c:
-        $H = sr($H, true);
-        break;
-    case 0x3d:
-        $L = sr($L, true);
-        break;
-    case 0x3e:
-        write($HL, sr(read($HL), true));
-        break;
-    case 0x3f:
-        $A = sr($A, true);
-        break;
-    case 0x40:
-        test($B, 0);
-        break;
-    case 0x41:
-        test($C, 0);
-        break;
-    case 0x42:
-        test($D, 0);
-        break;
-    case 0x43:
-        test($E, 0);
-        break;
-    case 0x44:
-        test($H, 0);
-        break;
-    case 0x45:
-        test($L, 0);
-        break;
-    case 0x46:
-        test(read($HL), 0);
-        break;
-    case 0x47:
-        test($A, 0);
-        break;
-    case 0x48:
-        test($B, 1);
-        break;
-    case 0x49:
-        test($C, 1);
-        break;
-    case 0x4a:
-        test($D, 1);
-        break;
-    case 0x4b:
-        test($E, 1);
-        break;
-    case 0x4c:
-        test($H, 1);
-        break;
-    case 0x4d:
-        test($L, 1);
-        break;
-    case 0x4e:
-        test(read($HL), 1);
-        break;
-    case 0x4f:
-        test($A, 1);
-        break;
-    case 0x50:
-        test($B, 2);
-        break;
-    case 0x51:
-        test($C, 2);
-        break;
-    case 0x52:
-        test($D, 2);
-        break;
-    case 0x53:
-        test($E, 2);
-        break;
-    case 0x54:
-        test($H, 2);
-        break;
-    case 0x55:
-        test($L, 2);
-        break;
-    case 0x56:
-        test(read($HL), 2);
-        break;
-    case 0x57:
-        test($A, 2);
-        break;
-    case 0x58:
-        test($B, 3);
-        break;
-    case 0x59:
-        test($C, 3);
-        break;
-    case 0x5a:
-        test($D, 3);
-        break;
-    case 0x5b:
-        test($E, 3);
-        break;
-    case 0x5c:
-        test($H, 3);
-        break;
-    case 0x5d:
-        test($L, 3);
-        break;
-    case 0x5e:
-        test(read($HL), 3);
-        break;
-    case 0x5f:
-        test($A, 3);
-        break;
-    case 0x60:
-        test($B, 4);
-        break;
-    case 0x61:
-        test($C, 4);
-        break;
-    case 0x62:
-        test($D, 4);
-        break;
-    case 0x63:
-        test($E, 4);
-        break;
-    case 0x64:
-        test($H, 4);
-        break;
-    case 0x65:
-        test($L, 4);
-        break;
-    case 0x66:
-        test(read($HL), 4);
-        break;
-    case 0x67:
-        test($A, 4);
-        break;
-    case 0x68:
-        test($B, 5);
-        break;
-    case 0x69:
-        test($C, 5);
-        break;
-    case 0x6a:
-        test($D, 5);
-        break;
-    case 0x6b:
-        test($E, 5);
-        break;
-    case 0x6c:
-        test($H, 5);
-        break;
-    case 0x6d:
-        test($L, 5);
-        break;
-    case 0x6e:
-        test(read($HL), 5);
-        break;
-    case 0x6f:
-        test($A, 5);
-        break;
-    case 0x70:
-        test($B, 6);
-        break;
-    case 0x71:
-        test($C, 6);
-        break;
-    case 0x72:
-        test($D, 6);
-        break;
-    case 0x73:
-        test($E, 6);
-        break;
-    case 0x74:
-        test($H, 6);
-        break;
-    case 0x75:
-        test($L, 6);
-        break;
-    case 0x76:
-        test(read($HL), 6);
-        break;
-    case 0x77:
-        test($A, 6);
-        break;
-    case 0x78:
-        test($B, 7);
-        break;
-    case 0x79:
-        test($C, 7);
-        break;
-    case 0x7a:
-        test($D, 7);
-        break;
-    case 0x7b:
-        test($E, 7);
-        break;
-    case 0x7c:
-        test($H, 7);
-        break;
-    case 0x7d:
-        test($L, 7);
-        break;
-    case 0x7e:
-        test(read($HL), 7);
-        break;
-    case 0x7f:
-        test($A, 7);
-        break;
-    case 0x80:
-        $B = res($B, 0);
-        break;
-    case 0x81:
-        $C = res($C, 0);
-        break;
-    case 0x82:
-        $D = res($D, 0);
-        break;
-    case 0x83:
-        $E = res($E, 0);
-        break;
-    case 0x84:
-        $H = res($H, 0);
-        break;
-    case 0x85:
-        $L = res($L, 0);
-        break;
-    case 0x86:
-        write($HL, res(read($HL), 0));
-        break;
-    case 0x87:
-        $A = res($A, 0);
-        break;
-    case 0x88:
-        $B = res($B, 1);
-        break;
-    case 0x89:
-        $C = res($C, 1);
-        break;
-    case 0x8a:
-        $D = res($D, 1);
-        break;
-    case 0x8b:
-        $E = res($E, 1);
-        break;
-    case 0x8c:
-        $H = res($H, 1);
-        break;
-    case 0x8d:
-        $L = res($L, 1);
-        break;
-    case 0x8e:
-        write($HL, res(read($HL), 1));
-        break;
-    case 0x8f:
-        $A = res($A, 1);
-        break;
-    case 0x90:
-        $B = res($B, 2);
-        break;
-    case 0x91:
-        $C = res($C, 2);
-        break;
-    case 0x92:
-        $D = res($D, 2);
-        break;
-    case 0x93:
-        $E = res($E, 2);
-        break;
-    case 0x94:
-        $H = res($H, 2);
-        break;
-    case 0x95:
-        $L = res($L, 2);
-        break;
-    case 0x96:
-        write($HL, res(read($HL), 2));
-        break;
-    case 0x97:
-        $A = res($A, 2);
-        break;
-    case 0x98:
-        $B = res($B, 3);
-        break;
-    case 0x99:
-        $C = res($C, 3);
-        break;
-    case 0x9a:
-        $D = res($D, 3);
-        break;
-    case 0x9b:
-        $E = res($E, 3);
-        break;
-    case 0x9c:
-        $H = res($H, 3);
-        break;
-    case 0x9d:
-        $L = res($L, 3);
-        break;
-    case 0x9e:
-        write($HL, res(read($HL), 3));
-        break;
-    case 0x9f:
-        $A = res($A, 3);
-        break;
-    case 0xa0:
-        $B = res($B, 4);
-        break;
-    case 0xa1:
-        $C = res($C, 4);
-        break;
-    case 0xa2:
-        $D = res($D, 4);
-        break;
-    case 0xa3:
-        $E = res($E, 4);
-        break;
-    case 0xa4:
-        $H = res($H, 4);
-        break;
-    case 0xa5:
-        $L = res($L, 4);
-        break;
-    case 0xa6:
-        write($HL, res(read($HL), 4));
-        break;
-    case 0xa7:
-        $A = res($A, 4);
-        break;
-    case 0xa8:
-        $B = res($B, 5);
-        break;
-    case 0xa9:
-        $C = res($C, 5);
-        break;
-    case 0xaa:
-        $D = res($D, 5);
-        break;
-    case 0xab:
-        $E = res($E, 5);
-        break;
-    case 0xac:
-        $H = res($H, 5);
-        break;
-    case 0xad:
-        $L = res($L, 5);
-        break;
-    case 0xae:
-        write($HL, res(read($HL), 5));
-        break;
-    case 0xaf:
-        $A = res($A, 5);
-        break;
-    case 0xb0:
-        $B = res($B, 6);
-        break;
-    case 0xb1:
-        $C = res($C, 6);
-        break;
-    case 0xb2:
-        $D = res($D, 6);
-        break;
-    case 0xb3:
-        $E = res($E, 6);
-        break;
-    case 0xb4:
-        $H = res($H, 6);
-        break;
-    case 0xb5:
-        $L = res($L, 6);
-        break;
-    case 0xb6:
-        write($HL, res(read($HL), 6));
-        break;
-    case 0xb7:
-        $A = res($A, 6);
-        break;
-    case 0xb8:
-        $B = res($B, 7);
-        break;
-    case 0xb9:
-        $C = res($C, 7);
-        break;
-    case 0xba:
-        $D = res($D, 7);
-        break;
-    case 0xbb:
-        $E = res($E, 7);
-        break;
-    case 0xbc:
-        $H = res($H, 7);
-        break;
-    case 0xbd:
-        $L = res($L, 7);
-        break;
-    case 0xbe:
-        write($HL, res(read($HL), 7));
-        break;
-    case 0xbf:
-        $A = res($A, 7);
-        break;
-    case 0xc0:
-        $B = set($B, 0);
-        break;
-    case 0xc1:
-        $C = set($C, 0);
-        break;
-    case 0xc2:
-        $D = set($D, 0);
-        break;
-    case 0xc3:
-        $E = set($E, 0);
-        break;
-    case 0xc4:
-        $H = set($H, 0);
-        break;
-    case 0xc5:
-        $L = set($L, 0);
-        break;
-    case 0xc6:
-        write($HL, set(read($HL), 0));
-        break;
-    case 0xc7:
-        $A = set($A, 0);
-        break;
-    case 0xc8:
-        $B = set($B, 1);
-        break;
-    case 0xc9:
-        $C = set($C, 1);
-        break;
-    case 0xca:
-        $D = set($D, 1);
-        break;
-    case 0xcb:
-        $E = set($E, 1);
-        break;
-    case 0xcc:
-        $H = set($H, 1);
-        break;
-    case 0xcd:
-        $L = set($L, 1);
-        break;
-    case 0xce:
-        write($HL, set(read($HL), 1));
-        break;
-    case 0xcf:
-        $A = set($A, 1);
-        break;
-    case 0xd0:
-        $B = set($B, 2);
-        break;
-    case 0xd1:
-        $C = set($C, 2);
-        break;
-    case 0xd2:
-        $D = set($D, 2);
-        break;
-    case 0xd3:
-        $E = set($E, 2);
-        break;
-    case 0xd4:
-        $H = set($H, 2);
-        break;
-    case 0xd5:
-        $L = set($L, 2);
-        break;
-    case 0xd6:
-        write($HL, set(read($HL), 2));
-        break;
-    case 0xd7:
-        $A = set($A, 2);
-        break;
-    case 0xd8:
-        $B = set($B, 3);
-        break;
-    case 0xd9:
-        $C = set($C, 3);
-        break;
-    case 0xda:
-        $D = set($D, 3);
-        break;
-    case 0xdb:
-        $E = set($E, 3);
-        break;
-    case 0xdc:
-        $H = set($H, 3);
-        break;
-    case 0xdd:
-        $L = set($L, 3);
-        break;
-    case 0xde:
-        write($HL, set(read($HL), 3));
-        break;
-    case 0xdf:
-        $A = set($A, 3);
-        break;
-    case 0xe0:
-        $B = set($B, 4);
-        break;
-    case 0xe1:
-        $C = set($C, 4);
-        break;
-    case 0xe2:
-        $D = set($D, 4);
-        break;
-    case 0xe3:
-        $E = set($E, 4);
-        break;
-    case 0xe4:
-        $H = set($H, 4);
-        break;
-    case 0xe5:
-        $L = set($L, 4);
-        break;
-    case 0xe6:
-        write($HL, set(read($HL), 4));
-        break;
-    case 0xe7:
-        $A = set($A, 4);
-        break;
-    case 0xe8:
-        $B = set($B, 5);
-        break;
-    case 0xe9:
-        $C = set($C, 5);
-        break;
-    case 0xea:
-        $D = set($D, 5);
-        break;
-    case 0xeb:
-        $E = set($E, 5);
-        break;
-    case 0xec:
-        $H = set($H, 5);
-        break;
-    case 0xed:
-        $L = set($L, 5);
-        break;
-    case 0xee:
-        write($HL, set(read($HL), 5));
-        break;
-    case 0xef:
-        $A = set($A, 5);
-        break;
-    case 0xf0:
-        $B = set($B, 6);
-        break;
-    case 0xf1:
-        $C = set($C, 6);
-        break;
-    case 0xf2:
-        $D = set($D, 6);
-        break;
-    case 0xf3:
-        $E = set($E, 6);
-        break;
-    case 0xf4:
-        $H = set($H, 6);
-        break;
-    case 0xf5:
-        $L = set($L, 6);
-        break;
-    case 0xf6:
-        write($HL, set(read($HL), 6));
-        break;
-    case 0xf7:
-        $A = set($A, 6);
-        break;
-    case 0xf8:
-        $B = set($B, 7);
-        break;
-    case 0xf9:
-        $C = set($C, 7);
-        break;
-    case 0xfa:
-        $D = set($D, 7);
-        break;
-    case 0xfb:
-        $E = set($E, 7);
-        break;
-    case 0xfc:
-        $H = set($H, 7);
-        break;
-    case 0xfd:
-        $L = set($L, 7);
-        break;
-    case 0xfe:
-        write($HL, set(read($HL), 7));
-        break;
-    case 0xff:
-        $A = set($A, 7);
-        break;
+ * Z: Set if result is 0 (unless `isA` is true, then Z is 0).
+ * N: Reset (0).
+ * H: Reset (0).
+ * C: Set to the value of bit 0 of the original `x`.
+ * @param x The 8-bit value to rotate.
+ * @param carry True for RRC (rotate right through carry), false for RR (rotate right).
+ * @param isA True if the operation is on register A (RRCA/RRA), affects Z flag.
+ * @return The 8-bit result of the rotation.
+ */
+uint8_t Machine::rr(uint8_t x, bool carry, bool isA) {
+    uint8_t res = (x >> 1) | ((carry ? x & 1 : carryFlag()) << 7);
+
+#ifdef GB_LAZY_FLAGS
+    deferFlags(isA ? LazyOp::ShiftA : LazyOp::Shift, x, x & 1, 0, res);
+#else
+    $Z = isA ? 0 : !res;
+
+    $N = 0; $HF = 0; $CR = x & 1;
+#endif
+
+    return res;
+}
+
+/**
+ * @brief Rotates an 8-bit value right (not specific to register A).
+ * Calls `rr(x, carry, false)`.
+ * @param x The 8-bit value to rotate.
+ * @param carry True for RRC, false for RR.
+ * @return The 8-bit result of the rotation.
+ */
+uint8_t Machine::rr(uint8_t x, bool carry) {
+    return rr(x, carry, false);
+}
+
+/**
+ * @brief Tests a specific bit of an 8-bit value.
+ * Updates Z, N, H flags. C flag is not affected.
+ * Z: Set if the tested bit is 0.
+ * N: Reset (0).
+ * H: Set (1).
+ * @param x The 8-bit value to test.
+ * @param pos The bit position to test (0-7).
+ */
+void Machine::test(uint8_t x, int pos) {
+    $Z = ((x >> pos) & 1) == 0; $N = 0; $HF = 1;
+}
+
+/**
+ * @brief Sets a specific bit of an 8-bit value to 1.
+ * Flags are not affected.
+ * @param x The 8-bit value.
+ * @param pos The bit position to set (0-7).
+ * @return The 8-bit value with the specified bit set.
+ */
+uint8_t Machine::set(uint8_t x, int pos) {
+    return x | (1 << pos);
+}
+
+/**
+ * @brief Resets (clears) a specific bit of an 8-bit value to 0.
+ * Flags are not affected.
+ * @param x The 8-bit value.
+ * @param pos The bit position to reset (0-7).
+ * @return The 8-bit value with the specified bit reset.
+ */
+uint8_t Machine::res(uint8_t x, int pos) {
+    return x & (~(1 << pos));
+}
+
+/**
+ * @brief Returns a reference to the 8-bit register selected by a CB opcode's low three bits.
+ * @tparam R Register index: 0=B, 1=C, 2=D, 3=E, 4=H, 5=L, 7=A ((HL) = 6 has no register).
+ * @return Reference to the register byte.
+ */
+template<int R>
+uint8_t& Machine::reg8() {
+    static_assert(R != 6, "(HL) is a memory operand");
+
+    static constexpr uint8_t CPUState::* regs[] = {
+        &CPUState::b, &CPUState::c, &CPUState::d, &CPUState::e, &CPUState::h, &CPUState::l, nullptr, &CPUState::a
+    };
+
+    return cpu.*regs[R];
+}
+
+/**
+ * @brief Applies the rotate/shift/RES/SET part of a CB-prefixed opcode to a value.
+ * The operation is decoded at compile time: group `OP >> 6` (0 = rotate/shift,
+ * 2 = RES, 3 = SET) and bit/sub-operation `(OP >> 3) & 7`.
+ * @tparam OP The CB-prefixed opcode (not a BIT opcode).
+ * @param x The operand value.
+ * @return The result to write back.
+ */
+template<uint8_t OP>
+uint8_t Machine::prefixOperation(uint8_t x) {
+    constexpr int group = OP >> 6;
+    constexpr int bit = (OP >> 3) & 7;
+
+    if constexpr (group == 2) {
+        return res(x, bit);
+    }
+    else if constexpr (group == 3) {
+        return set(x, bit);
+    }
+    else if constexpr (bit == 0) {
+        return rl(x, true);
+    }
+    else if constexpr (bit == 1) {
+        return rr(x, true);
+    }
+    else if constexpr (bit == 2) {
+        return rl(x, false);
+    }
+    else if constexpr (bit == 3) {
+        return rr(x, false);
+    }
+    else if constexpr (bit == 4) {
+        return sl(x);
+    }
+    else if constexpr (bit == 5) {
+        return sr(x, false);
+    }
+    else if constexpr (bit == 6) {
+        return swap(x);
+    }
+    else {
+        return sr(x, true);
+    }
+}
+
+/**
+ * @brief Executes a fixed CB-prefixed opcode.
+ * CB opcodes are fully regular: the operand is `OP & 7`, the bit index (or
+ * rotate/shift kind) is `(OP >> 3) & 7` and the operation group is `OP >> 6`
+ * (0 = rotate/shift, 1 = BIT, 2 = RES, 3 = SET). The (HL) operand variants
+ * read and write memory instead of a register.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @tparam OP The 8-bit CB-prefixed opcode.
+ */
+template<class M, uint8_t OP>
+void Machine::executePrefixOp() {
+    constexpr int r = OP & 7;
+    constexpr int group = OP >> 6;
+    constexpr int bit = (OP >> 3) & 7;
+
+    if constexpr (r == 6) {
+        if constexpr (group == 1) {
+            test(read<M>($HL), bit);
+        }
+        else {
+            write<M>($HL, prefixOperation<OP>(read<M>($HL)));
+        }
+    }
+    else {
+        if constexpr (group == 1) {
+            test(reg8<r>(), bit);
+        }
+        else {
+            reg8<r>() = prefixOperation<OP>(reg8<r>());
+        }
     }
 }
 
-uint8_t executeOp(uint8_t op) {
+/**
+ * @brief Executes a CB-prefixed opcode.
+ * These opcodes are typically bit manipulation, shift, and rotate instructions.
+ * Dispatches through a table of `executePrefixOp<OP>` instantiations.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @param op The 8-bit CB-prefixed opcode.
+ */
+template<class M>
+inline void Machine::executePrefixOp(uint8_t op) {
+    using PrefixHandler = void (Machine::*)();
+
+    static constexpr PrefixHandler handlers[256] = {
+#define GB_PREFIX_HANDLER_ADDR(n) &Machine::executePrefixOp<M, n>,
+        GB_OPCODES(GB_PREFIX_HANDLER_ADDR)
+#undef GB_PREFIX_HANDLER_ADDR
+    };
+
+    (this->*handlers[op])();
+}
+
+/**
+ * @brief Executes a non-prefixed opcode; shared body of every dispatch mode.
+ * Always inlined, so when `op` is a compile-time constant (see `executeOp<OP>`)
+ * the switch folds down to the single case being executed.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @tparam Decoded Whether immediates come from the pre-decoded `decoded` instead of memory.
+ * @param op The 8-bit opcode to execute.
+ * @return The number of M-cycles the instruction took.
+ */
+template<class M, bool Decoded>
+GB_ALWAYS_INLINE uint8_t Machine::execute(uint8_t op) {
     bool imm_ime = false;
     uint8_t c = cycles[op];
     
@@ -1256,10 +773,10 @@ uint8_t executeOp(uint8_t op) {
     case 0x0:
         break;
     case 0x01:
-        $BC = read16(++$PC); $PC++;
+        $BC = imm16<M, Decoded>(); $PC++;
         break;
     case 0x02:
-        write($BC, $A);
+        write<M>($BC, $A);
         break;
     case 0x03:
         $BC = inc($BC);
@@ -1271,23 +788,23 @@ uint8_t executeOp(uint8_t op) {
         $B = dec($B);
         break;
     case 0x06:
-        $B = read(++$PC);
+        $B = imm8<M, Decoded>();
         break;
     case 0x07:
         $A = rl($A, true, true);
         break;
     case 0x08:
     {
-        uint16_t nn = read16(++$PC); $PC++;
-        write(nn, (registers[5].bytes.lo));
-        write(nn + 1, (registers[5].bytes.hi));
+        uint16_t nn = imm16<M, Decoded>(); $PC++;
+        write<M>(nn, $SP & 0xFF);
+        write<M>(nn + 1, $SP >> 8);
     }
     break;
     case 0x09:
         $HL = add($HL, $BC);
         break;
     case 0x0A:
-        $A = read($BC);
+        $A = read<M>($BC);
         break;
     case 0x0B:
         $BC = dec($BC);
@@ -1299,7 +816,7 @@ uint8_t executeOp(uint8_t op) {
         $C = dec($C);
         break;
     case 0x0E:
-        $C = read(++$PC);
+        $C = imm8<M, Decoded>();
         break;
     case 0x0F:
         $A = rr($A, true, true);
@@ -1307,10 +824,10 @@ uint8_t executeOp(uint8_t op) {
         // case 0x10:
             // TODO: STOP
     case 0x11:
-        $DE = read16(++$PC); $PC++;
+        $DE = imm16<M, Decoded>(); $PC++;
         break;
     case 0x12:
-        write($DE, $A);
+        write<M>($DE, $A);
         break;
     case 0x13:
         $DE = inc($DE);
@@ -1322,19 +839,19 @@ uint8_t executeOp(uint8_t op) {
         $D = dec($D);
         break;
     case 0x16:
-        $D = read(++$PC);
+        $D = imm8<M, Decoded>();
         break;
     case 0x17:
         $A = rl($A, false, true);
         break;
     case 0x18:
-        $PC += (int8_t)read(++$PC);
+        $PC += (int8_t)imm8<M, Decoded>();
         break;
     case 0x19:
         $HL = add($HL, $DE);
         break;
     case 0x1A:
-        $A = read($DE);
+        $A = read<M>($DE);
         break;
     case 0x1B:
         $DE = dec($DE);
@@ -1346,26 +863,26 @@ uint8_t executeOp(uint8_t op) {
         $E = dec($E);
         break;
     case 0x1E:
-        $E = read(++$PC);
+        $E = imm8<M, Decoded>();
         break;
     case 0x1F:
         $A = rr($A, false, true);
         break;
     case 0x20:
     {
-        int8_t n = read(++$PC);
+        int8_t n = imm8<M, Decoded>();
 
-        if (!$Z) {
+        if (!zeroFlag()) {
             $PC += n;
             c++;
         }
     }
     break;
     case 0x21:
-        $HL = read16(++$PC); $PC++;
+        $HL = imm16<M, Decoded>(); $PC++;
         break;
     case 0x22:
-        write($HL, $A);
+        write<M>($HL, $A);
         ++$HL;
         break;
     case 0x23:
@@ -1378,9 +895,19 @@ uint8_t executeOp(uint8_t op) {
         $H = dec($H);
         break;
     case 0x26:
-        $H = read(++$PC);
+        $H = imm8<M, Decoded>();
         break;
     case 0x27:
+#ifdef GB_ALU_TABLES
+    {
+        CPUState& state = flags();
+        uint16_t af = Alu::tables.daa[state.nf << 2 | state.hf << 1 | state.cf][$A];
+
+        $A = af;
+        state.setF(af >> 8);
+    }
+    break;
+#else
     {
         uint8_t correction = 0;
 
@@ -1412,11 +939,12 @@ uint8_t executeOp(uint8_t op) {
          $N = n; $CR = (correction & 0x60) != 0; $Z = !$A; $HF = 0;
     }
     break;
+#endif
     case 0x28:
     {
-        int8_t n = read(++$PC);
+        int8_t n = imm8<M, Decoded>();
 
-        if ($Z) {
+        if (zeroFlag()) {
             $PC += n;
             c++;
         }
@@ -1426,7 +954,7 @@ uint8_t executeOp(uint8_t op) {
         $HL = add($HL, $HL);
         break;
     case 0x2A:
-        $A = read($HL);
+        $A = read<M>($HL);
         ++$HL;
         break;
     case 0x2B:
@@ -1439,48 +967,48 @@ uint8_t executeOp(uint8_t op) {
         $L = dec($L);
         break;
     case 0x2E:
-        $L = read(++$PC);
+        $L = imm8<M, Decoded>();
         break;
     case 0x2F:
         $A = ~$A; $N = 1; $HF = 1;
         break;
     case 0x30:
     {
-        int8_t n = read(++$PC);
+        int8_t n = imm8<M, Decoded>();
 
-        if (!$CR) {
+        if (!carryFlag()) {
             $PC += n;
             c++;
         }
     }
     break;
     case 0x31:
-        $SP = read16(++$PC); $PC++;
+        $SP = imm16<M, Decoded>(); $PC++;
         break;
     case 0x32:
-        write($HL, $A);
+        write<M>($HL, $A);
         --$HL;
         break;
     case 0x33:
         $SP = inc($SP);
         break;
     case 0x34:
-        write($HL, inc(read($HL)));
+        write<M>($HL, inc(read<M>($HL)));
         break;
     case 0x35:
-        write($HL, dec(read($HL)));
+        write<M>($HL, dec(read<M>($HL)));
         break;
     case 0x36:
-        write($HL, read(++$PC));
+        write<M>($HL, imm8<M, Decoded>());
         break;
     case 0x37:
         $N = 0; $HF = 0; $CR = 1;
         break;
     case 0x38:
     {
-        int8_t n = read(++$PC);
+        int8_t n = imm8<M, Decoded>();
 
-        if ($CR) {
+        if (carryFlag()) {
             $PC += n;
             c++;
         }
@@ -1490,7 +1018,7 @@ uint8_t executeOp(uint8_t op) {
         $HL = add($HL, $SP);
         break;
     case 0x3A:
-        $A = read($HL);
+        $A = read<M>($HL);
         --$HL;
         break;
     case 0x3B:
@@ -1503,10 +1031,10 @@ uint8_t executeOp(uint8_t op) {
         $A = dec($A);
         break;
     case 0x3E:
-        $A = read(++$PC);
+        $A = imm8<M, Decoded>();
         break;
     case 0x3F:
-        $N = 0; $HF = 0; $CR = ~$CR;
+        $N = 0; $HF = 0; $CR = !$CR;
         break;
     case 0x40:
         $B = $B;
@@ -1527,7 +1055,7 @@ uint8_t executeOp(uint8_t op) {
         $B = $L;
         break;
     case 0x46:
-        $B = read($HL);
+        $B = read<M>($HL);
         break;
     case 0x47:
         $B = $A;
@@ -1551,7 +1079,7 @@ uint8_t executeOp(uint8_t op) {
         $C = $L;
         break;
     case 0x4E:
-        $C = read($HL);
+        $C = read<M>($HL);
         break;
     case 0x4F:
         $C = $A;
@@ -1575,7 +1103,7 @@ uint8_t executeOp(uint8_t op) {
         $D = $L;
         break;
     case 0x56:
-        $D = read($HL);
+        $D = read<M>($HL);
         break;
     case 0x57:
         $D = $A;
@@ -1599,7 +1127,7 @@ uint8_t executeOp(uint8_t op) {
         $E = $L;
         break;
     case 0x5E:
-        $E = read($HL);
+        $E = read<M>($HL);
         break;
     case 0x5F:
         $E = $A;
@@ -1623,7 +1151,7 @@ uint8_t executeOp(uint8_t op) {
         $H = $L;
         break;
     case 0x66:
-        $H = read($HL);
+        $H = read<M>($HL);
         break;
     case 0x67:
         $H = $A;
@@ -1647,34 +1175,35 @@ uint8_t executeOp(uint8_t op) {
         $L = $L;
         break;
     case 0x6E:
-        $L = read($HL);
+        $L = read<M>($HL);
         break;
     case 0x6F:
         $L = $A;
         break;
     case 0x70:
-        write($HL, $B);
+        write<M>($HL, $B);
         break;
     case 0x71:
-        write($HL, $C);
+        write<M>($HL, $C);
         break;
     case 0x72:
-        write($HL, $D);
+        write<M>($HL, $D);
         break;
     case 0x73:
-        write($HL, $E);
+        write<M>($HL, $E);
         break;
     case 0x74:
-        write($HL, $H);
+        write<M>($HL, $H);
         break;
     case 0x75:
-        write($HL, $L);
+        write<M>($HL, $L);
         break;
     case 0x76:
         halted = true;
+        pollInterrupts();
         break;
     case 0x77:
-        write($HL, $A);
+        write<M>($HL, $A);
         break;
     case 0x78:
         $A = $B;
@@ -1695,7 +1224,7 @@ uint8_t executeOp(uint8_t op) {
         $A = $L;
         break;
     case 0x7E:
-        $A = read($HL);
+        $A = read<M>($HL);
         break;
     case 0x7F:
         $A = $A;
@@ -1719,7 +1248,7 @@ uint8_t executeOp(uint8_t op) {
         $A = add($A, $L);
         break;
     case 0x86:
-        $A = add($A, read($HL));
+        $A = add($A, read<M>($HL));
         break;
     case 0x87:
         $A = add($A, $A);
@@ -1743,7 +1272,7 @@ uint8_t executeOp(uint8_t op) {
         $A = add($A, $L, true);
         break;
     case 0x8E:
-        $A = add($A, read($HL), true);
+        $A = add($A, read<M>($HL), true);
         break;
     case 0x8F:
         $A = add($A, $A, true);
@@ -1767,7 +1296,7 @@ uint8_t executeOp(uint8_t op) {
         $A = sub($A, $L);
         break;
     case 0x96:
-        $A = sub($A, read($HL));
+        $A = sub($A, read<M>($HL));
         break;
     case 0x97:
         $A = sub($A, $A);
@@ -1791,7 +1320,7 @@ uint8_t executeOp(uint8_t op) {
         $A = sub($A, $L, true);
         break;
     case 0x9E:
-        $A = sub($A, read($HL), true);
+        $A = sub($A, read<M>($HL), true);
         break;
     case 0x9F:
         $A = sub($A, $A, true);
@@ -1815,7 +1344,7 @@ uint8_t executeOp(uint8_t op) {
         $A = and8($A, $L);
         break;
     case 0xA6:
-        $A = and8($A, read($HL));
+        $A = and8($A, read<M>($HL));
         break;
     case 0xA7:
         $A = and8($A, $A);
@@ -1839,7 +1368,7 @@ uint8_t executeOp(uint8_t op) {
         $A = xor8($A, $L);
         break;
     case 0xAE:
-        $A = xor8($A, read($HL));
+        $A = xor8($A, read<M>($HL));
         break;
     case 0xAF:
         $A = xor8($A, $A);
@@ -1863,7 +1392,7 @@ uint8_t executeOp(uint8_t op) {
         $A = or8($A, $L);
         break;
     case 0xB6:
-        $A = or8($A, read($HL));
+        $A = or8($A, read<M>($HL));
         break;
     case 0xB7:
         $A = or8($A, $A);
@@ -1887,40 +1416,40 @@ uint8_t executeOp(uint8_t op) {
         sub($A, $L);
         break;
     case 0xBE:
-        sub($A, read($HL));
+        sub($A, read<M>($HL));
         break;
     case 0xBF:
         sub($A, $A);
         break;
     case 0xC0:
-        if (!$Z) {
-            $PC = read16($SP++); $SP++; $PC--;
+        if (!zeroFlag()) {
+            $PC = read16<M>($SP++); $SP++; $PC--;
             c += 3;
         }
         break;
     case 0xC1:
-        $BC = read16($SP++); $SP++;
+        $BC = read16<M>($SP++); $SP++;
         break;
     case 0xC2:
     {
-        uint16_t nn = read16(++$PC); $PC++;
+        uint16_t nn = imm16<M, Decoded>(); $PC++;
 
-        if (!$Z) {
+        if (!zeroFlag()) {
             $PC = nn; $PC--;
             c++;
         }
     }
     break;
     case 0xC3:
-        $PC = read16(++$PC); $PC--;
+        $PC = imm16<M, Decoded>(); $PC--;
         break;
     case 0xC4:
     {
-        uint16_t nn = read16(++$PC); $PC+=2;
+        uint16_t nn = imm16<M, Decoded>(); $PC+=2;
 
-        if (!$Z) {
-            write(--$SP, registers[4].bytes.hi);
-            write(--$SP, registers[4].bytes.lo);
+        if (!zeroFlag()) {
+            write<M>(--$SP, $PC >> 8);
+            write<M>(--$SP, $PC & 0xFF);
             $PC = nn;
             c += 3;
         }
@@ -1929,32 +1458,32 @@ uint8_t executeOp(uint8_t op) {
     }
     break;
     case 0xC5:
-        write(--$SP, $B);
-        write(--$SP, $C);
+        write<M>(--$SP, $B);
+        write<M>(--$SP, $C);
         break;
     case 0xC6:
-        $A = add($A, read(++$PC));
+        $A = add($A, imm8<M, Decoded>());
         break;
     case 0xC7:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x00;  $PC--;
         break;
     case 0xC8:
-        if ($Z) {
-            $PC = read16($SP++); $SP++; $PC--;
+        if (zeroFlag()) {
+            $PC = read16<M>($SP++); $SP++; $PC--;
             c += 3;
         }
         break;
     case 0xC9:
-        $PC = read16($SP++); $SP++; $PC--;
+        $PC = read16<M>($SP++); $SP++; $PC--;
         break;
     case 0xCA:
     {
-        uint16_t nn = read16(++$PC); $PC++;
+        uint16_t nn = imm16<M, Decoded>(); $PC++;
 
-        if ($Z) {
+        if (zeroFlag()) {
             $PC = nn; $PC--;
             c++;
         }
@@ -1962,18 +1491,18 @@ uint8_t executeOp(uint8_t op) {
     break;
     case 0xCB:
     {
-        uint8_t code = read(++$PC);
-        executePrefixOp(code);
-        c = cb_cycles[code];
+        uint8_t code = imm8<M, Decoded>();
+        executePrefixOp<M>(code);
+        c = Decoded ? decoded->cycles : cb_cycles[code];
     }
         break;
     case 0xCC:
     {
-        uint16_t nn = read16(++$PC); $PC+=2;
+        uint16_t nn = imm16<M, Decoded>(); $PC+=2;
 
-        if ($Z) {
-            write(--$SP, registers[4].bytes.hi);
-            write(--$SP, registers[4].bytes.lo);
+        if (zeroFlag()) {
+            write<M>(--$SP, $PC >> 8);
+            write<M>(--$SP, $PC & 0xFF);
             $PC = nn;
             c += 3;
         }
@@ -1983,35 +1512,35 @@ uint8_t executeOp(uint8_t op) {
     break;
     case 0xCD:
     {
-        uint16_t nn = read16(++$PC); $PC += 2;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        uint16_t nn = imm16<M, Decoded>(); $PC += 2;
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = nn; $PC--;
     }
         break;
     case 0xCE:
-        $A = add($A, read(++$PC), true);
+        $A = add($A, imm8<M, Decoded>(), true);
         break;
     case 0xCF:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x07; //0x08
         break;
     case 0xD0:
-        if (!$CR) {
-            $PC = read16($SP++); $SP++; $PC--;
+        if (!carryFlag()) {
+            $PC = read16<M>($SP++); $SP++; $PC--;
             c += 3;
         }
         break;
     case 0xD1:
-        $DE = read16($SP++); $SP++;
+        $DE = read16<M>($SP++); $SP++;
         break;
     case 0xD2:
     {
-        uint16_t nn = read16(++$PC); $PC++;
+        uint16_t nn = imm16<M, Decoded>(); $PC++;
 
-        if (!$CR) {
+        if (!carryFlag()) {
             $PC = nn; $PC--;
             c++;
         }
@@ -2019,11 +1548,11 @@ uint8_t executeOp(uint8_t op) {
     break;
     case 0xD4:
     {
-        uint16_t nn = read16(++$PC); $PC+=2;
+        uint16_t nn = imm16<M, Decoded>(); $PC+=2;
 
-        if (!$CR) {
-            write(--$SP, registers[4].bytes.hi);
-            write(--$SP, registers[4].bytes.lo);
+        if (!carryFlag()) {
+            write<M>(--$SP, $PC >> 8);
+            write<M>(--$SP, $PC & 0xFF);
             $PC = nn;
             c += 3;
         }
@@ -2032,33 +1561,34 @@ uint8_t executeOp(uint8_t op) {
     }
     break;
     case 0xD5:
-        write(--$SP, $D);
-        write(--$SP, $E);
+        write<M>(--$SP, $D);
+        write<M>(--$SP, $E);
         break;
     case 0xD6:
-        $A = sub($A, read(++$PC));
+        $A = sub($A, imm8<M, Decoded>());
         break;
     case 0xD7:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x0F; //0x10
         break;
     case 0xD8:
-        if ($CR) {
-            $PC = read16($SP++); $SP++; $PC--;
+        if (carryFlag()) {
+            $PC = read16<M>($SP++); $SP++; $PC--;
             c += 3;
         }
         break;
     case 0xD9:
-        $PC = read16($SP++); $SP++; $PC--;
+        $PC = read16<M>($SP++); $SP++; $PC--;
         IME = true;
+        pollInterrupts();
         break;
     case 0xDA:
     {
-        uint16_t nn = read16(++$PC); $PC++;
+        uint16_t nn = imm16<M, Decoded>(); $PC++;
 
-        if ($CR) {
+        if (carryFlag()) {
             $PC = nn; $PC--;
             c++;
         }
@@ -2066,11 +1596,11 @@ uint8_t executeOp(uint8_t op) {
     break;
     case 0xDC:
     {
-        uint16_t nn = read16(++$PC); $PC+=2;
+        uint16_t nn = imm16<M, Decoded>(); $PC+=2;
 
-        if ($CR) {
-            write(--$SP, registers[4].bytes.hi);
-            write(--$SP, registers[4].bytes.lo);
+        if (carryFlag()) {
+            write<M>(--$SP, $PC >> 8);
+            write<M>(--$SP, $PC & 0xFF);
             $PC = nn;
             c += 3;
         }
@@ -2079,98 +1609,98 @@ uint8_t executeOp(uint8_t op) {
     }
     break;
     case 0xDE:
-        $A = sub($A, read(++$PC), true);
+        $A = sub($A, imm8<M, Decoded>(), true);
         break;
     case 0xDF:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x17; //0x18
         break;
     case 0xE0:
-        write(0xFF00 + read(++$PC), $A);
+        write<M>(0xFF00 + imm8<M, Decoded>(), $A);
         break;
     case 0xE1:
-        $HL = read16($SP++); $SP++;
+        $HL = read16<M>($SP++); $SP++;
         break;
     case 0xE2:
-        write(0xFF00 + $C, $A);
+        write<M>(0xFF00 + $C, $A);
         break;
     case 0xE5:
-        write(--$SP, $H);
-        write(--$SP, $L);
+        write<M>(--$SP, $H);
+        write<M>(--$SP, $L);
         break;
     case 0xE6:
-        $A = and8($A, read(++$PC));
+        $A = and8($A, imm8<M, Decoded>());
         break;
     case 0xE7:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x1F; //0x20
         break;
     case 0xE8:
-        $SP = add($SP, read(++$PC));
+        $SP = add($SP, imm8<M, Decoded>());
         break;
     case 0xE9:
         $PC = $HL; $PC--;
         break;
     case 0xEA:
-        write(read16(++$PC), $A); $PC++;
+        write<M>(imm16<M, Decoded>(), $A); $PC++;
         break;
     case 0xEE:
-        $A = xor8($A, read(++$PC));
+        $A = xor8($A, imm8<M, Decoded>());
         break;
     case 0xEF:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x27; //0x28
         break;
     case 0xF0:
-        $A = read(0xFF00 + read(++$PC));
+        $A = read<M>(0xFF00 + imm8<M, Decoded>());
         break;
     case 0xF1:
-        $AF = read16($SP++) & 0xfff0; $SP++;
+        flags().setAF(read16<M>($SP++)); $SP++;
         break;
     case 0xF2:
-        $A = read($C + 0xFF00);
+        $A = read<M>($C + 0xFF00);
         break;
     case 0xF3:
         ime_sched = IME = false;
         break;
     case 0xF5:
-        write(--$SP, $A);
-        write(--$SP, $F);
+        write<M>(--$SP, $A);
+        write<M>(--$SP, $F);
         break;
     case 0xF6:
-        $A = or8($A, read(++$PC));
+        $A = or8($A, imm8<M, Decoded>());
         break;
     case 0xF7:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x2F; //0x30
         break;
     case 0xF8:
-        $HL = add($SP, read(++$PC));
+        $HL = add($SP, imm8<M, Decoded>());
         break;
     case 0xF9:
         $SP = $HL;
         break;
     case 0xFA:
-        $A = read(read16(++$PC)); $PC++;
+        $A = read<M>(imm16<M, Decoded>()); $PC++;
         break;
     case 0xFB:
         imm_ime = ime_sched = true;
         break;
     case 0xFE:
-        sub($A, read(++$PC));
+        sub($A, imm8<M, Decoded>());
         break;
     case 0xFF:
         $PC++;
-        write(--$SP, registers[4].bytes.hi);
-        write(--$SP, registers[4].bytes.lo);
+        write<M>(--$SP, $PC >> 8);
+        write<M>(--$SP, $PC & 0xFF);
         $PC = 0x37; // 0x38
         break;
     }
@@ -2178,7 +1708,594 @@ uint8_t executeOp(uint8_t op) {
     if (!imm_ime && ime_sched) {
         IME = true;
         ime_sched = false;
+        pollInterrupts();
     }
 
     return c;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Executes a non-prefixed opcode through the switch.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @param op The 8-bit opcode to execute.
+ * @return The number of M-cycles the instruction took.
+ */
+template<class M>
+uint8_t Machine::executeOp(uint8_t op) {
+    return execute<M>(op);
+}
+
+/**
+ * @brief Executes a fixed non-prefixed opcode.
+ * Each instantiation is `execute` specialised for a single opcode, which is
+ * what the threaded dispatch jumps between.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @tparam OP The 8-bit opcode to execute.
+ * @tparam Decoded Whether immediates come from the pre-decoded `decoded` (cached dispatch).
+ * @return The number of M-cycles the instruction took.
+ */
+template<class M, uint8_t OP, bool Decoded>
+uint8_t Machine::executeOp() {
+    return execute<M, Decoded>(OP);
+}
+
+/**
+ * @brief Runs instructions with threaded dispatch until a target is reached or the CPU halts.
+ *
+ * With GCC/Clang every opcode handler ends in its own indirect jump to the
+ * next opcode's handler (computed goto), giving the branch predictor one
+ * history per opcode instead of a single shared jump-table branch. Other
+ * compilers fall back to a loop over a table of per-opcode handlers.
+ *
+ * Between instructions the only check is the clock against the next scheduled
+ * event. The run targets are tested after events only, which is enough because
+ * everything that can end a run (the cycle target, a new frame, HALT) is one.
+ * Short backward jumps are also handed to `skipIdleLoop`, which fast-forwards
+ * loops that are only polling for one.
+ *
+ * @tparam M The concrete memory controller type of `memory`.
+ * @param cycle_target Stop once `total_cycles` reaches this value.
+ * @param frame_target Stop once the PPU has completed this many frames.
+ */
+template<class M>
+void Machine::runThreaded(uint64_t cycle_target, uint64_t frame_target) {
+#if defined(__GNUC__)
+    static void* const labels[256] = {
+#define GB_LABEL_ADDR(n) &&op_##n,
+        GB_OPCODES(GB_LABEL_ADDR)
+#undef GB_LABEL_ADDR
+    };
+
+#define GB_DISPATCH() \
+    if (total_cycles >= scheduler.next()) { \
+        runEvents<M>(); \
+        if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) { \
+            return; \
+        } \
+    } \
+    goto *labels[read<M>($PC)];
+
+    goto *labels[read<M>($PC)];
+
+#define GB_HANDLER(n) \
+op_##n: \
+    { \
+        uint16_t pc = $PC; \
+        uint8_t c = executeOp<M, n>(); \
+        $PC++; \
+        total_instructions++; \
+        total_cycles += c; \
+        if (loopedBack(n, pc)) { \
+            skipIdleLoop<M>(pc, UINT64_MAX); \
+        } \
+    } \
+    GB_DISPATCH();
+
+    GB_OPCODES(GB_HANDLER)
+#undef GB_HANDLER
+#undef GB_DISPATCH
+#else
+    using Handler = uint8_t (Machine::*)();
+
+    static constexpr Handler handlers[256] = {
+#define GB_HANDLER_ADDR(n) &Machine::executeOp<M, n>,
+        GB_OPCODES(GB_HANDLER_ADDR)
+#undef GB_HANDLER_ADDR
+    };
+
+    for (;;) {
+        uint16_t pc = $PC;
+        uint8_t op = read<M>(pc);
+        uint8_t c = (this->*handlers[op])();
+        $PC++;
+        total_instructions++;
+        total_cycles += c;
+
+        if (loopedBack(op, pc)) {
+            skipIdleLoop<M>(pc, UINT64_MAX);
+        }
+
+        if (total_cycles >= scheduler.next()) {
+            runEvents<M>();
+
+            if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) {
+                return;
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Runs instruction `OP` of a block compiled ahead of time, with the same
+ * bookkeeping as a handler of the cached dispatch. Inlined into the generated
+ * block functions, where `op` points at constant data so the operand folds in.
+ * @tparam M The concrete memory controller type of `memory`.
+ * @tparam OP The 8-bit opcode to execute.
+ * @param op The pre-decoded instruction.
+ * @return False if an event came due (this includes a bank switch or any
+ * other change to the code, through `Event::Code`).
+ */
+template<class M, uint8_t OP>
+GB_ALWAYS_INLINE bool Machine::recompiledStep(const DecodedOp* op) {
+    uint16_t pc = $PC;
+    decoded = op;
+    uint8_t c = execute<M, true>(OP);
+    $PC++;
+    total_instructions++;
+    total_cycles += c;
+
+    if (loopedBack(OP, pc)) {
+        skipIdleLoop<M>(pc, UINT64_MAX);
+    }
+
+    return total_cycles < scheduler.next();
+}
+
+template<class M>
+const std::vector<Recompiled::Entry> Recompiled::entries;
+
+// Blocks generated by gba_recomp, see recompiled.hpp
+#ifdef GB_RECOMPILED
+#include GB_RECOMPILED
+#else
+const uint32_t Recompiled::checksum = 0;
+const size_t Recompiled::size = 0;
+#endif
+
+template<class M>
+int32_t Recompiled::find(int64_t offset) {
+    auto it = std::lower_bound(entries<M>.begin(), entries<M>.end(), offset, [](const Entry& entry, int64_t offset) {
+        return entry.offset < offset;
+    });
+
+    if (it == entries<M>.end() || it->offset != offset || it - entries<M>.begin() > UINT16_MAX) {
+        return -1;
+    }
+
+    return int32_t(it - entries<M>.begin());
+}
+
+/**
+ * @brief Finds the block starting at `$PC`, decoding it on first use.
+ * Blocks in RAM make the memory controller watch their page for writes. Copy
+ * and fill loops get a `BULK_LOOP` op in front, and other ROM blocks compiled
+ * ahead of time a `RECOMPILED` op.
+ * @tparam M The concrete memory controller type of `memory`.
+ */
+template<class M>
+const DecodedOp* Machine::findBlock() {
+    uint16_t pc = $PC;
+
+    // OAM and the I/O registers change without the CPU writing them
+    if (pc >= 0xFE00 && pc < 0xFF80) {
+        return nullptr;
+    }
+
+    const uint8_t* code = static_cast<M*>(memory.get())->codeAddress(pc);
+
+    if (!code) {
+        return nullptr;
+    }
+
+    Block* block = blocks.find(code, pc);
+
+    if (!block) {
+        const uint8_t* page = pc >= 0x8000 ? code - (pc & 0xFF) : nullptr;
+
+        block = blocks.insert(code, pc, page, Block::decode(code, pc, 0x100 - (pc & 0xFF)));
+        LoopIdiom loop = block->loopIdiom();
+
+        if (page) {
+            memory->watchCode(pc);
+        }
+
+        if (loop.kind != LoopIdiom::None) {
+            uint8_t cycles = 0;
+
+            for (size_t i = 0; i + 2 < block->ops.size(); i++) {
+                cycles += block->ops[i].cycles;
+            }
+
+            block->ops.insert(block->ops.begin(), { Block::BULK_LOOP, uint16_t(loop.kind | loop.counter << 8), pc, cycles, uint8_t(block->ops.size() - 1) });
+        }
+        else if (!page && dispatch == Dispatch::Recompiled && recompiled_rom) {
+            int64_t offset = memory->romOffset(pc);
+            int32_t index = Recompiled::find<M>(offset);
+
+            // Blocks were compiled for bank 0 at 0x0000 and the other banks at 0x4000,
+            // not for bank 0 mapped at 0x4000 (MBC5)
+            if (index >= 0 && (offset < 0x4000) == (pc < 0x4000)) {
+                block->ops.insert(block->ops.begin(), { Block::RECOMPILED, uint16_t(index), pc, 0 });
+            }
+        }
+    }
+    else if (dispatch == Dispatch::Jit && !block->inRAM && ++block->runs == Jit::HOT_RUNS && Jit::available()) {
+        if (!jit) {
+            jit = std::make_unique<Jit>(memory.get());
+        }
+
+        jit->translate(*block);
+    }
+
+    return block->ops.size() > 1 ? block->ops.data() : nullptr;
+}
+
+/**
+ * @brief Checks whether `count` bytes from `addr`, walking up or down, can be read
+ * (or written) with nothing happening besides the access: their pages are mapped
+ * for it, or are OAM, whose slow path only stores, or tile data being written,
+ * which only marks decoded tiles stale. I/O registers, bank registers, watched
+ * code and disabled cartridge RAM all fail.
+ */
+static bool bulkAccessible(const Mem& memory, uint16_t addr, uint32_t count, bool write, bool down) {
+    while (count) {
+        bool mapped = write ? memory.hostWriteAddress(addr) != nullptr || memory.isTileData(addr) : memory.hostAddress(addr) != nullptr;
+
+        if (!mapped && (addr >> 8) != 0xFE) {
+            return false;
+        }
+
+        uint32_t chunk = std::min<uint32_t>(count, down ? (addr & 0xFF) + 1 : 0x100 - (addr & 0xFF));
+        addr = down ? addr - chunk : addr + chunk;
+        count -= chunk;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Runs a recognised copy or fill loop in bulk.
+ *
+ * The iterations only read and write memory without side effects (see
+ * `bulkAccessible`) and no event comes due while they run, so nothing can
+ * observe them one at a time: the memory is copied or filled a page at a time,
+ * the pointers and the counter move by the number of iterations and the
+ * clock by their exact cycles (the last `jr nz`, not taken, is a cycle
+ * shorter). The flags are those of the last iteration's `dec` or `or c`.
+ *
+ * @tparam M The concrete memory controller type of `memory`.
+ */
+template<class M>
+bool Machine::runBulkLoop() {
+    const DecodedOp& loop = *decoded;
+    auto kind = LoopIdiom::Kind(loop.operand & 0xFF);
+    auto counter = LoopIdiom::Counter(loop.operand >> 8);
+
+    if (ime_sched || total_cycles >= scheduler.next()) {
+        return false;
+    }
+
+    static constexpr uint8_t CPUState::* counters[] = { &CPUState::b, &CPUState::c, &CPUState::d, &CPUState::e };
+    uint16_t start = counter == LoopIdiom::BC ? uint16_t($BC) : cpu.*counters[counter];
+    uint32_t remaining = start ? start : (counter == LoopIdiom::BC ? 0x10000 : 0x100);
+
+    uint64_t period = loop.cycles + 3;
+    bool finish = remaining * period - 1 <= scheduler.next() - total_cycles;
+    uint32_t count = finish ? remaining : uint32_t((scheduler.next() - total_cycles) / period);
+
+    bool copy = kind == LoopIdiom::CopyHLToDE || kind == LoopIdiom::CopyDEToHL;
+    bool down = kind == LoopIdiom::FillDown;
+    uint16_t src = kind == LoopIdiom::CopyHLToDE ? uint16_t($HL) : uint16_t($DE);
+    uint16_t dst = kind == LoopIdiom::CopyHLToDE ? uint16_t($DE) : uint16_t($HL);
+
+    if (!count || (copy && !bulkAccessible(*memory, src, count, false, false)) || !bulkAccessible(*memory, dst, count, true, down)) {
+        return false;
+    }
+
+    M* mem = static_cast<M*>(memory.get());
+
+    for (uint32_t left = count; left; ) {
+        if (copy) {
+            uint32_t chunk = std::min({ left, 0x100u - (src & 0xFF), 0x100u - (dst & 0xFF) });
+            const uint8_t* from = mem->hostAddress(src);
+            uint8_t* to = mem->hostWriteAddress(dst);
+
+            // Overlapping copies go forwards a byte at a time like the loop
+            if (from && to && (from + chunk <= to || to + chunk <= from)) {
+                std::memcpy(to, from, chunk);
+                $A = to[chunk - 1];
+            }
+            else {
+                for (uint32_t i = 0; i < chunk; i++) {
+                    $A = read<M>(src + i);
+                    write<M>(dst + i, $A);
+                }
+            }
+
+            src += chunk;
+            dst += chunk;
+            left -= chunk;
+        }
+        else {
+            uint32_t chunk = std::min(left, down ? (dst & 0xFFu) + 1 : 0x100u - (dst & 0xFF));
+            uint16_t first = down ? dst - (chunk - 1) : dst;
+
+            if (uint8_t* to = mem->hostWriteAddress(first)) {
+                std::memset(to, $A, chunk);
+            }
+            else {
+                for (uint32_t i = 0; i < chunk; i++) {
+                    write<M>(first + i, $A);
+                }
+            }
+
+            dst = down ? dst - chunk : dst + chunk;
+            left -= chunk;
+        }
+    }
+
+    if (kind == LoopIdiom::CopyHLToDE) {
+        $HL = src;
+        $DE = dst;
+    }
+    else if (kind == LoopIdiom::CopyDEToHL) {
+        $DE = src;
+        $HL = dst;
+    }
+    else {
+        $HL = dst;
+    }
+
+    if (counter == LoopIdiom::BC) {
+        $BC = uint16_t(start - count);
+        $A = or8($B, $C);
+    }
+    else {
+        cpu.*counters[counter] = dec(uint8_t(start - count + 1));
+    }
+
+    // Every instruction of these loops is one byte long, except the `jr nz`
+    uint16_t bytes = (copy ? 3 : 1) + (counter == LoopIdiom::BC ? 3 : 1) + 2;
+
+    // `$PC` is still the loop's start, the address it runs at (`loop.pc` may be an alias of it)
+    if (finish) {
+        $PC += bytes;
+    }
+    total_cycles += count * period - finish;
+    total_instructions += uint64_t(count) * loop.span;
+    return true;
+}
+
+/**
+ * @brief Runs pre-decoded blocks with threaded dispatch until a target is reached or the CPU halts.
+ *
+ * Like `runThreaded`, but the next handler is picked from the running block
+ * instead of by fetching the opcode, and immediates come from the block too.
+ * A block ends with a sentinel whose handler looks up the block at `$PC`;
+ * events go back to the lookup too if they moved `$PC` (an interrupt) or the
+ * code changed under the block (`code_changed`, with `Event::Code` making the
+ * clock check fire right after the instruction that changed it). Code the
+ * cache cannot hold runs one instruction at a time through the switch.
+ * With the Jit dispatch, a `JIT_REGION` op runs the instructions after it as
+ * native code when they all finish before the next event, and steps into them
+ * otherwise. With the Recompiled dispatch, a `RECOMPILED` op runs the whole
+ * block through its function compiled ahead of time instead. A `BULK_LOOP` op
+ * runs a copy or fill loop in bulk, or steps into it when it cannot.
+ *
+ * @tparam M The concrete memory controller type of `memory`.
+ * @param cycle_target Stop once `total_cycles` reaches this value.
+ * @param frame_target Stop once the PPU has completed this many frames.
+ */
+template<class M>
+void Machine::runCached(uint64_t cycle_target, uint64_t frame_target) {
+#if defined(__GNUC__)
+    static void* const labels[Block::BULK_LOOP + 1] = {
+#define GB_LABEL_ADDR(n) &&op_##n,
+        GB_OPCODES(GB_LABEL_ADDR)
+#undef GB_LABEL_ADDR
+        &&lookup,
+        &&region,
+        &&recompiled,
+        &&bulk
+    };
+
+#define GB_DISPATCH() \
+    if (total_cycles >= scheduler.next()) { \
+        runEvents<M>(); \
+        if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) { \
+            return; \
+        } \
+        if (code_changed || $PC != decoded->pc) { \
+            goto lookup; \
+        } \
+    } \
+    goto *labels[decoded->op];
+
+lookup:
+    blocks.collect();
+    code_changed = false;
+    decoded = findBlock<M>();
+
+    if (decoded) {
+        goto *labels[decoded->op];
+    }
+
+    {
+        uint16_t pc = $PC;
+        uint8_t op = read<M>(pc);
+        uint8_t c = execute<M>(op);
+        $PC++;
+        total_instructions++;
+        total_cycles += c;
+
+        if (loopedBack(op, pc)) {
+            skipIdleLoop<M>(pc, UINT64_MAX);
+        }
+
+        if (total_cycles >= scheduler.next()) {
+            runEvents<M>();
+
+            if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) {
+                return;
+            }
+        }
+    }
+    goto lookup;
+
+region:
+    // Runs natively only if no event can come due before its last instruction
+    if (total_cycles + decoded->cycles <= scheduler.next() && !ime_sched) {
+        const DecodedOp* next = decoded + decoded->span + 1;
+
+        flags();
+        jit->run(decoded->operand, cpu);
+        $PC += next->pc - decoded->pc;
+        total_instructions += decoded->span;
+        total_cycles += decoded->cycles;
+        decoded = next;
+        GB_DISPATCH();
+    }
+
+    decoded++;
+    goto *labels[decoded->op];
+
+recompiled:
+    // Returns at the end of the block or as soon as an event is due, wherever `$PC` is then
+    Recompiled::run<M>(decoded->operand, *this);
+
+    if (total_cycles >= scheduler.next()) {
+        runEvents<M>();
+
+        if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) {
+            return;
+        }
+    }
+    goto lookup;
+
+bulk:
+    if (!runBulkLoop<M>()) {
+        decoded++;
+        goto *labels[decoded->op];
+    }
+
+    if (total_cycles >= scheduler.next()) {
+        runEvents<M>();
+
+        if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) {
+            return;
+        }
+    }
+    goto lookup;
+
+#define GB_HANDLER(n) \
+op_##n: \
+    { \
+        uint16_t pc = $PC; \
+        uint8_t c = executeOp<M, n, true>(); \
+        $PC++; \
+        total_instructions++; \
+        total_cycles += c; \
+        if (loopedBack(n, pc)) { \
+            skipIdleLoop<M>(pc, UINT64_MAX); \
+        } \
+    } \
+    decoded++; \
+    GB_DISPATCH();
+
+    GB_OPCODES(GB_HANDLER)
+#undef GB_HANDLER
+#undef GB_DISPATCH
+#else
+    using Handler = uint8_t (Machine::*)();
+
+    static constexpr Handler handlers[256] = {
+#define GB_HANDLER_ADDR(n) &Machine::executeOp<M, n, true>,
+        GB_OPCODES(GB_HANDLER_ADDR)
+#undef GB_HANDLER_ADDR
+    };
+
+    for (;;) {
+        blocks.collect();
+        code_changed = false;
+        decoded = findBlock<M>();
+
+        bool ran = false; // Whether a pseudo-op already ran the block, or as much of it as it could
+
+        if (decoded && decoded->op == Block::RECOMPILED) {
+            Recompiled::run<M>(decoded->operand, *this);
+            ran = true;
+        }
+        else if (decoded && decoded->op == Block::BULK_LOOP) {
+            ran = runBulkLoop<M>();
+            decoded += !ran;
+        }
+
+        if (ran) {
+            if (total_cycles >= scheduler.next()) {
+                runEvents<M>();
+
+                if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) {
+                    return;
+                }
+            }
+            continue;
+        }
+
+        while (!decoded || decoded->op != Block::BLOCK_END) {
+            uint16_t pc = $PC;
+            uint8_t op = decoded ? uint8_t(decoded->op) : read<M>(pc);
+            uint8_t c = decoded ? (this->*handlers[op])() : execute<M>(op);
+            $PC++;
+            total_instructions++;
+            total_cycles += c;
+
+            if (loopedBack(op, pc)) {
+                skipIdleLoop<M>(pc, UINT64_MAX);
+            }
+
+            if (!decoded) {
+                if (total_cycles >= scheduler.next()) {
+                    runEvents<M>();
+
+                    if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) {
+                        return;
+                    }
+                }
+                break;
+            }
+
+            decoded++;
+
+            if (total_cycles >= scheduler.next()) {
+                runEvents<M>();
+
+                if (halted || stopped || total_cycles >= cycle_target || ppu->frameCount() >= frame_target) {
+                    return;
+                }
+
+                if (code_changed || $PC != decoded->pc) {
+                    break;
+                }
+            }
+        }
+    }
+#endif
+}
+
+#define GB_INSTANTIATE_CPU(M) \
+    template uint8_t Machine::executeOp<M>(uint8_t); \
+    template void Machine::runThreaded<M>(uint64_t, uint64_t); \
+    template void Machine::runCached<M>(uint64_t, uint64_t);
+GB_MAPPERS(GB_INSTANTIATE_CPU)
+#undef GB_INSTANTIATE_CPU
@@ -1,14 +1,21 @@
 #ifndef OPCODES_H
 #define OPCODES_H
 
+#include <cstdint>
+
+/**
+ * @brief M-cycles taken by each non-prefixed opcode (branches not taken).
+ */
+extern const uint8_t cycles[256];
+
+/**
+ * @brief M-cycles taken by each CB-prefixed opcode, including the prefix.
+ */
+extern const uint8_t cb_cycles[256];
+
 /**
- * @brief Executes a non-prefixed Game Boy opcode.
- * Fetches operands if necessary, performs the operation, updates flags,
- * and returns the number of CPU cycles taken by the instruction.
- * Handles instruction timing, immediate IME scheduling, and CB prefix.
- * @param op The 8-bit opcode to execute.
- * @return The number of T-cycles the instruction took.
+ * @brief Length in bytes of each non-prefixed opcode with its immediate operand.
  */
-uint8_t executeOp(uint8_t op);
+extern const uint8_t lengths[256];
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,219 @@
+#include "pixels.hpp"
+
+#include <array>
+#include <cstring>
+
+#ifdef GB_PIXELS_X86_64
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/**
+ * @brief For every byte value, the bit of each pixel (bit 7 first) as a byte of its own.
+ * Two bitplanes interleave into colour numbers as `spread[lo] | spread[hi] << 1`
+ * on the 8 bytes as one 64-bit word: every byte is 0 or 1, so the shift never
+ * crosses into the next pixel, whatever the host byte order.
+ */
+constexpr std::array<std::array<uint8_t, 8>, 256> buildSpread() {
+    std::array<std::array<uint8_t, 8>, 256> spread{};
+
+    for (unsigned b = 0; b < 256; b++) {
+        for (unsigned x = 0; x < 8; x++) {
+            spread[b][x] = b >> (7 - x) & 1;
+        }
+    }
+
+    return spread;
+}
+
+constexpr auto spread = buildSpread();
+
+void decodeScalar(const uint8_t* data, uint8_t* colours) {
+    for (unsigned row = 0; row < 8; row++) {
+        uint64_t lo, hi;
+
+        std::memcpy(&lo, spread[data[row * 2]].data(), 8);
+        std::memcpy(&hi, spread[data[row * 2 + 1]].data(), 8);
+
+        uint64_t pixels = lo | hi << 1;
+        std::memcpy(colours + row * 8, &pixels, 8);
+    }
+}
+
+void mapScalar(const uint8_t* colours, unsigned count, uint8_t palette, uint8_t* rgba) {
+    for (unsigned i = 0; i < count; i++) {
+        std::memcpy(rgba + i * 4, Pixels::SHADES[palette >> (2 * colours[i]) & 3], 4);
+    }
+}
+
+#ifdef GB_PIXELS_X86_64
+/**
+ * @brief Returns the RGBA values of colours 0-3 under `palette`, as 32-bit words.
+ */
+std::array<int, 4> shadesOf(uint8_t palette) {
+    std::array<int, 4> shades;
+
+    for (unsigned c = 0; c < 4; c++) {
+        std::memcpy(&shades[c], Pixels::SHADES[palette >> (2 * c) & 3], 4);
+    }
+
+    return shades;
+}
+
+/**
+ * @brief Turns two rows of bitplane bytes spread out as `{ lo x8, hi x8 }` each into
+ * the colour numbers of their 16 pixels.
+ */
+__attribute__((target("sse2")))
+__m128i combineSSE2(__m128i row0, __m128i row1) {
+    const __m128i bits = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i weights = _mm_setr_epi8(1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2);
+
+    row0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(row0, bits), bits), weights);
+    row1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(row1, bits), bits), weights);
+
+    return _mm_or_si128(_mm_unpacklo_epi64(row0, row1), _mm_unpackhi_epi64(row0, row1));
+}
+
+__attribute__((target("sse2")))
+void decodeSSE2(const uint8_t* data, uint8_t* colours) {
+    __m128i tile = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+
+    // Unpacking a vector with itself doubles its bytes: three rounds spread each row out
+    // as its low bitplane byte 8 times, then its high one 8 times
+    for (int half = 0; half < 2; half++) {
+        __m128i rows = half ? _mm_unpackhi_epi8(tile, tile) : _mm_unpacklo_epi8(tile, tile);
+
+        for (int pair = 0; pair < 2; pair++) {
+            __m128i two = pair ? _mm_unpackhi_epi16(rows, rows) : _mm_unpacklo_epi16(rows, rows);
+            __m128i out = combineSSE2(_mm_unpacklo_epi32(two, two), _mm_unpackhi_epi32(two, two));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(colours + half * 32 + pair * 16), out);
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+void mapSSE2(const uint8_t* colours, unsigned count, uint8_t palette, uint8_t* rgba) {
+    std::array<int, 4> shades = shadesOf(palette);
+    __m128i shade[4], number[4];
+
+    for (int c = 0; c < 4; c++) {
+        shade[c] = _mm_set1_epi32(shades[c]);
+        number[c] = _mm_set1_epi32(c);
+    }
+
+    unsigned i = 0;
+
+    // 16 pixels at a time: widen the colour numbers to 32 bits and select each pixel's shade
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colours + i));
+        __m128i words[2] = { _mm_unpacklo_epi8(bytes, _mm_setzero_si128()), _mm_unpackhi_epi8(bytes, _mm_setzero_si128()) };
+
+        for (int q = 0; q < 4; q++) {
+            __m128i index = q & 1 ? _mm_unpackhi_epi16(words[q >> 1], _mm_setzero_si128())
+                                  : _mm_unpacklo_epi16(words[q >> 1], _mm_setzero_si128());
+            __m128i out = _mm_setzero_si128();
+
+            for (int c = 0; c < 4; c++) {
+                out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(index, number[c]), shade[c]));
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + (i + q * 4) * 4), out);
+        }
+    }
+
+    mapScalar(colours + i, count - i, palette, rgba + i * 4);
+}
+
+__attribute__((target("avx2")))
+void decodeAVX2(const uint8_t* data, uint8_t* colours) {
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+    __m256i tile = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+
+    // Four rows at a time: the low bitplane byte of each repeated over the row's 8 pixels, and the high one
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+                                            4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+
+    for (int half = 0; half < 2; half++) {
+        __m256i index = _mm256_add_epi8(spread, _mm256_set1_epi8(char(half * 8)));
+        __m256i lo = _mm256_shuffle_epi8(tile, index);
+        __m256i hi = _mm256_shuffle_epi8(tile, _mm256_add_epi8(index, _mm256_set1_epi8(1)));
+
+        lo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), _mm256_set1_epi8(1));
+        hi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), _mm256_set1_epi8(2));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(colours + half * 32), _mm256_or_si256(lo, hi));
+    }
+}
+
+__attribute__((target("avx2")))
+void mapAVX2(const uint8_t* colours, unsigned count, uint8_t palette, uint8_t* rgba) {
+    std::array<int, 4> shades = shadesOf(palette);
+    const __m256i table = _mm256_setr_epi32(shades[0], shades[1], shades[2], shades[3], 0, 0, 0, 0);
+
+    unsigned i = 0;
+
+    // 32 pixels at a time, each group of 8 widened to 32 bits and looked up with one permute
+    for (; i + 32 <= count; i += 32) {
+        for (unsigned q = 0; q < 32; q += 8) {
+            __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(colours + i + q)));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + (i + q) * 4), _mm256_permutevar8x32_epi32(table, index));
+        }
+    }
+
+    mapScalar(colours + i, count - i, palette, rgba + i * 4);
+}
+#endif
+
+}
+
+bool Pixels::supported(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar:
+        return true;
+#ifdef GB_PIXELS_X86_64
+    case Isa::SSE2:
+        return true;
+    case Isa::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+Pixels::Kernels Pixels::kernels(Isa isa) {
+    switch (isa) {
+#ifdef GB_PIXELS_X86_64
+    case Isa::SSE2:
+        return { decodeSSE2, mapSSE2 };
+    case Isa::AVX2:
+        return { decodeAVX2, mapAVX2 };
+#endif
+    default:
+        return { decodeScalar, mapScalar };
+    }
+}
+
+const Pixels::Kernels& Pixels::best() {
+    static const Kernels chosen = [] {
+        for (int isa = int(Isa::Count) - 1; isa > 0; isa--) {
+            if (supported(Isa(isa))) {
+                return kernels(Isa(isa));
+            }
+        }
+
+        return kernels(Isa::Scalar);
+    }();
+
+    return chosen;
+}
+
+const char* Pixels::name(Isa isa) {
+    static const char* const names[] = { "scalar", "sse2", "avx2" };
+
+    return isa < Isa::Count ? names[size_t(isa)] : "?";
+}
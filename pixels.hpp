@@ -0,0 +1,77 @@
+#ifndef PIXELS_H
+#define PIXELS_H
+
+#include <cstdint>
+
+// The vector kernels use GCC/Clang target attributes and CPU detection
+#if defined(__GNUC__) && defined(__x86_64__)
+#define GB_PIXELS_X86_64
+#endif
+
+/**
+ * @brief The PPU's pixel kernels: decoding 2bpp tile data into colour numbers,
+ * and mapping colour numbers through a palette into RGBA.
+ *
+ * Each kernel has a portable version and, on x86-64, SSE2 and AVX2 versions.
+ * `best` picks the widest one the host CPU supports the first time it is
+ * called; `kernels` gives any of them, for comparing them (`gba_bench --mix pixels`).
+ */
+struct Pixels {
+    /**
+     * @brief Instruction sets the kernels are written for.
+     */
+    enum class Isa : uint8_t {
+        Scalar,
+        SSE2,
+        AVX2,
+        Count
+    };
+
+    /**
+     * @brief One implementation of every kernel.
+     */
+    struct Kernels {
+        /**
+         * @brief Decodes the 16 bytes of a tile (8 rows of a low and a high bitplane
+         * byte) into the colour numbers of its 64 pixels, row by row, leftmost first.
+         */
+        void (*decode)(const uint8_t* data, uint8_t* colours);
+        /**
+         * @brief Writes the RGBA values of `count` pixels with colour numbers `colours`
+         * under `palette` (a BGP/OBP0/OBP1 value) to `rgba`.
+         */
+        void (*map)(const uint8_t* colours, unsigned count, uint8_t palette, uint8_t* rgba);
+    };
+
+    /**
+     * @brief RGBA values of the four DMG shades, lightest first.
+     */
+    static constexpr uint8_t SHADES[4][4] = {
+        { 0xff, 0xff, 0xff, 0xff },
+        { 0xaa, 0xaa, 0xaa, 0xff },
+        { 0x55, 0x55, 0x55, 0xff },
+        { 0x00, 0x00, 0x00, 0xff },
+    };
+
+    /**
+     * @brief Returns whether the host can run the kernels written for `isa`.
+     */
+    static bool supported(Isa isa);
+
+    /**
+     * @brief Returns the kernels written for `isa`, which must be `supported`.
+     */
+    static Kernels kernels(Isa isa);
+
+    /**
+     * @brief Returns the kernels of the widest instruction set the host supports.
+     */
+    static const Kernels& best();
+
+    /**
+     * @brief Returns the name of `isa` ("scalar", "sse2", "avx2").
+     */
+    static const char* name(Isa isa);
+};
+
+#endif
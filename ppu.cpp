@@ -1,286 +1,286 @@
 #include "ppu.hpp"
 
 #include <iostream>
+#include <cstring>
 #include "memory.hpp"
 
-PPUObj::PPUObj() {
-    if (SDL_CreateWindowAndRenderer(160, 144, 0, &win, &renderer)) {
-        std::cout << "Window could not be created\n";
+PPUObj::PPUObj(Mem* memory) : memory(memory) {
+    (framebuffer = Framebuffer()).fill({});
+    kernels = Pixels::best();
+    stale.fill(true);
+    line_sprite_count = 0;
+
+    memory->set(0xFF42, 0);
+    memory->set(0xFF43, 0);
+
+    regs = memory->ioRegisters();
+
+    frames = 0;
+    line_start = 0;
+    next = OAM_SCAN_CYCLES;
+    mode = Mode::OAMScan;
+    ly = 0;
+    stat_line = false;
+
+    regs[0x44] = ly;
+    updateStat();
+};
+
+/**
+ * @brief Writes the RGBA value of DMG shade `shade` (0-3) to the pixel at `pixel`.
+ */
+static void setPixel(uint8_t* pixel, uint8_t shade) {
+    std::memcpy(pixel, Pixels::SHADES[shade], 4);
+}
+
+const uint8_t* PPUObj::tileRow(unsigned tile, unsigned y) {
+    if (stale[tile]) {
+        kernels.decode(memory->hostAddress(0x8000 + tile * 16), tiles[tile].data());
+        stale[tile] = false;
     }
 
-    SDL_SetWindowSize(win, 480, 432);
-    SDL_RenderSetLogicalSize(renderer, 160, 144);
+    return tiles[tile].data() + y * 8;
+}
 
-    SDL_SetWindowResizable(win, SDL_TRUE);
+template<class M>
+void PPUObj::scanOAM() {
+    M* bus = static_cast<M*>(memory);
 
-    
+    int height = (regs[0x40] & 0x04) ? 16 : 8;
+    uint8_t xs[MAX_LINE_SPRITES];
 
-    renderTarget = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, 160, 144);
+    line_sprite_count = 0;
 
-    (background = std::array<uint8_t, 262144>()).fill({});
-    (window = std::array<uint8_t, 262144>()).fill({});
-    (sprites = std::array<uint8_t, 262144>()).fill({});
-    (framebuffer = std::array<uint8_t, 92160>()).fill({});
+    for (uint8_t i = 0; i < 40 && line_sprite_count < MAX_LINE_SPRITES; i++) {
+        int y = ly - (bus->get(0xfe00 + i * 4) - 16);
 
-    memory->set(0xFF42, 0);
-    memory->set(0xFF43, 0);
+        if (y < 0 || y >= height) {
+            continue;
+        }
 
-    ppu_cycles = 0;
-    last_mode = 0;
+        // Insert after every sprite with the same X or less, so OAM order breaks ties
+        uint8_t x = bus->get(0xfe00 + i * 4 + 1);
+        unsigned n = line_sprite_count++;
 
-    lFlag = false;
-    dFlag = false;
-};
+        for (; n > 0 && xs[n - 1] > x; n--) {
+            xs[n] = xs[n - 1];
+            line_sprites[n] = line_sprites[n - 1];
+        }
 
-int COLORS[] = {
-        0xff,0xff,0xff,
-        0xaa,0xaa,0xaa,
-        0x55,0x55,0x55,
-        0x00,0x00,0x00
-};
+        xs[n] = x;
+        line_sprites[n] = i;
+    }
+}
 
 /**
- * @brief Calculates the pixel data for the background and window layers for a given scanline.
+ * @brief Renders the 160 visible pixels of a scanline straight into the framebuffer.
  *
- * This function renders the background and window layers for the specified `row` (scanline).
- * It reads tile data and tile maps from VRAM based on LCDC register settings,
- * SCX/SCY scroll registers, and WX/WY window position registers.
- * Colors are determined using the BGP palette register (0xFF47).
- * The results are stored in the `background` and `window` pixel arrays.
- * It also renders sprites that are visible on this scanline.
+ * Background and window pixels come first: each pixel is taken from the window
+ * once the window has started on this line (WY <= row and WX - 7 <= x) and from
+ * the background scrolled by SCX/SCY otherwise, looking the decoded tile row up
+ * again only when crossing a tile boundary (`tileRow`). The line's colour numbers
+ * then go through BGP into the framebuffer in one go (`Pixels::Kernels::map`).
+ * LCDC bit 0 blanks both. The colour numbers are kept for the sprites with the
+ * OBJ-to-BG priority bit, which hide behind colours 1-3. The sprites are those
+ * `scanOAM` picked, drawn in priority order: each pixel belongs to the first
+ * sprite that is not transparent there, even if that sprite is behind the background.
  *
+ * @tparam M The concrete memory controller type of `memory`.
  * @param row The current scanline number (LY register value, 0-143 for visible lines).
  */
-void PPUObj::calculateMaps(uint8_t row) {
-    uint8_t LCDC = memory->get(0xff40);
-    
-    uint8_t SCX = memory->get(0xff43);
-    uint8_t SCY = memory->get(0xff42);
-    uint8_t WY = memory->get(0xff4a);
-    uint8_t WX = memory->get(0xff4b) - 7;
-
-    uint16_t bgTileMapArea = (LCDC & 0x08) ? 0x9C00 : 0x9800; // LCDC Bit 3 for BG
-    uint16_t windowTileMapArea = (LCDC & 0x40) ? 0x9C00 : 0x9800; // LCDC Bit 6 for Window
-    bool signedTileAddressing = !(LCDC & 0x10); // LCDC Bit 4: 0 = 0x8800 method, 1 = 0x8000 method
-    uint16_t tileDataBaseAddress = (LCDC & 0x10) ? 0x8000 : 0x8800;
-    
-    uint8_t palette = memory->get(0xff47);
-
-    for (int j = 0; j < 256; j++) { // Iterate across the 256-pixel wide virtual map
-        // Background Pixel
-        uint8_t offY_bg = row + SCY;
-        uint8_t offX_bg = j + SCX;
-        int colour_bg = 0;
-
-        uint8_t tile_index_bg = memory->get(bgTileMapArea + ((offY_bg / 8 * 32) + (offX_bg / 8)));
-        uint16_t tile_addr_bg;
-
-        if (signedTileAddressing) { // 0x8800 method (signed index)
-            tile_addr_bg = tileDataBaseAddress + 0x800 + (((int8_t)tile_index_bg) * 0x10);
-        } else { // 0x8000 method (unsigned index)
-            tile_addr_bg = tileDataBaseAddress + (tile_index_bg * 0x10);
-        }
-        colour_bg = (memory->get(tile_addr_bg + (offY_bg % 8 * 2)) >> (7 - (offX_bg % 8)) & 0x1) + 
-                    ((memory->get(tile_addr_bg + (offY_bg % 8 * 2) + 1) >> (7 - (offX_bg % 8)) & 0x1) * 2);
-        
-        uint8_t colorfrompal_bg = (palette >> (2 * colour_bg)) & 3;
-        background[(row * 256 * 4) + (j * 4)] = COLORS[colorfrompal_bg * 3];
-        background[(row * 256 * 4) + (j * 4) + 1] = COLORS[colorfrompal_bg * 3 + 1];
-        background[(row * 256 * 4) + (j * 4) + 2] = COLORS[colorfrompal_bg * 3 + 2];
-        background[(row * 256 * 4) + (j * 4) + 3] = 0xff; // Mark as opaque for now
-
-        // Window Pixel (if window enabled and active for this pixel on this row)
-        bool windowEnabled = (LCDC & 0x20); // LCDC Bit 5
-        if (windowEnabled && WX <= j && WY <= row) {
-            // Check if current pixel (j) is within window's horizontal range on screen (0-159)
-            // And current row is within window's vertical range on screen (0-143)
-            // This check is implicitly handled by how drawFrame later crops from the 256x256 buffers.
-            // The WX <= j and WY <= row determines if the window *starts* covering pixels.
-
-            uint8_t offY_win = row - WY;
-            uint8_t offX_win = j - WX;
-            int colour_win = 0;
-
-            uint8_t tile_index_win = memory->get(windowTileMapArea + ((offY_win / 8 * 32) + (offX_win / 8)));
-            uint16_t tile_addr_win;
-
-            if (signedTileAddressing) { // 0x8800 method
-                tile_addr_win = tileDataBaseAddress + 0x800 + (((int8_t)tile_index_win) * 0x10);
-            } else { // 0x8000 method
-                tile_addr_win = tileDataBaseAddress + (tile_index_win * 0x10);
+template<class M>
+void PPUObj::renderLine(uint8_t row) {
+    M* bus = static_cast<M*>(memory);
+
+    uint8_t LCDC = regs[0x40];
+    uint8_t SCY = regs[0x42];
+    uint8_t SCX = regs[0x43];
+    uint8_t BGP = regs[0x47];
+    uint8_t WY = regs[0x4a];
+    uint8_t WX = regs[0x4b] - 7;
+
+    uint8_t* line = framebuffer.data() + row * 160 * 4;
+    uint8_t colours[160]; // Background and window colour numbers, before the palette
+
+    // Returns row `y` of the tile at (`x`, `y`) in the 32x32 tile map at `map`
+    auto fetch = [&](uint16_t map, uint8_t x, uint8_t y) {
+        uint8_t index = bus->get(map + (y / 8) * 32 + x / 8);
+
+        return tileRow((LCDC & 0x10) ? index : 256 + int8_t(index), y % 8);
+    };
+
+    if (LCDC & 0x01) {
+        uint16_t bgMap = (LCDC & 0x08) ? 0x9c00 : 0x9800;
+        uint16_t windowMap = (LCDC & 0x40) ? 0x9c00 : 0x9800;
+        bool windowLine = (LCDC & 0x20) && WY <= row;
+        bool inWindow = false;
+        const uint8_t* tile = nullptr;
+
+        for (int x = 0; x < 160; x++) {
+            bool window = windowLine && WX <= x;
+            uint8_t px = window ? x - WX : x + SCX;
+
+            if (x == 0 || window != inWindow || px % 8 == 0) {
+                tile = window ? fetch(windowMap, px, row - WY) : fetch(bgMap, px, row + SCY);
+                inWindow = window;
             }
 
-            colour_win = (memory->get(tile_addr_win + (offY_win % 8 * 2)) >> (7 - (offX_win % 8)) & 0x1) +
-                         ((memory->get(tile_addr_win + (offY_win % 8 * 2) + 1) >> (7 - (offX_win % 8)) & 0x1) * 2);
-            
-            uint8_t colorfrompal_win = (palette >> (2 * colour_win)) & 3;
-
-            window[(row * 256 * 4) + (j * 4)] = COLORS[colorfrompal_win * 3];
-            window[(row * 256 * 4) + (j * 4) + 1] = COLORS[colorfrompal_win * 3 + 1];
-            window[(row * 256 * 4) + (j * 4) + 2] = COLORS[colorfrompal_win * 3 + 2];
-            window[(row * 256 * 4) + (j * 4) + 3] = 0xff; // Mark as opaque
-        } else {
-            // If window not active here, ensure window buffer is transparent for this pixel
-            window[(row * 256 * 4) + (j * 4) + 3] = 0x00; 
+            colours[x] = tile[px % 8];
         }
+
+        kernels.map(colours, 160, BGP, line);
+    }
+    else {
+        std::fill(std::begin(colours), std::end(colours), 0);
+        kernels.map(colours, 160, 0, line);
     }
 
-    // Sprite rendering (largely unchanged for this specific fix, but see conceptual points later)
-    if (memory->get(0xff40) >> 1 & 1) {
-        for (uint16_t i = 0xfe00; i < 0xfe9f; i += 4) {
-            uint8_t y = memory->get(i);
-            uint8_t x = memory->get(i + 1);
-            uint8_t height = (memory->get(0xff40) >> 2 & 0x01) ? 16 : 8;
-
-            if (row >= (y - 16) && row <= ((y - 16) + height)) {
-                uint8_t t = memory->get(i + 2);
-                uint8_t f = memory->get(i + 3);
-                uint8_t colour = 0;
-
-                for (int u = 0; u < height; u++) {
-                    for (int v = 0; v < 8; v++) {
-                        switch (f & 0x60) {
-                        case 0x00:
-                            colour = (memory->get(0x8000 + (t * 0x10) + (u * 2)) >> (7 - v) & 0x1) + (memory->get(0x8000 + (t * 0x10) + (u * 2) + 1) >> (7 - v) & 0x1) * 2;
-                            break;
-                        case 0x20:
-                            colour = (memory->get(0x8000 + (t * 0x10) + (u * 2)) >> v & 0x1) + (memory->get(0x8000 + (t * 0x10) + (u * 2) + 1) >> v & 0x1) * 2;
-                            break;
-                        case 0x40:
-                            colour = (memory->get(0x8000 + (t * 0x10) + ((height - u - 1) * 2)) >> (7 - v) & 0x1) + (memory->get(0x8000 + (t * 0x10) + ((height - u - 1) * 2) + 1) >> (7 - v) & 0x1) * 2;
-                            break;
-                        case 0x60:
-                            colour = (memory->get(0x8000 + (t * 0x10) + ((height - u - 1) * 2)) >> v & 0x1) + (memory->get(0x8000 + (t * 0x10) + ((height - u - 1) * 2) + 1) >> v & 0x1) * 2;
-                            break;
-                        default:
-                            break;
-                        }
-
-                        uint8_t colorfrompal = (memory->get(f >> 4 & 1 ? 0xff49 : 0xff48) >> (2 * colour)) & 3;
-
-                        if (colour && ((y + u) >= 16 && (y + u) <= 0xff) && ((x + v) >= 8 && (x + v) <= 0xff)) {
-                            sprites[((y + u - 16) * 256 * 4) + ((x + v - 8) * 4)] = COLORS[colorfrompal * 3];
-                            sprites[((y + u - 16) * 256 * 4) + ((x + v - 8) * 4) + 1] = COLORS[colorfrompal * 3 + 1];
-                            sprites[((y + u - 16) * 256 * 4) + ((x + v - 8) * 4) + 2] = COLORS[colorfrompal * 3 + 2];
-                            sprites[((y + u - 16) * 256 * 4) + ((x + v - 8) * 4) + 3] = 0xff;
-                        }
-                    }
-                }
+    if (!(LCDC & 0x02)) {
+        return;
+    }
+
+    int height = (LCDC & 0x04) ? 16 : 8;
+    bool covered[160] = {}; // Pixels a sprite of higher priority has already drawn (or hidden) on
+
+    for (unsigned n = 0; n < line_sprite_count; n++) {
+        uint16_t entry = 0xfe00 + line_sprites[n] * 4;
+        int y = row - (bus->get(entry) - 16);
+
+        // LCDC can switch to 8x8 sprites between the scan and rendering
+        if (y < 0 || y >= height) {
+            continue;
+        }
+
+        int left = bus->get(entry + 1) - 8;
+        uint8_t t = bus->get(entry + 2);
+        uint8_t f = bus->get(entry + 3);
+
+        if (f & 0x40) {
+            y = height - 1 - y;
+        }
+
+        if (height == 16) {
+            t &= 0xfe;
+        }
+
+        const uint8_t* pixels = tileRow(t + y / 8, y % 8);
+        uint8_t palette = regs[(f & 0x10) ? 0x49 : 0x48];
+
+        for (int v = 0; v < 8; v++) {
+            int x = left + v;
+
+            if (x < 0 || x >= 160) {
+                continue;
+            }
+
+            uint8_t colour = pixels[(f & 0x20) ? 7 - v : v];
+
+            if (!colour || covered[x]) {
+                continue;
+            }
+
+            covered[x] = true;
+
+            if (!((f & 0x80) && colours[x])) {
+                setPixel(line + x * 4, palette >> (2 * colour) & 3);
             }
         }
     }
 }
 
 /**
- * @brief Draws the final composed frame to the screen.
- *
- * This function iterates through each pixel of the 160x144 framebuffer.
- * It composites the background, window, and sprite layers (in that order,
- * respecting transparency and priority where applicable, though current sprite
- * implementation might overlay unconditionally if sprite pixel is not transparent).
- * The resulting framebuffer is then updated to an SDL texture and rendered to the screen.
+ * @brief Hands the completed frame to the `present` callback, if any.
  */
 void PPUObj::drawFrame() {
-    for (int row = 0; row < 144; row++) {
-        for (int col = 0; col < 160; col++) {
-            int yoff = (row * 256 * 4);
-            int xoff = (col * 4);
-
-            framebuffer[(row * 160 * 4) + (col * 4)] = background[yoff + xoff];
-            framebuffer[(row * 160 * 4) + (col * 4) + 1] = background[yoff + xoff + 1];
-            framebuffer[(row * 160 * 4) + (col * 4) + 2] = background[yoff + xoff + 2];
-            framebuffer[(row * 160 * 4) + (col * 4) + 3] = background[yoff + xoff + 3];
-
-            if (window[yoff + xoff + 3]) {
-                framebuffer[(row * 160 * 4) + (col * 4)] = window[yoff + xoff];
-                framebuffer[(row * 160 * 4) + (col * 4) + 1] = window[yoff + xoff + 1];
-                framebuffer[(row * 160 * 4) + (col * 4) + 2] = window[yoff + xoff + 2];
-                framebuffer[(row * 160 * 4) + (col * 4) + 3] = window[yoff + xoff + 3];
-            }
-
-            if (sprites[yoff + xoff + 3]) {
-                framebuffer[(row * 160 * 4) + (col * 4)] = sprites[yoff + xoff];
-                framebuffer[(row * 160 * 4) + (col * 4) + 1] = sprites[yoff + xoff + 1];
-                framebuffer[(row * 160 * 4) + (col * 4) + 2] = sprites[yoff + xoff + 2];
-                framebuffer[(row * 160 * 4) + (col * 4) + 3] = sprites[yoff + xoff + 3];
-            }
-        }
+    if (present) {
+        present(framebuffer);
     }
-
-    SDL_UpdateTexture(renderTarget, NULL, framebuffer.data(), 160 * sizeof(unsigned char) * 4);
-    SDL_RenderCopy(renderer, renderTarget, NULL, NULL);
-    SDL_RenderPresent(renderer);
 }
 
-void PPUObj::step(int cycles) {
-    ppu_cycles += cycles * 4;
-
-    uint8_t LY = memory->get(0xff44);
+template<class M>
+void PPUObj::transition() {
+    M* bus = static_cast<M*>(memory);
 
-    if (ppu_cycles <= 80) {
-        memory->set(0xff41, (memory->get(0xff41) & 0xfc) | 2);
-
-        if (last_mode != 2 && (memory->get(0xff41) >> 5) & 1) {
-            memory->set(0xff0f, memory->get(0xff0f) | 2);
+    switch (mode) {
+    case Mode::OAMScan:
+        if (ly == 0) {
+            render_frame = render_requested || (render_interval && frames % render_interval == 0);
+            render_requested = false;
         }
 
-        last_mode = 2;
-    } 
-    else if (ppu_cycles <= 252) {
-        memory->set(0xff41, (memory->get(0xff41) & 0xfc) | 3);
-    } 
-    else if (ppu_cycles <= 456) {
-        memory->set(0xff41, (memory->get(0xff41) & 0xfc));
+        if (render_frame) {
+            scanOAM<M>();
+        }
 
-        if (last_mode != 0 && (memory->get(0xff41) >> 3) & 1) {
-            memory->set(0xff0f, memory->get(0xff0f) | 2);
+        mode = Mode::Transfer;
+        next = line_start + OAM_SCAN_CYCLES + TRANSFER_CYCLES;
+        break;
+    case Mode::Transfer:
+        if (render_frame) {
+            renderLine<M>(ly);
         }
 
-        last_mode = 0;
-    }
+        mode = Mode::HBlank;
+        next = line_start + LINE_CYCLES;
+        break;
+    case Mode::HBlank:
+    case Mode::VBlank:
+        line_start += LINE_CYCLES;
+        ly++;
+
+        if (ly == 144) {
+            mode = Mode::VBlank;
 
-    if (LY >= 144) {
-        memory->set(0xff41, (memory->get(0xff41) & 0xfc) | 1);
+            if (bus->get(0xff40) >> 7) {
+                bus->set(0xff0f, bus->get(0xff0f) | 1);
 
-        if (last_mode != 1 && (memory->get(0xff41) >> 4) & 1) {
-            memory->set(0xff0f, memory->get(0xff0f) | 2);
+                if (render_frame) {
+                    drawFrame();
+                }
+            }
+        }
+        else if (ly == 154) {
+            ly = 0;
+            frames++;
+            mode = Mode::OAMScan;
+        }
+        else if (mode == Mode::HBlank) {
+            mode = Mode::OAMScan;
         }
 
-        last_mode = 1;
+        next = line_start + (mode == Mode::OAMScan ? OAM_SCAN_CYCLES : LINE_CYCLES);
+        regs[0x44] = ly;
+        break;
     }
 
-    if (!lFlag && ppu_cycles > 252 && LY < 145) {
-        calculateMaps(LY);
-        
-        lFlag = true;
-    }
+    updateStat();
+}
 
-    if (!dFlag && LY == 144 && memory->get(0xff40) >> 7) {
-        memory->set(0xff0f, memory->get(0xff0f) | 1);
+void PPUObj::updateStat() {
+    uint8_t STAT = (regs[0x41] & 0xf8) | static_cast<uint8_t>(mode) | (ly == regs[0x45] ? 0x04 : 0);
+    regs[0x41] = STAT;
 
-        dFlag = true;
-        drawFrame();
+    bool line = ((STAT & 0x44) == 0x44)
+        || (mode == Mode::HBlank && (STAT & 0x08))
+        || (mode == Mode::VBlank && (STAT & 0x10))
+        || (mode == Mode::OAMScan && (STAT & 0x20));
 
-        background.fill({});
-        sprites.fill({});
-        window.fill({});
+    if (line && !stat_line) {
+        memory->set(0xff0f, memory->get(0xff0f) | 2);
     }
 
-    if (ppu_cycles > 456) {
-        ppu_cycles -= 456;
-        memory->set(0xff44, LY + 1);
-        lFlag = false;
+    stat_line = line;
+}
+
+template<class M>
+uint64_t PPUObj::update(uint64_t now) {
+    while (next <= now) {
+        transition<M>();
     }
 
-    if (LY == memory->get(0xff45) && (memory->get(0xff41) >> 6) & 1) {
-		memory->set(0xff0f, memory->get(0xff0f) | 2);
-        memory->set(0xff41, memory->get(0xff41) | 4);
-    } else {
-		memory->set(0xff41, memory->get(0xff41) & 0xfb);
-	}
+    return next;
+}
 
-    if (LY > 154) {
-        memory->set(0xff44, 0);
-        dFlag = false;
-    }
-}
\ No newline at end of file
+#define GB_INSTANTIATE_PPU(M) template uint64_t PPUObj::update<M>(uint64_t);
+GB_MAPPERS(GB_INSTANTIATE_PPU)
+#undef GB_INSTANTIATE_PPU
@@ -1,9 +1,14 @@
 #ifndef PPU_H
 #define PPU_H
 
-#include <SDL.h>
 #include <array>
 #include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "pixels.hpp"
+
+class Mem;
 
 /**
  * @brief Pixel Processing Unit (PPU) class.
@@ -12,66 +17,162 @@
  */
 class PPUObj {
 public:
+    /**
+     * @brief Framebuffer type: 160x144 RGBA pixels.
+     */
+    using Framebuffer = std::array<uint8_t, 92160>;
+
     /**
      * @brief Constructor for the PPUObj (Pixel Processing Unit Object).
      *
-     * Initializes SDL, creates a window and renderer, and sets up textures
-     * for background, window, sprites, and the final framebuffer.
-     * Also initializes PPU-related memory registers (SCY, SCX) and internal state.
+     * Clears the framebuffer and initializes PPU-related memory registers (SCY, SCX) and internal state,
+     * starting the OAM scan of line 0 at master clock value 0.
+     * Does not touch any host video API; see `present`.
+     * @param memory The memory controller holding VRAM, OAM and the LCD registers.
      */
-    PPUObj();
+    PPUObj(Mem* memory);
     /**
      * @brief Destructor for the PPUObj.
-     * Defaulted, SDL cleanup might be handled elsewhere or upon program termination.
      */
     ~PPUObj() = default;
     /**
-     * @brief Steps the PPU simulation by a given number of CPU cycles.
+     * @brief Runs the PPU up to the master clock value `now`.
+     *
+     * Called when the machine's `Event::PPU` comes due. The PPU only changes state
+     * at mode and line changes, whose times are known in advance, so this makes
+     * every transition due by `now` and nothing else.
      *
-     * Updates the PPU's internal cycle counter. Based on the cycle count and the
-     * current scanline (LY register), it transitions the PPU through its different
-     * modes (OAM Scan, Drawing, HBlank, VBlank).
-     * It sets the appropriate mode flags in the STAT register (0xFF41) and requests
-     * LCD STAT interrupts if enabled and conditions are met.
-     * When a scanline is completed (during HBlank), `calculateMaps` is called.
-     * When the VBlank period starts (LY=144), a VBlank interrupt is requested,
-     * and `drawFrame` is called to render the completed frame.
+     * @tparam M The concrete memory controller type of `memory`.
+     * @param now The current master clock value (M-cycles).
+     * @return The master clock value of the next mode or line change.
+     */
+    template<class M> uint64_t update(uint64_t now);
+    /**
+     * @brief Returns the master clock value of the next mode or line change.
+     */
+    uint64_t nextEvent() const { return next; }
+    /**
+     * @brief Recomputes STAT's mode and LY=LYC bits and requests the LCD STAT
+     * interrupt if one of its enabled conditions has just become true.
+     * Called at every transition and after writes to STAT (0xFF41) and LYC (0xFF45).
+     */
+    void updateStat();
+
+    /**
+     * @brief Sets which frames are rendered: every `interval`th one (1, the default,
+     * renders all of them), or with 0 only those asked for with `renderNextFrame`.
      *
-     * @param cycles The number of CPU M-cycles that have passed. PPU cycles are 4x this.
+     * A skipped frame keeps all of the PPU's timing and side effects (modes, LY,
+     * LYC, the VBlank and STAT interrupts); its sprites are not scanned, its lines
+     * are not rendered and it is not presented, so the framebuffer keeps the last
+     * rendered frame.
+     */
+    void setRenderInterval(unsigned interval) { render_interval = interval; }
+    /**
+     * @brief Makes the PPU render the next frame whatever the render interval: the
+     * current one if its first line has not been scanned yet (as right after
+     * `Machine::run_frames` returns), otherwise the one after it.
+     */
+    void renderNextFrame() { render_requested = true; }
+
+    /**
+     * @brief Marks a tile's decoded rows as stale after its bytes in VRAM changed.
+     * Called by the memory controller (`Mem::writeVRAM`).
+     * @param tile The tile's number counted from 0x8000 (0-383).
+     */
+    void tileWritten(unsigned tile) { stale[tile] = true; }
+
+    /**
+     * @brief Number of frames completed (LY wrapped back to 0) since construction.
+     */
+    uint64_t frameCount() const { return frames; }
+
+    /**
+     * @brief Called with the composited framebuffer at the start of every VBlank.
+     * Left unset when running headless.
      */
-    void step(int cycles);
+    std::function<void(const Framebuffer&)> present;
 
 private:
-    SDL_Window* win;
-    SDL_Renderer* renderer;
-    SDL_Texture* renderTarget;
+    Mem* memory;
+
+    Framebuffer framebuffer; // 160*144*4 (RGBA), rendered a line at a time
+
+    Pixels::Kernels kernels; // Tile decoding and palette mapping, the best the host supports
+
+    std::array<std::array<uint8_t, 64>, 384> tiles;    // Colour numbers of the pixels of the 384 tiles in VRAM
+    std::array<bool, 384> stale;                       // Tiles whose VRAM bytes changed since they were decoded
+
+    /**
+     * @brief PPU modes, numbered as in STAT bits 0-1.
+     */
+    enum class Mode : uint8_t {
+        HBlank = 0,
+        VBlank = 1,
+        OAMScan = 2,
+        Transfer = 3
+    };
+
+    static constexpr uint64_t LINE_CYCLES = 114;     // M-cycles per line, 154 lines a frame
+    static constexpr uint64_t OAM_SCAN_CYCLES = 20;
+    static constexpr uint64_t TRANSFER_CYCLES = 43;
+
+    uint8_t* regs;       // The memory's I/O registers, which STAT and LY are stored in
+
+    uint64_t frames;
+    uint64_t line_start; // Master clock value at which the current line began
+    uint64_t next;       // Master clock value of the next transition
+    Mode mode;
+    uint8_t ly;
+    bool stat_line;      // Whether an enabled STAT condition holds; the interrupt fires when it becomes true
 
-    std::array<uint8_t, 262144> background;
-    std::array<uint8_t, 262144> window;
-    std::array<uint8_t, 262144> sprites;
-    std::array<uint8_t, 92160> framebuffer; // 160*144*4 (RGBA)
+    static constexpr unsigned MAX_LINE_SPRITES = 10;
 
-    uint16_t ppu_cycles;
-    uint8_t last_mode;
+    std::array<uint8_t, MAX_LINE_SPRITES> line_sprites; // OAM entries on the current line, highest priority first
+    uint8_t line_sprite_count;
 
-    bool dFlag; 
-    bool lFlag; 
+    unsigned render_interval = 1;  // See `setRenderInterval`
+    bool render_requested = false; // See `renderNextFrame`
+    bool render_frame = true;      // Whether the current frame is rendered, decided as its first line's OAM scan ends
 
     /**
-     * @brief Calculates pixel data for background, window, and sprites for a given scanline.
+     * @brief Makes the transition due at `next` and works out when the following one is.
+     *
+     * Each line runs OAM scan, transfer and HBlank; the line's sprites are
+     * picked (`scanOAM`) as the OAM scan ends and the line is rendered
+     * (`renderLine`) as HBlank starts, in frames that are rendered at all (see
+     * `setRenderInterval`). Line 144 starts VBlank, which requests
+     * the VBlank interrupt and presents the frame (`drawFrame`), and lasts until
+     * LY wraps from 153 back to 0.
+     *
+     * @tparam M The concrete memory controller type of `memory`.
+     */
+    template<class M> void transition();
+    /**
+     * @brief Picks the sprites of the current line into `line_sprites`, like the
+     * hardware's OAM scan: the first 10 OAM entries whose rows cover LY, ordered by
+     * X and then by OAM position, lowest first, which is the order of their priority.
+     * @tparam M The concrete memory controller type of `memory`.
+     */
+    template<class M> void scanOAM();
+    /**
+     * @brief Returns the colour numbers of the 8 pixels of row `y` of tile `tile`,
+     * decoding the tile first if it is stale.
+     * @param tile The tile's number counted from 0x8000 (0-383).
+     * @param y The row (0-7).
+     */
+    const uint8_t* tileRow(unsigned tile, unsigned y);
+    /**
+     * @brief Renders the visible pixels of a scanline, background, window and sprites
+     * composited, into `framebuffer`.
+     * @tparam M The concrete memory controller type of `memory`.
      * @param row The current scanline number (LY register value).
      */
-    void calculateMaps(uint8_t row);
+    template<class M> void renderLine(uint8_t row);
     /**
-     * @brief Composites the rendered layers (background, window, sprites) into the framebuffer
-     * and draws the final frame to the SDL window.
+     * @brief Hands the completed framebuffer to `present`.
      */
     void drawFrame();
 };
 
-/**
- * @brief Global unique pointer to the PPU object.
- */
-inline std::unique_ptr<PPUObj> PPU;
-
 #endif
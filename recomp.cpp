@@ -0,0 +1,300 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include "gba.hpp"
+
+/**
+ * @brief Prints command-line usage for the static recompiler.
+ * @param name The executable name (argv[0]).
+ */
+static void usage(const char* name) {
+    std::cout << "usage: " << name << " <rom> <output>\n"
+              << "  Compiles the code reachable from the entry points of <rom> to C++ in <output>.\n"
+              << "  Configure with -DGB_RECOMPILED=<output> to build it into gbcore, then run\n"
+              << "  that build with the recompiled dispatch.\n";
+}
+
+/**
+ * @brief Names the memory controller class `memory` is an instance of.
+ * @return The class name, or an empty string for an unknown controller.
+ */
+static std::string mapperName(Mem* memory) {
+#define GB_MAPPER_NAME(M) \
+    if (dynamic_cast<M*>(memory)) { \
+        return #M; \
+    }
+    GB_MAPPERS(GB_MAPPER_NAME)
+#undef GB_MAPPER_NAME
+    return "";
+}
+
+/**
+ * @brief Code address still to be compiled.
+ */
+struct Target {
+    uint16_t pc;
+    unsigned bank; // Bank assumed to be mapped at 0x4000-0x7FFF
+};
+
+/**
+ * @brief Finds the code reachable from a cartridge's entry points, block by block.
+ *
+ * Blocks are decoded with `Block::decode`, so they start and end exactly
+ * where the cached dispatch's do and can stand in for them. Successors are the
+ * static targets of the jump, call or restart ending a block, and the
+ * instruction after it unless it always jumps away. Computed jumps (JP HL),
+ * returns and interrupt returns are left to the interpreter, which is also
+ * what runs a block reached at any address not found here.
+ *
+ * The bank at 0x4000-0x7FFF is only known statically when the code switches
+ * it with an immediate (`LD A,n` then `LD (nn),A` to a bank register). Targets
+ * in it are compiled for that bank, for the bank of the jumping code when it
+ * is in that region itself, and for bank 1 otherwise.
+ */
+class Discovery {
+public:
+    explicit Discovery(const std::vector<uint8_t>& rom) : rom(rom) {
+        for (uint16_t vector = 0; vector <= 0x60; vector += 8) {
+            add({ vector, 1 });
+        }
+
+        add({ 0x100, 1 });
+    }
+
+    /**
+     * @brief Decodes every reachable block, up to `MAX_INSTRUCTIONS` instructions.
+     * @return The blocks by ROM offset.
+     */
+    std::map<uint32_t, std::unique_ptr<Block>> run() {
+        size_t instructions = 0;
+
+        while (!pending.empty() && instructions < MAX_INSTRUCTIONS) {
+            Target target = pending.front();
+            pending.pop_front();
+
+            int64_t offset = offsetOf(target);
+            unsigned avail = 0x100 - (target.pc & 0xFF);
+
+            if (offset < 0 || blocks.count(offset) || size_t(offset) + avail > rom.size()) {
+                continue;
+            }
+
+            auto block = Block::decode(rom.data() + offset, target.pc, avail);
+
+            if (block->ops.size() > 1) {
+                instructions += block->ops.size() - 1;
+                follow(*block, target.pc >= 0x4000 ? unsigned(offset / 0x4000) : target.bank);
+                blocks[offset] = std::move(block);
+            }
+        }
+
+        return std::move(blocks);
+    }
+
+    /**
+     * @brief Roughly the most instructions one file can hold (the index of a
+     * `RECOMPILED` op is 16 bits; instructions past it stay interpreted).
+     */
+    static constexpr size_t MAX_INSTRUCTIONS = 0x10000;
+
+private:
+    /**
+     * @brief Returns the ROM offset of `target`, or -1 if it is not in ROM.
+     */
+    int64_t offsetOf(const Target& target) const {
+        if (target.pc < 0x4000) {
+            return target.pc;
+        }
+
+        if (target.pc < 0x8000) {
+            // Cartridges without banks ignore bank switches
+            unsigned bank = rom.size() > 0x8000 ? target.bank : 1;
+            return int64_t(bank) * 0x4000 + (target.pc - 0x4000);
+        }
+
+        return -1;
+    }
+
+    void add(const Target& target) {
+        pending.push_back(target);
+    }
+
+    /**
+     * @brief Queues the successors of `block`, which runs with `bank` mapped.
+     */
+    void follow(const Block& block, unsigned bank) {
+        int value = -1; // Last immediate loaded into A
+
+        for (size_t i = 0; i + 1 < block.ops.size(); i++) {
+            const DecodedOp& op = block.ops[i];
+
+            if (op.op == 0x3E) {
+                value = op.operand;
+            }
+            else if (op.op == 0xEA && op.operand >= 0x2000 && op.operand < 0x4000 && value >= 0) {
+                bank = value ? value : 1;
+            }
+            else if (op.op != 0xEA) {
+                // Anything else may have changed A
+                value = -1;
+            }
+        }
+
+        const DecodedOp& last = block.ops[block.ops.size() - 2];
+        uint16_t next = block.ops.back().pc;
+        bool fallsThrough = true;
+
+        switch (last.op) {
+        case 0x18: // JR
+            fallsThrough = false;
+            [[fallthrough]];
+        case 0x20: case 0x28: case 0x30: case 0x38:
+            add({ uint16_t(next + int8_t(last.operand)), bank });
+            break;
+        case 0xC3: // JP
+            fallsThrough = false;
+            [[fallthrough]];
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+        case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+            add({ last.operand, bank });
+            break;
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: // RST
+        case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+            add({ uint16_t(last.op & 0x38), bank });
+            break;
+        case 0xE9: case 0xC9: case 0xD9: // JP HL, RET, RETI
+            fallsThrough = false;
+            break;
+        }
+
+        if (fallsThrough) {
+            add({ next, bank });
+        }
+    }
+
+    const std::vector<uint8_t>& rom;
+    std::deque<Target> pending;
+    std::map<uint32_t, std::unique_ptr<Block>> blocks;
+};
+
+/**
+ * @brief Writes the C++ of the compiled blocks (see `Recompiled`).
+ */
+static void emit(std::ostream& out, const std::string& romPath, const std::string& mapper,
+                 const std::vector<uint8_t>& rom, const std::map<uint32_t, std::unique_ptr<Block>>& blocks) {
+    size_t instructions = 0;
+
+    for (auto& [offset, block] : blocks) {
+        instructions += block->ops.size() - 1;
+    }
+
+    out << "// Generated by gba_recomp from " << romPath << ". Do not edit.\n"
+        << "// " << blocks.size() << " blocks, " << instructions << " instructions.\n"
+        << "// Included by opcodes.cpp when gbcore is configured with -DGB_RECOMPILED=<this file>.\n\n"
+        << std::hex << std::uppercase << std::setfill('0');
+
+    for (auto& [offset, block] : blocks) {
+        out << "template<>\n"
+            << "void Recompiled::block<" << mapper << ", 0x" << std::setw(6) << offset << ">(Machine& m, unsigned start) {\n"
+            << "    static constexpr DecodedOp ops[] = {\n";
+
+        for (size_t i = 0; i + 1 < block->ops.size(); i++) {
+            const DecodedOp& op = block->ops[i];
+            out << "        { 0x" << std::setw(2) << op.op << ", 0x" << std::setw(4) << op.operand
+                << ", 0x" << std::setw(4) << op.pc << ", " << std::dec << unsigned(op.cycles) << std::hex << " },\n";
+        }
+
+        out << "    };\n\n"
+            << "    switch (start) {\n";
+
+        for (size_t i = 0; i + 1 < block->ops.size(); i++) {
+            out << (i ? "        [[fallthrough]];\n" : "") << "    case " << std::dec << i << std::hex << ":\n"
+                << "        if (!m.recompiledStep<" << mapper << ", 0x" << std::setw(2) << block->ops[i].op << ">(&ops["
+                << std::dec << i << std::hex << "])) {\n"
+                << "            return;\n"
+                << "        }\n";
+        }
+
+        out << "    }\n"
+            << "}\n\n";
+    }
+
+    // Instructions shared by overlapping blocks resume in the block starting there, if any, else the first one
+    std::map<uint32_t, std::pair<uint32_t, size_t>> entries;
+
+    for (auto& [offset, block] : blocks) {
+        entries.emplace(offset, std::make_pair(offset, 0));
+    }
+
+    for (auto& [offset, block] : blocks) {
+        for (size_t i = 1; i + 1 < block->ops.size(); i++) {
+            entries.emplace(offset + (block->ops[i].pc - block->ops[0].pc), std::make_pair(offset, i));
+        }
+    }
+
+    out << "template<>\n"
+        << "const std::vector<Recompiled::Entry> Recompiled::entries<" << mapper << "> = {\n";
+
+    for (auto& [at, entry] : entries) {
+        out << "    { 0x" << std::setw(6) << at << ", &Recompiled::block<" << mapper << ", 0x" << std::setw(6) << entry.first
+            << ">, " << std::dec << entry.second << std::hex << " },\n";
+    }
+
+    out << "};\n\n"
+        << "const uint32_t Recompiled::checksum = 0x" << std::setw(8) << Recompiled::checksumOf(rom) << ";\n"
+        << "const size_t Recompiled::size = 0x" << rom.size() << ";\n";
+}
+
+/**
+ * @brief Entry point of the static recompiler.
+ *
+ * Loads the ROM given on the command line like the emulator would, finds the
+ * code reachable from its entry points and writes it as C++ for gbcore.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 on success, 1 on error.
+ */
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string romPath = argv[1], outPath = argv[2];
+    Machine machine;
+    std::string error;
+
+    if (!machine.loadCartridge(romPath, "", error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    std::string mapper = mapperName(machine.memory.get());
+    const std::vector<uint8_t>& rom = machine.memory->romImage();
+    auto blocks = Discovery(rom).run();
+
+    std::ofstream out(outPath);
+
+    if (!out) {
+        std::cerr << "Cannot write " << outPath << std::endl;
+        return 1;
+    }
+
+    emit(out, romPath, mapper, rom, blocks);
+
+    if (!out) {
+        std::cerr << "Cannot write " << outPath << std::endl;
+        return 1;
+    }
+
+    std::cout << "blocks: " << blocks.size() << " (" << mapper << ")\n";
+    return 0;
+}
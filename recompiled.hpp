@@ -0,0 +1,93 @@
+#ifndef RECOMPILED_H
+#define RECOMPILED_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Machine;
+
+/**
+ * @brief ROM code compiled ahead of time by gba_recomp (recomp.cpp).
+ *
+ * gba_recomp decodes the blocks reachable from a cartridge's entry points the
+ * way the cached dispatch does (`Block::decode`) and writes one C++ function
+ * per block. Each runs the block's instructions through the same
+ * `executeOp<M, OP>` instantiations as the interpreter, with the operands as
+ * constants and without a dispatch between instructions. Setting the
+ * GB_RECOMPILED CMake option to the generated file builds it into gbcore
+ * (opcodes.cpp includes it), making every executable built with it specific
+ * to that cartridge.
+ *
+ * With the Recompiled dispatch, a ROM block the cached dispatch meets at one
+ * of their instructions runs the compiled block from there instead. Code
+ * gba_recomp did not find (computed jumps, banks it could not guess, RAM) and
+ * other cartridges run in the cached interpreter.
+ */
+struct Recompiled {
+    /**
+     * @brief Runs a block from its instruction `start` until its end or until an event comes due.
+     */
+    using Run = void (*)(Machine& m, unsigned start);
+
+    /**
+     * @brief An instruction of a compiled block, by ROM offset. Every instruction
+     * has one, so a block interrupted by an event resumes in compiled code.
+     */
+    struct Entry {
+        uint32_t offset;
+        Run run;
+        unsigned start; // Index of the instruction in its block
+    };
+
+    /**
+     * @brief Checksum of the cartridge the blocks were compiled from (FNV-1a).
+     */
+    static uint32_t checksumOf(const std::vector<uint8_t>& rom) {
+        uint32_t hash = 2166136261u;
+
+        for (uint8_t byte : rom) {
+            hash = (hash ^ byte) * 16777619u;
+        }
+
+        return hash;
+    }
+
+    /**
+     * @brief Checks whether the blocks built in were compiled from `rom`.
+     */
+    static bool matches(const std::vector<uint8_t>& rom) {
+        return size != 0 && rom.size() == size && checksumOf(rom) == checksum;
+    }
+
+    /**
+     * @brief Finds the compiled instruction for memory controller `M` at ROM offset `offset`.
+     * @return Its index for `run`, or -1 if there is none.
+     */
+    template<class M> static int32_t find(int64_t offset);
+
+    /**
+     * @brief Runs the block holding instruction `index` (see `find`) on `m`, from that instruction.
+     */
+    template<class M> static void run(uint16_t index, Machine& m) {
+        const Entry& entry = entries<M>[index];
+        entry.run(m, entry.start);
+    }
+
+private:
+    static const uint32_t checksum;
+    static const size_t size; // ROM size in bytes, 0 without recompiled code
+
+    /**
+     * @brief The compiled instructions, sorted by offset. Only the cartridge's
+     * own memory controller has any.
+     */
+    template<class M> static const std::vector<Entry> entries;
+
+    /**
+     * @brief The block at ROM offset `OFFSET`; specialised by the generated file.
+     */
+    template<class M, uint32_t OFFSET> static void block(Machine& m, unsigned start);
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * @brief Work that happens at a known M-cycle instead of after every instruction.
+ */
+enum class Event : uint8_t {
+    PPU,        // Next PPU mode or line change
+    Timer,      // Next TIMA overflow
+    Interrupts, // IE, IF, IME or the halted state changed
+    RunTarget,  // End of the current run_cycles budget
+    Code,       // Pre-decoded code was overwritten or banked out
+    Count
+};
+
+/**
+ * @brief Fixed-slot event scheduler.
+ * Holds one due time per `Event`, stamped against the machine's 64-bit master
+ * clock (`Machine::total_cycles`), and caches the earliest of them so the CPU
+ * loop only has to compare the clock against `next()` after each instruction.
+ */
+class Scheduler {
+public:
+    /**
+     * @brief Due time of an event that is not scheduled.
+     */
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    Scheduler() {
+        clear();
+    }
+
+    /**
+     * @brief Cancels every event.
+     */
+    void clear() {
+        due.fill(NEVER);
+        earliest = NEVER;
+    }
+
+    /**
+     * @brief Returns the master clock value at which the earliest event is due.
+     */
+    uint64_t next() const {
+        return earliest;
+    }
+
+    /**
+     * @brief Sets the due time of `e`, replacing any earlier schedule.
+     * @param e The event to schedule.
+     * @param when Master clock value at which the event fires.
+     */
+    void schedule(Event e, uint64_t when) {
+        due[size_t(e)] = when;
+        earliest = *std::min_element(due.begin(), due.end());
+    }
+
+    /**
+     * @brief Makes `e` due no later than `when`, keeping its schedule if that is sooner.
+     * @param e The event to schedule.
+     * @param when Master clock value by which the event must fire.
+     */
+    void expedite(Event e, uint64_t when) {
+        if (when < due[size_t(e)]) {
+            due[size_t(e)] = when;
+            earliest = std::min(earliest, when);
+        }
+    }
+
+    /**
+     * @brief Cancels `e`.
+     */
+    void cancel(Event e) {
+        schedule(e, NEVER);
+    }
+
+    /**
+     * @brief Checks whether `e` is due at `now` and, if so, cancels it so the caller can handle it.
+     * @param e The event to check.
+     * @param now The current master clock value.
+     * @return True if the event was due.
+     */
+    bool take(Event e, uint64_t now) {
+        if (due[size_t(e)] > now) {
+            return false;
+        }
+
+        cancel(e);
+        return true;
+    }
+
+private:
+    std::array<uint64_t, size_t(Event::Count)> due;
+    uint64_t earliest;
+};
+
+#endif
@@ -3,70 +3,157 @@
 
 /**
  * @brief Constructor for the Timer object.
- * Initializes the divider register and timer counter to 0.
+ * Starts the internal counter and TIMA at 0 at master clock value 0.
+ * @param memory The memory controller holding the timer's I/O registers.
  */
-Timer::Timer() {
-    divider = 0;
-    timer = 0;
+Timer::Timer(Mem* memory) : memory(memory) {
+    origin = 0;
+    last = 0;
+    tima = 0;
+    control = 0;
 }
 
 /**
- * @brief Resets the divider register (DIV, 0xFF04) to 0.
+ * @brief Returns the TIMA period selected by TAC bits 0-1, in M-cycles.
+ *
+ * TIMA counts the falling edges of bit 3, 5, 7 or 9 of the internal T-cycle
+ * counter, i.e. once every 16, 64, 256 or 1024 T-cycles from the last DIV write.
+ */
+uint64_t Timer::period() const {
+    switch (control & 0x03) {
+    case 1:
+        return 4;
+    case 2:
+        return 16;
+    case 3:
+        return 64;
+    default:
+        return 256;
+    }
+}
+
+/**
+ * @brief Resets the internal counter, and with it DIV (0xFF04), to 0.
  * This typically happens when 0xFF04 is written to.
  */
 void Timer::resetdiv() {
-    divider = 0;
+    Machine* m = memory->machine;
+    uint64_t now = m->total_cycles;
+
+    advance<Mem>(now);
+
+    // The selected bit falls if it was set, as the whole counter drops to 0
+    if ((control & 0x04) && (now - origin) % period() >= period() / 2) {
+        increment<Mem>(1);
+    }
+
+    origin = now;
+    m->scheduler.schedule(Event::Timer, nextEvent());
+}
+
+void Timer::setControl(uint8_t TAC) {
+    Machine* m = memory->machine;
+
+    advance<Mem>(m->total_cycles);
+    control = TAC;
+    m->scheduler.schedule(Event::Timer, nextEvent());
+}
+
+void Timer::setCounter(uint8_t TIMA) {
+    Machine* m = memory->machine;
+
+    advance<Mem>(m->total_cycles);
+    tima = TIMA;
+    m->scheduler.schedule(Event::Timer, nextEvent());
+}
+
+uint8_t Timer::div() {
+    div_reads++;
+
+    // DIV is bits 8-15 of the T-cycle counter, i.e. it counts every 64 M-cycles
+    return uint8_t((memory->machine->total_cycles - origin) >> 6);
+}
+
+uint8_t Timer::counter() {
+    tima_reads++;
+    advance<Mem>(memory->machine->total_cycles);
+
+    return tima;
+}
+
+template<class M>
+uint64_t Timer::update(uint64_t now) {
+    advance<M>(now);
+
+    return nextEvent();
 }
 
 /**
- * @brief Ticks the timer system by the given number of CPU M-cycles.
+ * @brief Returns the master clock value of the next TIMA overflow.
  *
- * Updates the DIV register (0xFF04) based on elapsed cycles. The DIV register
- * increments at a rate of 16384 Hz (every 256 T-cycles / 64 M-cycles).
- * If the timer is enabled (TAC bit 2 is set), it updates the TIMA register (0xFF05)
- * at a frequency determined by TAC bits 0-1.
- * If TIMA overflows (goes past 0xFF), it is reset to the value of TMA (0xFF06),
- * and a timer interrupt flag (bit 2) is set in IF (0xFF0F).
- *
- * @param cycles The number of CPU M-cycles that have passed.
+ * TIMA increments on exact M-cycles, so the overflow lands on the first
+ * instruction boundary at or after it, just as if the timer were ticked after
+ * every instruction.
  */
-void Timer::tick(int cycles) {
-    divider += cycles;
-
-    if (divider >= 256) {
-        divider -= 256;
-        memory->set(0xff04, memory->get(0xff04) + 1);
+uint64_t Timer::nextEvent() const {
+    if (!(control & 0x04)) {
+        return Scheduler::NEVER;
     }
 
-    uint8_t TAC = memory->get(0xff07);
+    uint64_t p = period();
 
-    if (TAC & 0x04) {
-        timer += cycles * 4;
+    return origin + ((last - origin) / p + (0x100 - tima)) * p;
+}
 
-        unsigned int freq = 0;
+uint64_t Timer::nextChange(uint64_t after, bool div, bool tima) const {
+    after = std::max(after, origin);
 
-        switch (TAC & 0x03) {
-        case 1:
-            freq = 16; break;
-        case 2:
-            freq = 64; break;
-        case 3:
-            freq = 256; break;
-        default:
-            freq = 1024;
-        }
+    uint64_t next = div ? origin + ((after - origin) / 64 + 1) * 64 : Scheduler::NEVER;
 
-        while (timer >= freq) {
-            timer -= freq;
+    if (tima && (control & 0x04)) {
+        uint64_t p = period();
 
-            uint8_t TIMA = memory->get(0xff05) + 1;
+        next = std::min(next, origin + ((after - origin) / p + 1) * p);
+    }
 
-            if (TIMA == 0x00) {
-                TIMA = memory->get(0xff06);
-                memory->set(0xff0f, memory->get(0xff0f) | 0x04);
-            }
+    return next;
+}
 
-            memory->set(0xff05, TIMA);
-         }
+/**
+ * @brief Counts the TIMA increments since the last update.
+ *
+ * The number of falling edges between two clock values is the number of
+ * period boundaries, counted from the last DIV write, between them. If TIMA
+ * overflows (goes past 0xFF), it is reset to the value of TMA (0xFF06), and a
+ * timer interrupt flag (bit 2) is set in IF (0xFF0F).
+ *
+ * @tparam M The concrete memory controller type of `memory`.
+ * @param now The current master clock value (M-cycles).
+ */
+template<class M>
+void Timer::advance(uint64_t now) {
+    if (control & 0x04) {
+        uint64_t p = period();
+
+        increment<M>((now - origin) / p - (last - origin) / p);
+    }
+
+    last = now;
+}
+
+template<class M>
+void Timer::increment(uint64_t ticks) {
+    M* bus = static_cast<M*>(memory);
+
+    while (ticks >= 0x100u - tima) {
+        ticks -= 0x100u - tima;
+        tima = bus->get(0xff06);
+        bus->set(0xff0f, bus->get(0xff0f) | 0x04);
     }
-}
\ No newline at end of file
+
+    tima += ticks;
+}
+
+#define GB_INSTANTIATE_TIMER(M) template uint64_t Timer::update<M>(uint64_t);
+GB_MAPPERS(GB_INSTANTIATE_TIMER)
+#undef GB_INSTANTIATE_TIMER
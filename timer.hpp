@@ -3,31 +3,106 @@
 
 #include <cstdint> // For uint16_t
 
+class Mem;
+
 /**
  * @brief Game Boy Timer class.
  * Emulates the Game Boy's internal timer system, including the DIV, TIMA, TMA, and TAC registers.
+ *
+ * Nothing runs while the clock advances. DIV is the top byte of a counter of
+ * T-cycles since it was last written, so it is computed from the master clock
+ * whenever it is read. TIMA counts the falling edges of one bit of that same
+ * counter (picked by TAC); it is brought up to date when read or written,
+ * when TAC changes, and by the machine's `Event::Timer`, which is scheduled
+ * for the M-cycle TIMA next overflows.
  */
 class Timer {
 public:
     /**
      * @brief Constructor for the Timer.
      * Initializes timer registers.
+     * @param memory The memory controller holding the timer's I/O registers.
      */
-    Timer();
+    Timer(Mem* memory);
     /**
-     * @brief Resets the DIV register (0xFF04) to 0.
-     * This typically occurs when 0xFF04 is written to.
+     * @brief Handles a write to DIV (0xFF04), which restarts the internal counter.
+     * If the counter bit TIMA counts was set, that is a falling edge and TIMA increments.
      */
     void resetdiv();
     /**
-     * @brief Advances the timer state by a given number of CPU M-cycles.
-     * Updates DIV, TIMA, and handles TIMA overflow and interrupt requests.
-     * @param cycles The number of CPU M-cycles that have passed.
+     * @brief Handles a write to TAC (0xFF07).
+     * Runs the timer up to the current cycle at the old rate before switching,
+     * then reschedules the machine's `Event::Timer`.
+     * @param TAC The new TAC value.
+     */
+    void setControl(uint8_t TAC);
+    /**
+     * @brief Handles a write to TIMA (0xFF05) and reschedules the machine's `Event::Timer`.
+     * @param TIMA The new TIMA value.
+     */
+    void setCounter(uint8_t TIMA);
+    /**
+     * @brief Returns DIV (0xFF04) as of the machine's current M-cycle.
+     */
+    uint8_t div();
+    /**
+     * @brief Returns TIMA (0xFF05) as of the machine's current M-cycle.
+     */
+    uint8_t counter();
+    /**
+     * @brief Runs the timer up to the master clock value `now`: the TIMA overflow event.
+     * @tparam M The concrete memory controller type of `memory`.
+     * @param now The current master clock value (M-cycles).
+     * @return The master clock value of the next TIMA overflow.
+     */
+    template<class M> uint64_t update(uint64_t now);
+    /**
+     * @brief Returns the master clock value of the next TIMA overflow, or
+     * `Scheduler::NEVER` while TIMA is stopped.
+     */
+    uint64_t nextEvent() const;
+    /**
+     * @brief Returns the first master clock value after `after` at which DIV (if
+     * `div`) or TIMA (if `tima`) reads differently. Unlike an overflow, such a
+     * change runs no event.
+     */
+    uint64_t nextChange(uint64_t after, bool div, bool tima) const;
+    /**
+     * @brief Returns how many times DIV has been read, so a polling loop can tell
+     * whether it is waiting on it (see `Machine::skipIdleLoop`).
      */
-    void tick(int cycles);
+    uint64_t divReads() const {
+        return div_reads;
+    }
+    /**
+     * @brief Returns how many times TIMA has been read (see `divReads`).
+     */
+    uint64_t timaReads() const {
+        return tima_reads;
+    }
 private:
-    uint16_t divider;    // Internal counter for DIV register increments
-    unsigned int timer;  // Internal counter for TIMA increments
+    /**
+     * @brief Brings TIMA up to the master clock value `now`, reloading it from TMA
+     * and requesting the timer interrupt on every overflow on the way.
+     * @tparam M The concrete memory controller type of `memory`.
+     */
+    template<class M> void advance(uint64_t now);
+    /**
+     * @brief Adds `ticks` to TIMA, handling overflows like `advance`.
+     */
+    template<class M> void increment(uint64_t ticks);
+    /**
+     * @brief Returns the M-cycles between TIMA increments selected by TAC bits 0-1.
+     */
+    uint64_t period() const;
+
+    Mem* memory;
+    uint64_t origin;     // Master clock value at which the internal counter was last 0
+    uint64_t last;       // Master clock value TIMA is up to date with
+    uint8_t tima;        // TIMA as of `last`
+    uint8_t control;     // TAC as of `last`
+    uint64_t div_reads = 0;
+    uint64_t tima_reads = 0;
 };
 
-#endif
\ No newline at end of file
+#endif